@@ -0,0 +1,129 @@
+"""Helpers shared by the test scripts: running ./db, talking to a server and
+reading what either prints."""
+import signal
+import socket
+import subprocess
+import time
+
+def run_db(db_file, commands, extra_args=[], settle=0):
+    """Runs the commands in a fresh ./db and returns what it printed"""
+    process = subprocess.Popen(
+        ["./db", db_file] + extra_args,
+        stdin=subprocess.PIPE,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        text=True,
+    )
+    # Traffic after a restart does not arrive the instant the process starts
+    time.sleep(settle)
+    stdout, _ = process.communicate("\n".join(commands + [".exit"]) + "\n")
+    return stdout
+
+def crash_db(db_file, commands, extra_args=[], wait=1.0):
+    """Runs the commands, then kills the process before it can close"""
+    process = subprocess.Popen(
+        ["./db", db_file] + extra_args,
+        stdin=subprocess.PIPE,
+        stdout=subprocess.PIPE,
+        text=True,
+    )
+    process.stdin.write("\n".join(commands) + "\n")
+    process.stdin.flush()
+    time.sleep(wait)
+    process.send_signal(signal.SIGKILL)
+    output = process.stdout.read()
+    process.wait()
+    return output
+
+def lines_of(output):
+    return output.split("\n") if isinstance(output, str) else output
+
+def parse_stats(output):
+    """The .stats counters in output, the last value of each"""
+    stats = {}
+    for line in lines_of(output):
+        parts = line.replace("db > ", "").split(" ")
+        if len(parts) == 2 and parts[1].replace(".", "").isdigit():
+            stats[parts[0]] = float(parts[1])
+    return stats
+
+def rows_of(output):
+    return [line.replace("db > ", "") for line in lines_of(output)
+            if line.replace("db > ", "").startswith("(")]
+
+def insert_users(ids):
+    return [f"insert into users values ({i}, 'user{i}', 'user{i}@example.com')"
+            for i in ids]
+
+def user_rows(ids):
+    return [f"({i}, user{i}, user{i}@example.com)" for i in ids]
+
+class Client:
+    """A session with ./db --server"""
+    def __init__(self, port, timeout=30, receive_buffer=None):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        if receive_buffer is not None:
+            self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF,
+                                 receive_buffer)
+        self.sock.connect(("localhost", port))
+        self.timeout = timeout
+        self.sock.settimeout(timeout)
+        self.pending = b""
+
+    def send(self, command):
+        self.sock.sendall((command + "\n").encode())
+
+    def reply(self, end=b"Executed.\n"):
+        """Reads the lines up to the next end marker"""
+        while end not in self.pending:
+            data = self.sock.recv(65536)
+            if not data:
+                raise ConnectionError("server closed the connection")
+            self.pending += data
+        index = self.pending.index(end) + len(end)
+        reply, self.pending = self.pending[:index], self.pending[index:]
+        return reply.decode().split("\n")[:-1]
+
+    def execute(self, command):
+        self.send(command)
+        return self.reply()
+
+    def close(self):
+        self.sock.close()
+
+def start_server(db_file, port, extra_args=[]):
+    """Starts ./db --server and waits until it accepts connections"""
+    server = subprocess.Popen(["./db", db_file, "--server"] + extra_args,
+                              stdout=subprocess.DEVNULL,
+                              stderr=subprocess.DEVNULL)
+    for _ in range(100):
+        try:
+            Client(port).close()
+            return server
+        except ConnectionRefusedError:
+            if server.poll() is not None:
+                break
+            time.sleep(0.1)
+    server.kill()
+    raise RuntimeError(f"server on port {port} did not start")
+
+def server_stats(port):
+    """Sums the counters of every pager, read on a connection of its own"""
+    client = Client(port, timeout=0.5)
+    client.send(".stats")
+    output = b""
+    try:
+        while True:
+            data = client.sock.recv(65536)
+            if not data:
+                break
+            output += data
+    except socket.timeout:
+        pass
+    client.close()
+    totals = {}
+    for line in output.decode().split("\n"):
+        parts = line.split(" ")
+        if len(parts) == 2 and parts[1].replace(".", "").isdigit():
+            totals[parts[0]] = totals.get(parts[0], 0) + float(parts[1])
+    return totals
@@ -30,7 +30,9 @@ typedef enum {
   STATEMENT_CREATE_TABLE,
   STATEMENT_SHOW_TABLES,
   STATEMENT_DESC_TABLE,
-  STATEMENT_SHOW_INDEX
+  STATEMENT_SHOW_INDEX,
+  STATEMENT_REORGANIZE,
+  STATEMENT_DROP_TABLE
 } StatementType;
 
 typedef struct {
@@ -0,0 +1,22 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Small LZ77 codec in the style of LZ4's block format. Each sequence is a
+ * token byte (literal count in the high nibble, match length - 4 in the low
+ * one, 15 meaning more length bytes follow), the literals, a 16-bit
+ * little-endian match offset and any extra match length bytes. The last
+ * sequence carries literals only.
+ */
+
+// Returns the compressed size, or 0 if it would not fit in dst_capacity
+uint32_t lz_compress(const uint8_t *src, uint32_t src_len, uint8_t *dst,
+                     uint32_t dst_capacity);
+// Returns false if src is malformed or does not expand to exactly dst_len
+bool lz_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst,
+                   uint32_t dst_len);
+
+#endif
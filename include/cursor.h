@@ -6,17 +6,26 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+// Read-ahead window for scans, in leaf pages
+#define READ_AHEAD_MIN_LEAVES 4
+#define READ_AHEAD_MAX_LEAVES 64
+
 typedef struct Cursor {
   Table *table;
   uint32_t page_num;
   uint32_t cell_num;
   bool end_of_table;
+
+  // Scan read-ahead state
+  uint32_t sequential_leaves; // Leaves reached by following next_leaf
+  uint32_t readahead_window;  // Leaves requested by the last read-ahead
+  uint32_t readahead_left;    // Requested leaves the cursor has not reached
 } Cursor;
 
 Cursor *table_start(Table *table, uint32_t root_page_num);
 Cursor *table_end(Table *table, uint32_t root_page_num);
 Cursor *table_find(Table *table, uint32_t root_page_num, void *key,
-                   uint32_t key_size, KeyType key_type);
+                   uint32_t key_size, uint32_t value_size, KeyType key_type);
 void *cursor_value(Cursor *cursor);
 void cursor_advance(Cursor *cursor);
 
@@ -0,0 +1,38 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+#include "table.h"
+#include <stdint.h>
+
+/*
+ * Binary dump of a database, written by "db <file> --dump <dump>" and read
+ * back by "db <file> --load <dump>". The dump is a DumpHeader followed by
+ * one DumpTable per table, each followed by its rows in key order: batches
+ * of a row count and that many rows of row_size bytes, the last batch empty.
+ * A DumpTable with an empty name ends the dump. Numbers are in host byte
+ * order.
+ *
+ * A load sorts the rows of each table, merges them with any rows the table
+ * already has, and builds the tree bottom up with bulk_load_tree() instead
+ * of inserting them one by one.
+ */
+#define DUMP_MAGIC 0x504d5544 // "DUMP"
+#define DUMP_VERSION 1
+#define DUMP_BATCH_ROWS 1024
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+} DumpHeader;
+
+typedef struct {
+  char name[TABLE_NAME_SIZE];
+  uint32_t num_columns;
+  uint32_t row_size;
+  Column columns[MAX_COLUMNS];
+} DumpTable;
+
+void dump_database(Table *table, const char *path);
+void load_database(Table *table, const char *path);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef LOCK_H
+#define LOCK_H
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Page locks for transactions, held until COMMIT or ROLLBACK (strict
+ * two-phase locking). A transaction takes a shared lock on every page it
+ * fetches and an exclusive lock on every page it changes, so two clients
+ * can work on different leaves of a table side by side. A transaction that
+ * needs a page another one holds waits for it, letting other statements run
+ * meanwhile. If waiting would close a cycle the waiter is rolled back
+ * instead: its statement unwinds to execute_statement() and fails with a
+ * deadlock error.
+ *
+ * The meta page (page 0) holds the allocator's state and is never locked.
+ * Pages a transaction frees only go on the freelist when it commits.
+ */
+#define LOCK_BUCKETS 1024
+
+typedef enum { LOCK_SHARED, LOCK_EXCLUSIVE } LockMode;
+
+struct Pager;
+struct Table;
+struct Transaction;
+
+typedef struct LockGrant {
+  struct Transaction *transaction;
+  LockMode mode;
+  struct PageLock *lock;
+  struct LockGrant *next;             // Other holders of the same page
+  struct LockGrant *transaction_next; // Other pages of the same transaction
+} LockGrant;
+
+typedef struct PageLock {
+  struct Pager *pager;
+  uint32_t page_num;
+  LockGrant *grants;
+  uint32_t waiters;      // Kept while nonzero, even with no grants left
+  struct PageLock *next; // Same bucket
+} PageLock;
+
+typedef struct Transaction {
+  uint32_t id; // Nonzero while open; pages it changes carry it, see pager.h
+  struct LockTable *locks;
+  struct Table *db; // Whose statement gate to let go of while waiting
+  LockGrant *grants;
+  // The lock being waited for, NULL if none, and in which mode
+  PageLock *waiting_for;
+  LockMode waiting_mode;
+  uint32_t visited; // Deadlock search that last went through this one
+  jmp_buf *abort;   // Where its running statement unwinds to
+} Transaction;
+
+typedef struct {
+  _Atomic uint64_t lock_waits;
+  _Atomic uint64_t deadlocks;
+} LockStats;
+
+typedef struct LockTable {
+  // Guards everything below
+  pthread_mutex_t mutex;
+  pthread_cond_t released; // Signalled whenever a transaction ends
+  PageLock *buckets[LOCK_BUCKETS];
+  uint32_t num_grants;
+  uint32_t next_id;
+  uint32_t search; // Numbers deadlock searches
+  LockStats stats;
+} LockTable;
+
+void lock_table_init(LockTable *locks);
+void lock_table_destroy(LockTable *locks);
+void lock_begin(LockTable *locks, Transaction *transaction, struct Table *db);
+void lock_release_all(Transaction *transaction);
+bool lock_busy(LockTable *locks);
+void lock_wait_until_idle(LockTable *locks, struct Table *db);
+void lock_set_current(Transaction *transaction);
+Transaction *lock_current(void);
+uint32_t lock_current_id(void);
+void lock_page(struct Pager *pager, uint32_t page_num, LockMode mode);
+void lock_print_stats(LockTable *locks, int out_fd);
+void lock_reset_stats(LockTable *locks);
+
+#endif
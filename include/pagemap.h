@@ -0,0 +1,73 @@
+#ifndef PAGEMAP_H
+#define PAGEMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Storage for compressed databases. The file starts with a fixed header,
+ * followed by slots holding one compressed page each, in whole sectors. The
+ * page map (one PageSlot per page) is itself stored in a slot and the header
+ * points at the current copy.
+ *
+ * Nothing the header can reach is ever overwritten. A changed page goes to a
+ * fresh slot, and the slot it replaces stays reserved until a checkpoint has
+ * durably pointed the header at a map without it, so a crash at any point
+ * leaves the last checkpoint readable.
+ */
+#define PAGE_MAP_MAGIC 0x5a424443 // "CDBZ"
+#define PAGE_MAP_VERSION 1
+#define PAGE_MAP_HEADER_SIZE 512
+#define PAGE_MAP_SECTOR_SIZE 512
+
+typedef struct {
+  uint64_t offset;   // 0 if the page was never written
+  uint32_t length;   // Stored bytes; equal to the page size if uncompressed
+  uint32_t capacity; // Slot size, a multiple of the sector size
+} PageSlot;
+
+typedef struct {
+  uint64_t offset;
+  uint64_t length;
+} FreeExtent;
+
+typedef struct PageMap {
+  int file_descriptor;
+  uint32_t page_size;
+
+  uint32_t num_pages; // Pages with an entry in slots
+  uint32_t slots_capacity;
+  PageSlot *slots;
+  bool *unsynced; // Per page: slot written since the last checkpoint
+
+  PageSlot map_slot; // Where the page map was last written
+  bool dirty;        // Slots changed since the last checkpoint
+  uint64_t file_end; // End of the last allocated slot
+
+  // Unused space below file_end, sorted by offset and coalesced
+  FreeExtent *free;
+  uint32_t num_free;
+  uint32_t free_capacity;
+
+  // Slots the checkpointed map still uses, freed by the next checkpoint
+  FreeExtent *pending;
+  uint32_t num_pending;
+  uint32_t pending_capacity;
+
+  uint8_t *scratch; // Compression buffer, one page long
+} PageMap;
+
+bool page_map_probe(int fd, uint32_t *page_size);
+PageMap *page_map_open(int fd, uint32_t page_size, bool create);
+void page_map_close(PageMap *map);
+// Both return the number of bytes that went to or came from the file
+uint32_t page_map_read(PageMap *map, uint32_t page_num, void *destination);
+uint32_t page_map_write(PageMap *map, uint32_t page_num, const void *source);
+// Forgets every page from num_pages on and frees their slots
+void page_map_truncate(PageMap *map, uint32_t num_pages);
+// Makes a batch of page writes durable: syncs the pages and a new copy of
+// the map, then the header, and only then frees the slots they replaced
+void page_map_checkpoint(PageMap *map);
+uint64_t page_map_stored_bytes(PageMap *map);
+
+#endif
@@ -1,21 +1,393 @@
 #ifndef PAGER_H
 #define PAGER_H
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include "uring.h"
 
-#define TABLE_MAX_PAGES 400
+#define DEFAULT_CACHE_FRAMES 1024
+#define MIN_CACHE_FRAMES 16
 
+// Page size is fixed when a database is created
+#define DEFAULT_PAGE_SIZE 4096
+#define MIN_PAGE_SIZE 4096
+#define MAX_PAGE_SIZE 65536
+
+// Explicit huge page size assumed when backing the frame arena with them
+#define HUGE_PAGE_SIZE (2u << 20)
+
+// Warm-up files list cached pages at shutdown for the next start to preload
+#define WARM_LIST_MAGIC 0x4d524157 // "WARM"
+#define WARM_UP_BATCH_PAGES 256
+#define WARM_LIST_SUFFIX ".warm"
+
+/*
+ * Background flusher: every FLUSHER_INTERVAL_MS it writes back dirty pages,
+ * oldest first, once they are older than FLUSHER_MAX_AGE_MS or make up more
+ * than FLUSHER_DIRTY_PERCENT of the pool. At most flush_rate pages per
+ * second are written.
+ */
+#define FLUSHER_INTERVAL_MS 100
+#define FLUSHER_MAX_AGE_MS 1000
+#define FLUSHER_DIRTY_PERCENT 10
+#define DEFAULT_FLUSH_RATE 1000
+
+/*
+ * Pages past the end of the file are handed to each B-tree EXTENT_PAGES at a
+ * time, so a tree that grows alongside others still gets runs of adjacent
+ * pages and its leaf chain stays mostly sequential on disk. Extents are
+ * preallocated with fallocate() where the file system supports it.
+ */
+#define EXTENT_PAGES 64
+
+// WAL mode: the log is checkpointed into the file once a commit leaves it
+// holding this many page images
+#define WAL_CHECKPOINT_FRAMES 1000
+
+// Address space reserved for the file mapping in mmap mode, in bytes
+#define MMAP_WINDOW_SIZE (1ull << 30)
+
+// Page table latches; a page's partition is picked by its low bits
+#define PAGER_PARTITIONS 16
+
+/*
+ * Snapshot reads. Pages change in write windows: each statement, numbered
+ * one past the last committed window. A transaction's changes belong to the
+ * window of the statement that commits it. A snapshot sees the database as
+ * of the last commit before it began. The first time a window fetches a page
+ * that a snapshot may still need, the page is saved as a version before it
+ * can change; transactions use their undo images for this and turn the
+ * changed ones into versions when they commit. Versions are freed once no
+ * snapshot is older than the window that replaced them.
+ *
+ * A snapshot reader is given copies rather than frames, so writers never
+ * wait for it. Like an unpinned frame, a copy stays valid until the thread
+ * has read SNAPSHOT_COPIES other pages.
+ */
+#define SNAPSHOT_COPIES 64
+#define VERSION_BUCKETS 1024
+
+// Pins one thread may hold through pin_page() at a time
+#define THREAD_PINS 256
+
+// Pages a thread last fetched with get_page() that it keeps pinned until
+// its statement ends, see get_page()
+#define RECENT_PINS 4
+
+// An online backup reads the database file in chunks of this many bytes
+#define BACKUP_CHUNK_BYTES (1u << 20)
+
+#define NO_FRAME UINT32_MAX
+#define NO_PAGE UINT32_MAX
+
+/*
+ * Page numbers are 32 bits wide in memory and in every on-disk pointer
+ * (parents, children, leaf siblings, the freelist), which allows files of up
+ * to 2^32 - 1 pages: 16TB at the default page size. Byte offsets are always
+ * 64-bit. Widening page numbers is a format change that starts here: the node
+ * layout sizes its pointers with PAGE_NUM_SIZE.
+ */
+#define PAGE_NUM_SIZE sizeof(uint32_t)
+#define MAX_PAGES NO_PAGE
+
+/*
+ * Meta page (page 0) fields owned by the pager. Offsets 0-15 hold the table
+ * layer's root page numbers. Free pages are chained through their first word.
+ * The page size is read straight from the file, before any page is cached.
+ */
+#define META_FREELIST_HEAD_OFFSET 16
+#define META_FREELIST_COUNT_OFFSET 20
+#define META_PAGE_SIZE_OFFSET 24
+#define FREE_PAGE_NEXT_OFFSET 0
+
+typedef enum { ACCESS_RANDOM, ACCESS_SEQUENTIAL } AccessPattern;
+
+/*
+ * Latency histograms use power-of-two microsecond buckets: bucket 0 counts
+ * operations under 1us, bucket i those under 2^i us, and the last bucket
+ * everything slower.
+ */
+#define LATENCY_BUCKETS 24
+
+typedef struct {
+  _Atomic uint64_t hits;
+  _Atomic uint64_t misses;
+  _Atomic uint64_t evictions;
+  _Atomic uint64_t dirty_evictions;
+  _Atomic uint64_t pages_read;
+  _Atomic uint64_t bytes_read;
+  _Atomic uint64_t pages_written;
+  _Atomic uint64_t bytes_written;
+  // Write-back operations: single pages or whole batches
+  _Atomic uint64_t flushes;
+  _Atomic uint64_t prefetched_pages;
+  _Atomic uint64_t warmed_pages;     // Loaded from the warm-up list
+  _Atomic uint64_t background_pages; // Written by the background flusher
+  _Atomic uint64_t extents_reserved;
+  _Atomic uint64_t wal_frames;  // Page images appended to the log
+  _Atomic uint64_t wal_commits;
+  _Atomic uint64_t wal_syncs;   // Commits that ran fdatasync() themselves
+  _Atomic uint64_t checkpoints;
+  _Atomic uint64_t syncs; // pager_sync() calls that had changes to sync
+  _Atomic uint64_t rollbacks;
+  _Atomic uint64_t rollback_discards; // Dirty pages dropped by rollbacks
+  _Atomic uint64_t rollback_restores; // Dirty pages put back from undo images
+  _Atomic uint64_t undo_images;       // Before-images saved by transactions
+  _Atomic uint64_t snapshots;
+  _Atomic uint64_t versions_saved;
+  _Atomic uint64_t version_reads; // Snapshot reads of replaced pages
+  _Atomic uint64_t read_latency[LATENCY_BUCKETS];
+  _Atomic uint64_t flush_latency[LATENCY_BUCKETS];
+} PagerStats;
+
+typedef struct {
+  uint32_t cache_frames; // Buffer pool budget, in pages
+  bool use_mmap;         // Serve cache misses from a mapping of the file
+  bool use_io_uring;     // Submit batched reads and writes through io_uring
+  uint32_t page_size;    // Used only when creating a new database
+  bool use_direct_io;    // Bypass the kernel page cache with O_DIRECT
+  bool use_huge_pages;   // Back the frame arena with huge pages if possible
+  bool compress;         // Create new databases with compressed pages
+  bool warm_up;          // Preload last run's hot pages; save them on close
+  bool background_flush; // Trickle dirty pages out from a flusher thread
+  uint32_t flush_rate;   // Flusher budget, in pages per second
+  bool file_per_table;   // New databases keep each table in a file of its own
+  bool use_wal;          // Write pages to a write-ahead log, see wal.h
+} PagerOptions;
+
+/*
+ * One slot of the buffer pool. A frame holds at most one page; frames that
+ * are pinned are never chosen as eviction victims. page_num, dirty, loading
+ * and hash_next change only under the latch of the page's partition.
+ */
+typedef struct {
+  uint32_t page_num; // NO_PAGE if the frame is free
+  void *data;        // Either buffer or a page inside the file mapping
+  void *buffer;      // This frame's slot in the frame arena
+  bool mapped;
+  atomic_uint pin_count;
+  atomic_bool referenced; // CLOCK second-chance bit
+  bool dirty;
+  bool loading;       // Being read in; other users wait for it to finish
+  uint32_t accesses;  // Lookups since it was read, ranks the warm-up list
+  uint64_t dirtied_at; // When it last became dirty, in monotonic us
+  // The open transaction whose before-image is in the undo slot, 0 if none,
+  // and whether the page was dirty when it was saved
+  uint32_t undo_owner;
+  bool undo_dirty;
+  uint64_t write_ts;   // Last write window that fetched the page
+  uint32_t hash_next; // Next frame in the same page table bucket
+  pthread_rwlock_t latch; // Page contents, see pager_acquire()
+} Frame;
+
+// Pages reserved for one tree, named by its root page number
 typedef struct {
+  uint32_t owner;
+  uint32_t next; // Next page to hand out
+  uint32_t end;  // One past the last reserved page
+} Extent;
+
+typedef struct {
+  pthread_mutex_t latch;
+  pthread_cond_t loaded; // Signalled when a frame's read completes
+} PagePartition;
+
+// A page as it was until write window valid_until replaced it
+typedef struct PageVersion {
+  uint32_t page_num;
+  uint64_t valid_until;
+  struct PageVersion *next; // Same bucket, newest first
+  char data[];
+} PageVersion;
+
+// One thread's snapshot of one pager
+typedef struct PagerSnapshot {
+  struct Pager *pager;
+  uint64_t ts; // Last window it sees
+  void *copies;
+  uint32_t copy_pages[SNAPSHOT_COPIES]; // NO_PAGE for an unused copy
+  uint32_t next_copy;
+  void *target;                       // Copy being filled by pager_fetch()
+  struct PagerSnapshot *next;         // The pager's other snapshots
+  struct PagerSnapshot *thread_next;  // The thread's snapshots of other pagers
+} PagerSnapshot;
+
+/*
+ * A page an open transaction allocated or freed. The freelist is only
+ * changed once the transaction ends: freed pages go on it at COMMIT, and
+ * allocated ones at ROLLBACK.
+ */
+typedef struct {
+  uint32_t page_num;
+  uint32_t owner;
+  bool allocated;
+} PendingPage;
+
+typedef struct Pager {
   int file_descriptor;
-  uint32_t file_length;
-  uint32_t num_pages;
-  void *pages[TABLE_MAX_PAGES];
+  uint32_t page_size;
+  _Atomic uint64_t file_length; // Bytes
+  atomic_uint num_pages;
+
+  // Buffer pool
+  uint32_t num_frames;
+  uint32_t frames_used; // Frames handed out at least once
+  Frame *frames;
+  uint32_t clock_hand;
+  // Guards frames_used and clock_hand; taken before any partition latch
+  pthread_mutex_t clock_latch;
+  // Frames pinned by read-ahead batches of all threads, see
+  // pager_read_pages()
+  atomic_uint read_ahead_frames;
+
+  // One page-aligned allocation holding every frame's buffer
+  void *arena;
+  size_t arena_size;
+  bool direct_io;
+
+  // Page table: page number -> frame index, chained through Frame.hash_next
+  uint32_t *page_table;
+  uint32_t page_table_size; // Power of two, at least PAGER_PARTITIONS
+  PagePartition partitions[PAGER_PARTITIONS];
+
+  // Serializes the freelist in the meta page and the extents
+  pthread_mutex_t alloc_latch;
+  Extent *extents;
+  uint32_t num_extents;
+  uint32_t extents_capacity;
+  PendingPage *pending_pages;
+  uint32_t num_pending_pages;
+  uint32_t pending_pages_capacity;
+  // Serializes the io_uring queues and the page map, neither of which is
+  // safe to share
+  pthread_mutex_t io_latch;
+
+  // Open transactions save each page the first time they change it in the
+  // frame's slot of this arena, so ROLLBACK can restore it in place. Such
+  // frames are neither evicted nor written until the transaction ends, see
+  // pager_end_transaction().
+  void *undo_arena;
+  atomic_uint dirty_pages;
+  // Pages changed or written since the last pager_sync()
+  atomic_bool unsynced;
+
+  // Snapshot reads. The window fields change only under the statement
+  // latch and version_lock; the rest is guarded by version_lock alone.
+  pthread_mutex_t version_lock;
+  pthread_cond_t snapshots_done; // Signalled when the last snapshot ends
+  uint64_t commit_ts;            // Last committed write window
+  _Atomic uint64_t write_ts;     // Open write window, 0 if none
+  bool versioned;                // The open window saves versions
+  PagerSnapshot *snapshots;
+  PageVersion **versions; // VERSION_BUCKETS chains
+  uint32_t live_versions;
+  // Pages saved by the open window, checked for changes when it commits
+  uint32_t *window_pages;
+  uint32_t window_count;
+  uint32_t window_capacity;
+
+  // Online backup, see pager_begin_backup(): a bitmap of the backup's
+  // backup_pages pages, set for each one written to the file since it
+  // began. Guarded by backup_lock; NULL while no backup runs.
+  pthread_mutex_t backup_lock;
+  atomic_bool backup_running;
+  uint8_t *backup_written;
+  uint32_t backup_pages;
+
+  // Held by the statement that is modifying pages, see
+  // pager_begin_statement()
+  pthread_mutex_t statement_latch;
+
+  // mmap mode: MAP_PRIVATE view of the file, so writes stay in memory until
+  // they are flushed
+  void *map;
+  uint32_t map_pages;
+  AccessPattern access_pattern;
+
+  // Batched I/O; NULL means every batch is issued with preadv()/pwritev()
+  IoRing *ring;
+
+  // Compressed databases only: where each page is stored in the file
+  struct PageMap *page_map;
+
+  // WAL mode only: pages are written to the log and reach the file at
+  // checkpoints, so the log is consulted before the file on a cache miss
+  struct Wal *wal;
+
+  // Primary of replicas only: every page written is handed to
+  // replication_capture(), and each pager_commit() ships them as a commit
+  struct Replication *_Atomic replication;
+
+  // Background preload started by pager_warm_up()
+  pthread_t warm_thread;
+  bool warm_running;
+  atomic_bool warm_stop;
+  uint32_t *warm_pages; // Sorted
+  uint32_t warm_count;
+
+  // Background flusher, sleeping on flusher_wake between rounds
+  pthread_t flusher_thread;
+  bool flusher_running;
+  bool flusher_stop; // Guarded by flusher_lock
+  uint32_t flush_rate;
+  pthread_mutex_t flusher_lock;
+  pthread_cond_t flusher_wake;
+
+  PagerStats stats;
 } Pager;
 
-Pager *pager_open(const char *filename);
+/*
+ * get_page(), pin_page(), unpin_page(), pager_acquire(), pager_release(),
+ * pager_mark_dirty(), pager_prefetch() and page allocation may be called from
+ * any number of threads. Whole-pool operations (pager_flush_all(),
+ * pager_end_transaction(), pager_compact(), pager_close()) may run alongside
+ * readers and read-ahead, such as the warm-up thread, but not alongside other
+ * writers.
+ *
+ * Inside a transaction (see lock.h) get_page() and pin_page() lock the page
+ * shared and pager_mark_dirty() exclusive, so either may wait, or unwind the
+ * statement when waiting would deadlock; mark a page dirty before changing
+ * it. Pins taken with pin_page() are given back by pager_unpin_thread() then,
+ * along with those get_page() keeps for the thread's last RECENT_PINS pages.
+ */
+void pager_options_init(PagerOptions *options);
+bool pager_valid_page_size(uint32_t page_size);
+Pager *pager_open(const char *filename, PagerOptions *options);
+void pager_close(Pager *pager);
 void *get_page(Pager *pager, uint32_t page_num);
+void *pin_page(Pager *pager, uint32_t page_num);
+void unpin_page(Pager *pager, uint32_t page_num);
+void *pager_acquire(Pager *pager, uint32_t page_num, bool exclusive);
+void pager_release(Pager *pager, uint32_t page_num);
+void pager_mark_dirty(Pager *pager, uint32_t page_num);
 void pager_flush(Pager *pager, uint32_t page_num, uint32_t size);
-void pager_rollback(Pager *pager);
+uint64_t pager_commit(Pager *pager);
+void pager_wait_for_commit(Pager *pager, uint64_t lsn);
+void pager_flush_all(Pager *pager);
+void pager_sync(Pager *pager);
+void pager_end_transaction(Pager *pager, uint32_t transaction, bool commit);
+void pager_unpin_thread(void);
+void pager_begin_snapshot(Pager *pager);
+void pager_end_snapshot(Pager *pager);
+void pager_wait_for_snapshots(Pager *pager);
+void pager_access_hint(Pager *pager, AccessPattern pattern);
+uint32_t pager_prefetch(Pager *pager, const uint32_t *page_nums,
+                        uint32_t count);
+void pager_begin_statement(Pager *pager);
+void pager_end_statement(Pager *pager);
+void pager_warm_up(Pager *pager, const char *path);
+void pager_save_warm_list(Pager *pager, const char *path);
+void pager_print_stats(Pager *pager, int out_fd);
+void pager_reset_stats(Pager *pager);
 uint32_t get_unused_page_num(Pager *pager);
+uint32_t pager_allocate_page(Pager *pager, uint32_t owner);
+void pager_free_page(Pager *pager, uint32_t page_num);
+uint32_t pager_compact(Pager *pager);
+void pager_begin_backup(Pager *pager);
+bool pager_backup(Pager *pager, const char *path, uint32_t *pages,
+                  uint32_t *recopied);
 
 #endif
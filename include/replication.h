@@ -0,0 +1,91 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include "table.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Log-shipping replication. A primary started with "--replicate <port>"
+ * listens there for replicas, started with "--replica-of <host:port>".
+ *
+ * A replica that connects is sent a ReplicationHeader and a copy of every
+ * page as of the last commit, which it writes over its own database file
+ * before opening it. From then on it is sent each commit in turn: a page
+ * number and the page for every page the commit wrote to the database file,
+ * or in WAL mode to the log, then REPLICATION_COMMIT. The replica applies a
+ * commit's pages in a statement of their own, so its readers see whole
+ * commits only, and serves read-only queries meanwhile. Numbers are in host
+ * byte order.
+ *
+ * Only what reaches the file is shipped, so autocommitted statements go out
+ * at the next sync; replicating turns ".sync off" into ".sync normal". A
+ * replica that falls more than REPLICATION_MAX_LAG_BYTES behind is
+ * disconnected and copies the database afresh when restarted.
+ */
+#define REPLICATION_MAGIC 0x4c504552 // "REPL"
+#define REPLICATION_COMMIT UINT32_MAX
+#define REPLICATION_MAX_LAG_BYTES (256u << 20)
+
+typedef struct {
+  uint32_t magic;
+  uint32_t page_size;
+  uint32_t num_pages;
+} ReplicationHeader;
+
+// One commit's page numbers and pages, followed by REPLICATION_COMMIT
+typedef struct ReplicationBatch {
+  uint64_t seq;
+  uint32_t size;
+  uint32_t senders; // Replicas it has yet to be sent to
+  struct ReplicationBatch *next;
+  uint8_t data[];
+} ReplicationBatch;
+
+typedef struct Replica {
+  struct Replication *replication;
+  int fd;
+  uint64_t next_seq; // Batches before this one are not its to send
+  uint64_t last_seq; // Nor those after this one, once it is dropped
+  uint64_t lag;      // Bytes of batches not yet sent to it
+  bool dropped;
+  struct Replica *next;
+} Replica;
+
+/*
+ * A primary's replication state, hung off its pager. Pages written since
+ * the last commit collect in pending until pager_commit() ends the
+ * commit. Everything is guarded by lock.
+ */
+typedef struct Replication {
+  Table *table;
+  uint32_t page_size;
+  int listen_fd;
+  pthread_t accept_thread;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake; // Signalled for each new batch
+  uint8_t *pending;
+  uint32_t pending_size;
+  uint32_t pending_capacity;
+  uint64_t next_seq;
+  ReplicationBatch *batches; // Oldest first
+  ReplicationBatch *last;
+  Replica *replicas;
+
+  _Atomic uint64_t batches_shipped;
+  _Atomic uint64_t bytes_shipped;
+} Replication;
+
+void replication_start(Table *table, int port);
+void replication_capture(Replication *replication, uint32_t page_num,
+                         const void *page);
+void replication_commit(Replication *replication);
+void replication_print_stats(Replication *replication, int out_fd);
+void replication_reset_stats(Replication *replication);
+int replica_copy(const char *filename, const char *primary);
+void replica_start(Table *table, int fd);
+
+#endif
@@ -1,18 +1,45 @@
 #ifndef TABLE_H
 #define TABLE_H
 
+#include "lock.h"
 #include "pager.h"
 #include "row.h"
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 
-#define PAGE_SIZE 4096
-
 #define MAX_TABLES 10
 #define TABLE_NAME_SIZE 32
 
 #define MAX_COLUMNS 10
 
+/*
+ * File-per-table mode: the database file is only a catalog (meta and
+ * directory pages), and each table lives with its index in
+ * <database file>.<table>.tbl. A table file has its own meta page on page 0
+ * and the table's root on page 1; the users table keeps its username index
+ * root on page 2, as in a single-file database. The mode is chosen when the
+ * database is created and recorded in the catalog's meta page.
+ */
+#define TABLE_FILE_SUFFIX ".tbl"
+#define TABLE_FILE_ROOT_PAGE 1
+#define META_FILE_PER_TABLE_OFFSET 28
+
+/*
+ * How soon an autocommitted statement's changes must reach the disk, set at
+ * runtime with ".sync off|normal|full":
+ *   SYNC_OFF    - only at COMMIT, BEGIN, eviction and close
+ *   SYNC_NORMAL - written back and synced once SYNC_NORMAL_STATEMENTS
+ *                 changing statements have run, or SYNC_NORMAL_INTERVAL_MS
+ *                 after the oldest of them, whichever comes first
+ *   SYNC_FULL   - written back and synced before each statement returns
+ * Statements inside a transaction are synced with its COMMIT instead.
+ */
+typedef enum { SYNC_OFF, SYNC_NORMAL, SYNC_FULL } SyncMode;
+
+#define SYNC_NORMAL_STATEMENTS 100
+#define SYNC_NORMAL_INTERVAL_MS 1000
+
 typedef enum { COLUMN_INT, COLUMN_VARCHAR } ColumnType;
 
 typedef struct {
@@ -38,14 +65,83 @@ typedef struct Table {
   uint32_t num_tables;
   TableInfo tables[MAX_TABLES];
 
-  bool in_transaction;
+  // Page locks of the sessions' transactions, see lock.h. Catalog only.
+  LockTable *locks;
+
+  // Set when sessions run side by side (server mode): SELECTs outside the
+  // session's own transaction read a snapshot, see db_begin_snapshot()
+  bool snapshot_reads;
+
+  // A replica's: only the primary's commits change it, see replication.h
+  bool read_only;
+
+  // Warm-up list beside the db file; NULL unless warm-up is enabled
+  char *warm_path;
+
+  char *filename;
+  PagerOptions options; // Used again for table files created later
+
+  // File-per-table mode: the open table files, by index into tables. Each
+  // is a Table of its own holding just the pager of that file.
+  bool file_per_table;
+  struct Table *spaces[MAX_TABLES];
+
+  // Synchronous mode. The counters are only touched inside a statement.
+  SyncMode sync_mode;
+  uint32_t unsynced_statements; // Changing statements since the last sync
+  uint64_t first_unsynced_us;   // When the oldest of them finished
+
+  // NORMAL mode syncs idle sessions on this thread. syncer_control
+  // serializes mode changes, which start and stop it; syncer_lock guards
+  // the flags.
+  pthread_t syncer_thread;
+  bool syncer_running;
+  bool syncer_stop;
+  pthread_mutex_t syncer_control;
+  pthread_mutex_t syncer_lock;
+  pthread_cond_t syncer_wake;
 } Table;
 
-extern const uint32_t ROWS_PER_PAGE;
+/*
+ * One client's connection to the database: the REPL, or a server client.
+ * Each session has at most one transaction open, and sessions' transactions
+ * run side by side, kept apart by page locks.
+ */
+typedef struct {
+  Table *table;
+  int out_fd;
+  bool in_transaction; // Between BEGIN and COMMIT or ROLLBACK
+  Transaction transaction;
+  // Set by BEGIN and COMMIT: the log is synced up to it once the statement
+  // lets go of the gate, see db_wait_for_commit()
+  uint64_t commit_lsn;
+} Session;
 
-Table *db_open(const char *filename);
+Table *db_open(const char *filename, PagerOptions *options);
 void db_close(Table *table);
 TableInfo *find_table(Table *table, const char *name);
+void db_reload_catalog(Table *table);
+Table *table_space(Table *table, TableInfo *info);
+void table_space_create(Table *table, TableInfo *info);
+void table_space_drop(Table *table, TableInfo *info);
+void db_begin_statement(Table *table);
+void db_end_statement(Table *table);
+uint64_t db_flush_commit(Table *table);
+void db_wait_for_commit(Table *table, uint64_t lsn);
+void db_flush_all(Table *table);
+uint64_t db_commit(Table *table, Transaction *transaction, bool durable);
+void db_rollback(Table *table, Transaction *transaction);
+void db_wait_for_transactions(Table *table);
+void db_open_session(Session *session, Table *table, int out_fd);
+void db_close_session(Session *session);
+void db_statement_done(Table *table, bool in_transaction);
+Table *db_snapshot(Table *table);
+Table *db_begin_snapshot(Table *table);
+void db_end_snapshot(Table *snapshot);
+void db_wait_for_snapshots(Table *table);
+void db_backup(Table *table, const char *path, int out_fd);
+void db_set_sync_mode(Table *table, SyncMode mode);
+const char *sync_mode_name(SyncMode mode);
 void *row_slot(Table *table, uint32_t row_num);
 
 void serialize_row(Row *source, void *destination);
@@ -0,0 +1,39 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define IO_RING_ENTRIES 64
+
+// Most iovecs one request carries. preadv()/pwritev() take up to IOV_MAX,
+// which is 1024 on Linux but only declared with _GNU_SOURCE or _XOPEN_SOURCE
+#define IO_REQUEST_MAX_IOVECS 1024
+
+/*
+ * One vectored read or write in a batch. result receives the byte count or
+ * a negative errno, as preadv()/pwritev() would report it, and done is set
+ * once it has.
+ */
+typedef struct {
+  int fd;
+  bool write;
+  struct iovec *iov;
+  uint32_t iovcnt;
+  off_t offset;
+  ssize_t result;
+  bool done;
+} IoRequest;
+
+typedef struct IoRing IoRing;
+
+// Returns NULL when io_uring is not available on this system
+IoRing *io_ring_open(uint32_t entries);
+void io_ring_close(IoRing *ring);
+// Submits the whole batch, keeping up to the ring size in flight, and
+// returns once every request has completed
+void io_ring_run(IoRing *ring, IoRequest *requests, uint32_t count);
+
+#endif
@@ -7,9 +7,12 @@
 typedef enum {
   EXECUTE_SUCCESS,
   EXECUTE_DUPLICATE_KEY,
-  EXECUTE_TABLE_FULL
+  EXECUTE_TABLE_FULL,
+  EXECUTE_DEADLOCK, // The session's transaction was rolled back
+  EXECUTE_READ_ONLY // A change sent to a replica
 } ExecuteResult;
 
-ExecuteResult execute_statement(Statement *statement, Table *table, int out_fd);
+ExecuteResult execute_statement(Statement *statement, Session *session);
+uint32_t table_row_size(TableInfo *table_info);
 
 #endif
@@ -0,0 +1,110 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Write-ahead log, kept next to the database in "<file>-wal". Written pages
+ * are appended to it as whole images instead of going to their place in the
+ * database file, and a commit appends a commit record and makes the log
+ * durable with a single fdatasync(). A checkpoint later copies the newest
+ * image of every page into the database file and empties the log.
+ *
+ * The log is a WalHeader followed by frames: a WalFrameHeader and a page, or
+ * a WalFrameHeader alone for a commit record. Frames are checksummed together
+ * with the header's salt, which changes every time the log is emptied, so a
+ * torn or stale frame ends recovery instead of being replayed.
+ */
+#define WAL_MAGIC 0x4c415744 // "DWAL"
+#define WAL_VERSION 1
+#define WAL_SUFFIX "-wal"
+#define WAL_COMMIT_RECORD UINT32_MAX // page_num of a commit record
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t page_size;
+  uint32_t salt;
+} WalHeader;
+
+typedef struct {
+  uint32_t page_num;
+  uint32_t db_pages; // Commit records only: database size in pages
+  uint32_t salt;
+  uint32_t checksum;
+} WalFrameHeader;
+
+#define WAL_NO_FRAME UINT64_MAX
+
+typedef struct {
+  uint32_t page_num; // WAL_COMMIT_RECORD if the slot is empty
+  uint64_t offset;   // File offset of the page's newest frame
+  // File offset of its newest frame before the last commit record, if that
+  // is not the newest; WAL_NO_FRAME if it has none
+  uint64_t committed_offset;
+} WalEntry;
+
+/*
+ * Positions in the log are log sequence numbers: bytes appended since the
+ * log was opened, so they keep growing when a checkpoint empties the file.
+ * A frame's file offset is its LSN minus base.
+ */
+typedef struct Wal {
+  int file_descriptor;
+  char *path;
+  uint32_t page_size;
+
+  // Guards everything below. Held while appending, never across fsync.
+  pthread_mutex_t lock;
+  pthread_cond_t synced_cond; // Signalled when a sync finishes
+  uint32_t salt;
+  uint64_t base;
+  uint64_t end;         // LSN of the next frame
+  uint64_t committed;   // LSN just past the last commit record
+  uint64_t synced;      // Everything before this LSN is on disk
+  bool syncing;         // A committer is in fdatasync() for everyone
+  uint32_t uncommitted; // Frames appended since the last commit record
+  uint32_t num_frames;  // Frames in the file, commit records excluded
+  uint32_t db_pages;    // Database size as of the last commit
+
+  // Newest frame of each page, open addressing on the page number
+  WalEntry *index;
+  uint32_t index_capacity; // Power of two
+  uint32_t index_count;
+
+  void *scratch; // One page, aligned for O_DIRECT database files
+} Wal;
+
+// Replays the committed frames of db_path's log, if it has one, into db_fd
+void wal_recover(const char *db_path, int db_fd);
+Wal *wal_open(const char *db_path, uint32_t page_size, uint32_t db_pages);
+// Deletes the log; checkpoint first
+void wal_close(Wal *wal);
+void wal_append(Wal *wal, const uint32_t *page_nums, void *const *pages,
+                uint32_t count);
+/*
+ * Ends the frames appended so far with a commit record. Returns the LSN to
+ * pass to wal_sync(), or 0 if everything is committed and durable already.
+ */
+uint64_t wal_commit(Wal *wal, uint32_t db_pages);
+// Returns true if this call issued the fdatasync() itself
+bool wal_sync(Wal *wal, uint64_t lsn);
+// Both return false if the log holds no image of the page
+bool wal_contains(Wal *wal, uint32_t page_num);
+bool wal_read_page(Wal *wal, uint32_t page_num, void *destination);
+// Forgets the images of every page from end on, which was cut off
+void wal_forget(Wal *wal, uint32_t end);
+/*
+ * Copies the newest committed image of every logged page into db_fd, cut to
+ * the committed size, makes it durable and empties the log. Frames appended
+ * after the last commit record are logged again afterwards, so uncommitted
+ * pages never reach the database file. db_length is set to
+ * the file's new length before the log is emptied, so concurrent readers
+ * always find a page in one place or the other.
+ */
+void wal_checkpoint(Wal *wal, int db_fd, _Atomic uint64_t *db_length);
+
+#endif
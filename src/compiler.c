@@ -1,4 +1,5 @@
 #include "compiler.h"
+#include "replication.h"
 #include "table.h"
 #include <stdio.h>
 #include <string.h>
@@ -20,6 +21,64 @@ MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table,
         "email varchar(255)\n);\nCREATE TABLE orders (\n    id integer,\n    "
         "user_id integer,\n    product_name varchar(32)\n);\n");
     return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".stats") == 0) {
+    // Keeps DROP TABLE from closing a space's pager under the walk
+    db_begin_statement(table);
+    pager_print_stats(table->pager, out_fd);
+    lock_print_stats(table->locks, out_fd);
+    if (table->pager->replication != NULL) {
+      replication_print_stats(table->pager->replication, out_fd);
+    }
+    // Table files have pools of their own, listed after the catalog's
+    for (uint32_t i = 0; i < table->num_tables; i++) {
+      if (table->spaces[i] != NULL) {
+        dprintf(out_fd, "table %s\n", table->tables[i].name);
+        pager_print_stats(table->spaces[i]->pager, out_fd);
+      }
+    }
+    db_end_statement(table);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".stats reset") == 0) {
+    db_begin_statement(table);
+    pager_reset_stats(table->pager);
+    lock_reset_stats(table->locks);
+    if (table->pager->replication != NULL) {
+      replication_reset_stats(table->pager->replication);
+    }
+    for (uint32_t i = 0; i < table->num_tables; i++) {
+      if (table->spaces[i] != NULL) {
+        pager_reset_stats(table->spaces[i]->pager);
+      }
+    }
+    db_end_statement(table);
+    dprintf(out_fd, "Statistics reset.\n");
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".sync") == 0) {
+    db_begin_statement(table);
+    SyncMode mode = table->sync_mode;
+    db_end_statement(table);
+    dprintf(out_fd, "sync %s\n", sync_mode_name(mode));
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(input_buffer->buffer, ".sync ", 6) == 0) {
+    const char *name = input_buffer->buffer + 6;
+    SyncMode mode;
+    if (strcmp(name, "off") == 0) {
+      mode = SYNC_OFF;
+    } else if (strcmp(name, "normal") == 0) {
+      mode = SYNC_NORMAL;
+    } else if (strcmp(name, "full") == 0) {
+      mode = SYNC_FULL;
+    } else {
+      dprintf(out_fd, "Unknown sync mode '%s'. Use off, normal or full.\n",
+              name);
+      return META_COMMAND_SUCCESS;
+    }
+    db_set_sync_mode(table, mode);
+    dprintf(out_fd, "sync %s\n", sync_mode_name(mode));
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(input_buffer->buffer, ".backup ", 8) == 0) {
+    db_backup(table, input_buffer->buffer + 8, out_fd);
+    return META_COMMAND_SUCCESS;
   } else {
     return META_COMMAND_UNRECOGNIZED_COMMAND;
   }
@@ -59,7 +118,8 @@ PrepareResult prepare_statement(InputBuffer *input_buffer,
     *cols_end = '\0'; // Terminate string at closing paren
 
     statement->create_num_columns = 0;
-    char *token = strtok(cols_start, ",");
+    char *save;
+    char *token = strtok_r(cols_start, ",", &save);
     while (token != NULL) {
       if (statement->create_num_columns >= 10)
         break;
@@ -79,7 +139,7 @@ PrepareResult prepare_statement(InputBuffer *input_buffer,
             1; // VARCHAR
       }
       statement->create_num_columns++;
-      token = strtok(NULL, ",");
+      token = strtok_r(NULL, ",", &save);
     }
 
     // Legacy support for schema_type (optional, can be removed if VM uses
@@ -116,6 +176,26 @@ PrepareResult prepare_statement(InputBuffer *input_buffer,
     return PREPARE_SUCCESS;
   }
 
+  if (strncasecmp(input_buffer->buffer, "reorganize table", 16) == 0) {
+    statement->type = STATEMENT_REORGANIZE;
+    char *args = input_buffer->buffer + 16;
+    while (*args == ' ')
+      args++;
+    if (sscanf(args, "%31[^; ]", statement->table_name) != 1)
+      return PREPARE_SYNTAX_ERROR;
+    return PREPARE_SUCCESS;
+  }
+
+  if (strncasecmp(input_buffer->buffer, "drop table", 10) == 0) {
+    statement->type = STATEMENT_DROP_TABLE;
+    char *args = input_buffer->buffer + 10;
+    while (*args == ' ')
+      args++;
+    if (sscanf(args, "%31[^; ]", statement->table_name) != 1)
+      return PREPARE_SYNTAX_ERROR;
+    return PREPARE_SUCCESS;
+  }
+
   if (strncmp(input_buffer->buffer, "insert", 6) == 0 ||
       strncmp(input_buffer->buffer, "INSERT", 6) == 0) {
     statement->type = STATEMENT_INSERT;
@@ -154,7 +234,8 @@ PrepareResult prepare_statement(InputBuffer *input_buffer,
           // Format: (val1, val2, ...)
           char *vals = paren_start + 1;
           int val_idx = 0;
-          char *token = strtok(vals, ",)");
+          char *save;
+          char *token = strtok_r(vals, ",)", &save);
           while (token != NULL) {
             if (val_idx >= 10)
               break; // Limit to 10 columns for now
@@ -174,7 +255,7 @@ PrepareResult prepare_statement(InputBuffer *input_buffer,
             // Store in statement
             statement->insert_values[val_idx++] = token;
 
-            token = strtok(NULL, ",)");
+            token = strtok_r(NULL, ",)", &save);
           }
           statement->insert_values[val_idx] = NULL; // Null terminate array
           return PREPARE_SUCCESS;
@@ -234,7 +315,8 @@ PrepareResult prepare_statement(InputBuffer *input_buffer,
 
         // Check for *
         if (strstr(cols_str, "*") == NULL) {
-          char *token = strtok(cols_str, ",");
+          char *save;
+          char *token = strtok_r(cols_str, ",", &save);
           while (token != NULL) {
             // Trim spaces
             while (*token == ' ')
@@ -249,7 +331,7 @@ PrepareResult prepare_statement(InputBuffer *input_buffer,
               if (statement->num_select_columns >= 10)
                 break;
             }
-            token = strtok(NULL, ",");
+            token = strtok_r(NULL, ",", &save);
           }
         }
       }
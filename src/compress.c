@@ -0,0 +1,184 @@
+#include "compress.h"
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_HASH_BITS 12
+
+static uint32_t read32(const uint8_t *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static uint32_t lz_hash(uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Writes the extra bytes of a length that did not fit in its nibble
+static bool put_length(uint8_t *dst, uint32_t *op, uint32_t capacity,
+                       uint32_t length) {
+  while (length >= 255) {
+    if (*op >= capacity) {
+      return false;
+    }
+    dst[(*op)++] = 255;
+    length -= 255;
+  }
+  if (*op >= capacity) {
+    return false;
+  }
+  dst[(*op)++] = (uint8_t)length;
+  return true;
+}
+
+static bool put_sequence(uint8_t *dst, uint32_t *op, uint32_t capacity,
+                         const uint8_t *literals, uint32_t literal_len,
+                         uint32_t offset, uint32_t match_len) {
+  if (*op >= capacity) {
+    return false;
+  }
+  uint32_t token_pos = (*op)++;
+  uint8_t token = 0;
+
+  if (literal_len >= 15) {
+    token = 15 << 4;
+    if (!put_length(dst, op, capacity, literal_len - 15)) {
+      return false;
+    }
+  } else {
+    token = (uint8_t)(literal_len << 4);
+  }
+
+  if (*op + literal_len > capacity) {
+    return false;
+  }
+  memcpy(dst + *op, literals, literal_len);
+  *op += literal_len;
+
+  if (match_len > 0) {
+    if (*op + 2 > capacity) {
+      return false;
+    }
+    dst[(*op)++] = offset & 0xFF;
+    dst[(*op)++] = offset >> 8;
+
+    uint32_t extra = match_len - LZ_MIN_MATCH;
+    if (extra >= 15) {
+      token |= 15;
+      if (!put_length(dst, op, capacity, extra - 15)) {
+        return false;
+      }
+    } else {
+      token |= (uint8_t)extra;
+    }
+  }
+
+  dst[token_pos] = token;
+  return true;
+}
+
+uint32_t lz_compress(const uint8_t *src, uint32_t src_len, uint8_t *dst,
+                     uint32_t dst_capacity) {
+  // Positions are stored plus one so that zero means an empty slot
+  uint32_t table[1 << LZ_HASH_BITS];
+  memset(table, 0, sizeof(table));
+
+  uint32_t ip = 0;
+  uint32_t anchor = 0;
+  uint32_t op = 0;
+
+  while (ip + LZ_MIN_MATCH <= src_len) {
+    uint32_t sequence = read32(src + ip);
+    uint32_t hash = lz_hash(sequence);
+    uint32_t candidate = table[hash];
+    table[hash] = ip + 1;
+
+    if (candidate == 0 || ip - (candidate - 1) > LZ_MAX_OFFSET ||
+        read32(src + candidate - 1) != sequence) {
+      ip++;
+      continue;
+    }
+
+    uint32_t ref = candidate - 1;
+    uint32_t match_len = LZ_MIN_MATCH;
+    while (ip + match_len < src_len &&
+           src[ref + match_len] == src[ip + match_len]) {
+      match_len++;
+    }
+
+    if (!put_sequence(dst, &op, dst_capacity, src + anchor, ip - anchor,
+                      ip - ref, match_len)) {
+      return 0;
+    }
+    ip += match_len;
+    anchor = ip;
+  }
+
+  if (!put_sequence(dst, &op, dst_capacity, src + anchor, src_len - anchor, 0,
+                    0)) {
+    return 0;
+  }
+  return op;
+}
+
+static bool get_length(const uint8_t *src, uint32_t src_len, uint32_t *ip,
+                       uint32_t *length) {
+  uint8_t byte;
+  do {
+    if (*ip >= src_len) {
+      return false;
+    }
+    byte = src[(*ip)++];
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+bool lz_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst,
+                   uint32_t dst_len) {
+  uint32_t ip = 0;
+  uint32_t op = 0;
+
+  while (ip < src_len) {
+    uint8_t token = src[ip++];
+
+    uint32_t literal_len = token >> 4;
+    if (literal_len == 15 && !get_length(src, src_len, &ip, &literal_len)) {
+      return false;
+    }
+    if (ip + literal_len > src_len || op + literal_len > dst_len) {
+      return false;
+    }
+    memcpy(dst + op, src + ip, literal_len);
+    ip += literal_len;
+    op += literal_len;
+
+    if (ip == src_len) {
+      break; // Last sequence has no match
+    }
+
+    if (ip + 2 > src_len) {
+      return false;
+    }
+    uint32_t offset = src[ip] | (src[ip + 1] << 8);
+    ip += 2;
+
+    uint32_t match_len = token & 15;
+    if (match_len == 15 && !get_length(src, src_len, &ip, &match_len)) {
+      return false;
+    }
+    match_len += LZ_MIN_MATCH;
+
+    if (offset == 0 || offset > op || op + match_len > dst_len) {
+      return false;
+    }
+    // Byte by byte: the match may overlap the bytes it produces
+    for (uint32_t i = 0; i < match_len; i++) {
+      dst[op + i] = dst[op - offset + i];
+    }
+    op += match_len;
+  }
+
+  return op == dst_len;
+}
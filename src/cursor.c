@@ -5,20 +5,27 @@
 #include <stdlib.h>
 
 Cursor *table_start(Table *table, uint32_t root_page_num) {
-  Cursor *cursor = malloc(sizeof(Cursor));
-  cursor->table = table;
+  // Full scans walk the leaf chain
+  pager_access_hint(table->pager, ACCESS_SEQUENTIAL);
 
   uint32_t page_num = root_page_num;
   void *node = get_page(table->pager, page_num);
   uint32_t num_cells = *leaf_node_num_cells(node);
 
   while (get_node_type(node) == NODE_INTERNAL) {
-    uint32_t child_page_num = *internal_node_child(
-        node, 0, MAIN_TABLE_INTERNAL_KEY_SIZE, MAIN_TABLE_INTERNAL_CHILD_SIZE);
+    // A node whose other children were removed keeps only its right child
+    uint32_t child_page_num =
+        *internal_node_num_keys(node) == 0
+            ? *internal_node_right_child(node)
+            : *internal_node_child(node, 0, MAIN_TABLE_INTERNAL_KEY_SIZE,
+                                   MAIN_TABLE_INTERNAL_CHILD_SIZE);
     page_num = child_page_num;
     node = get_page(table->pager, page_num);
   }
 
+  // Allocated once the pages are locked, so a deadlock cannot leak it
+  Cursor *cursor = calloc(1, sizeof(Cursor));
+  cursor->table = table;
   cursor->page_num = page_num;
   cursor->cell_num = 0;
 
@@ -29,18 +36,18 @@ Cursor *table_start(Table *table, uint32_t root_page_num) {
 }
 
 Cursor *table_end(Table *table, uint32_t root_page_num) {
-  Cursor *cursor = malloc(sizeof(Cursor));
-  cursor->table = table;
-  cursor->page_num = root_page_num;
-
+  uint32_t page_num = root_page_num;
   void *root_node = get_page(table->pager, root_page_num);
 
   while (get_node_type(root_node) == NODE_INTERNAL) {
-    uint32_t right_child_page_num = *internal_node_right_child(root_node);
-    root_node = get_page(table->pager, right_child_page_num);
-    cursor->page_num = right_child_page_num;
+    page_num = *internal_node_right_child(root_node);
+    root_node = get_page(table->pager, page_num);
   }
 
+  Cursor *cursor = calloc(1, sizeof(Cursor));
+  cursor->table = table;
+  cursor->page_num = page_num;
+
   uint32_t num_cells = *leaf_node_num_cells(root_node);
   cursor->cell_num = num_cells;
   cursor->end_of_table = true;
@@ -48,17 +55,20 @@ Cursor *table_end(Table *table, uint32_t root_page_num) {
   return cursor;
 }
 
+/*
+ * value_size is the size of a leaf value in this tree; the leaf binary search
+ * needs it to step between cells.
+ */
 Cursor *table_find(Table *table, uint32_t root_page_num, void *key,
-                   uint32_t key_size, KeyType key_type) {
+                   uint32_t key_size, uint32_t value_size, KeyType key_type) {
+  pager_access_hint(table->pager, ACCESS_RANDOM);
   void *root_node = get_page(table->pager, root_page_num);
 
   if (get_node_type(root_node) == NODE_LEAF) {
-    uint32_t value_size = (key_type == KEY_INT) ? MAIN_TABLE_VALUE_SIZE
-                                                : USERNAME_INDEX_VALUE_SIZE;
     return leaf_node_find(table, root_page_num, key, key_size, value_size,
                           key_type);
   } else {
-    uint32_t child_size = sizeof(uint32_t);
+    uint32_t child_size = INTERNAL_NODE_CHILD_SIZE;
     uint32_t num_keys = *internal_node_num_keys(root_node);
     uint32_t child_index = internal_node_find_child(root_node, key, key_size,
                                                     child_size, key_type);
@@ -70,7 +80,8 @@ Cursor *table_find(Table *table, uint32_t root_page_num, void *key,
           *internal_node_child(root_node, child_index, key_size, child_size);
     }
 
-    return table_find(table, child_page_num, key, key_size, key_type);
+    return table_find(table, child_page_num, key, key_size, value_size,
+                      key_type);
   }
 }
 
@@ -95,6 +106,44 @@ void *cursor_value(Cursor *cursor) {
                          MAIN_TABLE_KEY_SIZE);
 }
 
+/*
+ * Requests the leaves that follow page_num under the same parent and returns
+ * how many were requested. Leaves are linked only through next_leaf, so the
+ * parent is the one place that already lists the upcoming pages.
+ */
+static uint32_t cursor_read_ahead(Cursor *cursor, uint32_t page_num,
+                                  uint32_t count) {
+  Pager *pager = cursor->table->pager;
+  void *leaf = get_page(pager, page_num);
+  if (is_node_root(leaf)) {
+    return 0;
+  }
+
+  void *parent = get_page(pager, *node_parent(leaf));
+  if (get_node_type(parent) != NODE_INTERNAL) {
+    return 0;
+  }
+  uint32_t num_keys = *internal_node_num_keys(parent);
+
+  uint32_t pages[READ_AHEAD_MAX_LEAVES];
+  uint32_t num_pages = 0;
+  bool found = false;
+  for (uint32_t i = 0; i <= num_keys && num_pages < count; i++) {
+    uint32_t child = i == num_keys
+                         ? *internal_node_right_child(parent)
+                         : *internal_node_child(parent, i,
+                                                MAIN_TABLE_INTERNAL_KEY_SIZE,
+                                                MAIN_TABLE_INTERNAL_CHILD_SIZE);
+    if (found) {
+      pages[num_pages++] = child;
+    } else if (child == page_num) {
+      found = true;
+    }
+  }
+
+  return pager_prefetch(pager, pages, num_pages);
+}
+
 void cursor_advance(Cursor *cursor) {
   uint32_t page_num = cursor->page_num;
   void *node = get_page(cursor->table->pager, page_num);
@@ -109,6 +158,29 @@ void cursor_advance(Cursor *cursor) {
     } else {
       cursor->page_num = next_page_num;
       cursor->cell_num = 0;
+
+      /*
+       * Once the cursor has crossed two leaves in a row the scan is taken to
+       * be sequential. Each read-ahead is issued when half of the previous
+       * one has been consumed and doubles the window, up to the maximum.
+       */
+      cursor->sequential_leaves++;
+      if (cursor->readahead_left > 0) {
+        cursor->readahead_left--;
+      }
+      if (cursor->sequential_leaves >= 2 &&
+          cursor->readahead_left <= cursor->readahead_window / 2) {
+        uint32_t window = cursor->readahead_window * 2;
+        if (window < READ_AHEAD_MIN_LEAVES) {
+          window = READ_AHEAD_MIN_LEAVES;
+        }
+        if (window > READ_AHEAD_MAX_LEAVES) {
+          window = READ_AHEAD_MAX_LEAVES;
+        }
+        cursor->readahead_window =
+            cursor_read_ahead(cursor, next_page_num, window);
+        cursor->readahead_left = cursor->readahead_window;
+      }
     }
   }
 }
@@ -0,0 +1,402 @@
+#include "dump.h"
+#include "compiler.h"
+#include "cursor.h"
+#include "node.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// A table whose rows a load has spooled, sorted and merged, ready to build
+typedef struct {
+  TableInfo *info;
+  Table *space;
+  FILE *spool;
+  uint32_t num_cells;
+} LoadedTable;
+
+static void dump_write(FILE *file, const void *data, size_t size) {
+  if (size > 0 && fwrite(data, size, 1, file) != 1) {
+    printf("Error writing dump file.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void dump_read(FILE *file, void *data, size_t size) {
+  if (size > 0 && fread(data, size, 1, file) != 1) {
+    printf("Dump file is truncated.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static FILE *spool_open(void) {
+  FILE *spool = tmpfile();
+  if (spool == NULL) {
+    printf("Unable to create load spool file.\n");
+    exit(EXIT_FAILURE);
+  }
+  return spool;
+}
+
+static void spool_write(FILE *spool, const void *cells, uint32_t cell_size,
+                        uint32_t count) {
+  if (fwrite(cells, cell_size, count, spool) != count) {
+    printf("Error writing load spool file.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void spool_read(FILE *spool, void *cells, uint32_t cell_size,
+                       uint32_t count) {
+  if (fread(cells, cell_size, count, spool) != count) {
+    printf("Error reading load spool file.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Writes the cells of a table in key order, in batches
+static uint64_t dump_rows(Table *space, uint32_t root_page_num,
+                          uint32_t cell_size, FILE *file) {
+  char *batch = malloc((size_t)cell_size * DUMP_BATCH_ROWS);
+  uint32_t count = 0;
+  uint64_t total = 0;
+  Cursor *cursor = table_start(space, root_page_num);
+  while (!cursor->end_of_table) {
+    void *node = get_page(space->pager, cursor->page_num);
+    memcpy(batch + (size_t)count * cell_size,
+           leaf_node_cell(node, cursor->cell_num, cell_size), cell_size);
+    if (++count == DUMP_BATCH_ROWS) {
+      dump_write(file, &count, sizeof(count));
+      dump_write(file, batch, (size_t)count * cell_size);
+      total += count;
+      count = 0;
+    }
+    cursor_advance(cursor);
+  }
+  free(cursor);
+  if (count > 0) {
+    dump_write(file, &count, sizeof(count));
+    dump_write(file, batch, (size_t)count * cell_size);
+    total += count;
+  }
+  // An empty batch ends the table
+  count = 0;
+  dump_write(file, &count, sizeof(count));
+  free(batch);
+  return total;
+}
+
+void dump_database(Table *table, const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    printf("Unable to open dump file '%s'.\n", path);
+    exit(EXIT_FAILURE);
+  }
+  DumpHeader header = {DUMP_MAGIC, DUMP_VERSION};
+  dump_write(file, &header, sizeof(header));
+
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < table->num_tables; i++) {
+    TableInfo *info = &table->tables[i];
+    DumpTable entry;
+    memset(&entry, 0, sizeof(entry));
+    memcpy(entry.name, info->name, TABLE_NAME_SIZE);
+    entry.num_columns = info->num_columns;
+    entry.row_size = table_row_size(info);
+    memcpy(entry.columns, info->columns, sizeof(Column) * info->num_columns);
+    dump_write(file, &entry, sizeof(entry));
+    total += dump_rows(table_space(table, info), info->root_page_num,
+                       sizeof(uint32_t) + entry.row_size, file);
+  }
+  DumpTable end;
+  memset(&end, 0, sizeof(end));
+  dump_write(file, &end, sizeof(end));
+  if (fclose(file) != 0) {
+    printf("Error writing dump file.\n");
+    exit(EXIT_FAILURE);
+  }
+  printf("Dumped %llu rows from %u tables.\n", (unsigned long long)total,
+         table->num_tables);
+}
+
+/*
+ * The table a dumped table's rows go into. One that does not exist yet is
+ * created, as CREATE TABLE would; one that does must have the same columns.
+ */
+static TableInfo *load_table_info(Session *session, DumpTable *entry) {
+  entry->name[TABLE_NAME_SIZE - 1] = '\0';
+  if (entry->num_columns == 0 || entry->num_columns > MAX_COLUMNS) {
+    printf("Dump file is damaged.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  Table *table = session->table;
+  TableInfo *info = find_table(table, entry->name);
+  if (info == NULL) {
+    Statement statement;
+    memset(&statement, 0, sizeof(statement));
+    statement.type = STATEMENT_CREATE_TABLE;
+    strcpy(statement.create_table_name, entry->name);
+    statement.create_num_columns = entry->num_columns;
+    for (uint32_t i = 0; i < entry->num_columns; i++) {
+      entry->columns[i].name[sizeof(entry->columns[i].name) - 1] = '\0';
+      strcpy(statement.create_column_names[i], entry->columns[i].name);
+      statement.create_column_types[i] =
+          entry->columns[i].type == COLUMN_INT ? 0 : 1;
+    }
+    if (execute_statement(&statement, session) != EXECUTE_SUCCESS) {
+      printf("Unable to create table '%s'.\n", entry->name);
+      exit(EXIT_FAILURE);
+    }
+    info = find_table(table, entry->name);
+  }
+
+  bool same = info->num_columns == entry->num_columns &&
+              table_row_size(info) == entry->row_size;
+  for (uint32_t i = 0; same && i < info->num_columns; i++) {
+    same = info->columns[i].type == entry->columns[i].type &&
+           info->columns[i].size == entry->columns[i].size &&
+           info->columns[i].offset == entry->columns[i].offset;
+  }
+  if (!same) {
+    printf("Table '%s' in the dump does not match the database.\n",
+           entry->name);
+    exit(EXIT_FAILURE);
+  }
+  return info;
+}
+
+static int compare_cell_keys(const void *a, const void *b) {
+  uint32_t key_a = *(const uint32_t *)a;
+  uint32_t key_b = *(const uint32_t *)b;
+  return key_a < key_b ? -1 : key_a > key_b;
+}
+
+// Username index cells go by username, then by id
+static int compare_index_cells(const void *a, const void *b) {
+  int order = strncmp(a, b, USERNAME_INDEX_KEY_SIZE);
+  if (order != 0) {
+    return order;
+  }
+  return compare_cell_keys((const char *)a + USERNAME_INDEX_KEY_SIZE,
+                           (const char *)b + USERNAME_INDEX_KEY_SIZE);
+}
+
+static void duplicate_key(const char *name, uint32_t key) {
+  printf("Duplicate key %u in table '%s'.\n", key, name);
+  exit(EXIT_FAILURE);
+}
+
+/*
+ * Copies one table's rows from the dump into a spool, noting whether they
+ * came in strictly increasing key order, as a dump writes them.
+ */
+static uint32_t load_rows(FILE *file, FILE *spool, uint32_t cell_size,
+                          bool *sorted) {
+  char *batch = malloc((size_t)cell_size * DUMP_BATCH_ROWS);
+  uint32_t num_cells = 0;
+  uint32_t last_key = 0;
+  *sorted = true;
+  while (true) {
+    uint32_t count;
+    dump_read(file, &count, sizeof(count));
+    if (count == 0) {
+      break;
+    }
+    if (count > DUMP_BATCH_ROWS) {
+      printf("Dump file is damaged.\n");
+      exit(EXIT_FAILURE);
+    }
+    dump_read(file, batch, (size_t)count * cell_size);
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t key = *(uint32_t *)(batch + (size_t)i * cell_size);
+      if (num_cells + i > 0 && key <= last_key) {
+        *sorted = false;
+      }
+      last_key = key;
+    }
+    spool_write(spool, batch, cell_size, count);
+    num_cells += count;
+  }
+  free(batch);
+  rewind(spool);
+  return num_cells;
+}
+
+// Sorts a spool of cells in memory. Returns the sorted spool.
+static FILE *sort_spool(FILE *spool, uint32_t num_cells, uint32_t cell_size,
+                        const char *name) {
+  char *cells = malloc((size_t)cell_size * num_cells);
+  spool_read(spool, cells, cell_size, num_cells);
+  fclose(spool);
+  qsort(cells, num_cells, cell_size, compare_cell_keys);
+  for (uint32_t i = 1; i < num_cells; i++) {
+    if (compare_cell_keys(cells + (size_t)(i - 1) * cell_size,
+                          cells + (size_t)i * cell_size) == 0) {
+      duplicate_key(name, *(uint32_t *)(cells + (size_t)i * cell_size));
+    }
+  }
+
+  FILE *sorted = spool_open();
+  spool_write(sorted, cells, cell_size, num_cells);
+  free(cells);
+  rewind(sorted);
+  return sorted;
+}
+
+// Merges the table's existing rows, if any, into a sorted spool of new ones
+static FILE *merge_spool(LoadedTable *loaded, uint32_t cell_size) {
+  Table *space = loaded->space;
+  Cursor *cursor = table_start(space, loaded->info->root_page_num);
+  if (cursor->end_of_table) {
+    free(cursor);
+    return loaded->spool;
+  }
+
+  FILE *merged = spool_open();
+  char *cell = malloc(cell_size);
+  uint32_t left = loaded->num_cells;
+  bool have = left > 0;
+  if (have) {
+    spool_read(loaded->spool, cell, cell_size, 1);
+  }
+  while (!cursor->end_of_table) {
+    void *node = get_page(space->pager, cursor->page_num);
+    void *existing = leaf_node_cell(node, cursor->cell_num, cell_size);
+    int order;
+    while (have && (order = compare_cell_keys(cell, existing)) <= 0) {
+      if (order == 0) {
+        duplicate_key(loaded->info->name, *(uint32_t *)cell);
+      }
+      spool_write(merged, cell, cell_size, 1);
+      have = --left > 0;
+      if (have) {
+        spool_read(loaded->spool, cell, cell_size, 1);
+      }
+    }
+    spool_write(merged, existing, cell_size, 1);
+    loaded->num_cells++;
+    cursor_advance(cursor);
+  }
+  free(cursor);
+  if (have) {
+    spool_write(merged, cell, cell_size, 1);
+    while (--left > 0) {
+      spool_read(loaded->spool, cell, cell_size, 1);
+      spool_write(merged, cell, cell_size, 1);
+    }
+  }
+  free(cell);
+  fclose(loaded->spool);
+  rewind(merged);
+  return merged;
+}
+
+// Builds the username index of users from the table's sorted rows
+static void load_username_index(LoadedTable *loaded, uint32_t cell_size) {
+  Column *username_col = NULL;
+  for (uint32_t i = 0; i < loaded->info->num_columns; i++) {
+    if (strcmp(loaded->info->columns[i].name, "username") == 0) {
+      username_col = &loaded->info->columns[i];
+    }
+  }
+  if (username_col == NULL) {
+    return;
+  }
+  uint32_t username_size = username_col->size < USERNAME_INDEX_KEY_SIZE
+                               ? username_col->size
+                               : USERNAME_INDEX_KEY_SIZE;
+
+  char *cell = malloc(cell_size);
+  char *index = calloc(loaded->num_cells, USERNAME_INDEX_LEAF_CELL_SIZE);
+  rewind(loaded->spool);
+  for (uint32_t i = 0; i < loaded->num_cells; i++) {
+    spool_read(loaded->spool, cell, cell_size, 1);
+    char *index_cell = index + (size_t)i * USERNAME_INDEX_LEAF_CELL_SIZE;
+    strncpy(index_cell, cell + sizeof(uint32_t) + username_col->offset,
+            username_size);
+    memcpy(index_cell + USERNAME_INDEX_KEY_SIZE, cell, sizeof(uint32_t));
+  }
+  free(cell);
+  qsort(index, loaded->num_cells, USERNAME_INDEX_LEAF_CELL_SIZE,
+        compare_index_cells);
+
+  FILE *spool = spool_open();
+  spool_write(spool, index, USERNAME_INDEX_LEAF_CELL_SIZE, loaded->num_cells);
+  free(index);
+  rewind(spool);
+  bulk_load_tree(loaded->space, 2, USERNAME_INDEX_KEY_SIZE,
+                 USERNAME_INDEX_VALUE_SIZE, spool, loaded->num_cells);
+  fclose(spool);
+}
+
+/*
+ * Restores a dump. Every table is read, checked and sorted first, so a
+ * damaged dump or a duplicate key is reported before any tree is touched;
+ * the trees are then built bottom up.
+ */
+void load_database(Table *table, const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    printf("Unable to open dump file '%s'.\n", path);
+    exit(EXIT_FAILURE);
+  }
+  DumpHeader header;
+  dump_read(file, &header, sizeof(header));
+  if (header.magic != DUMP_MAGIC || header.version != DUMP_VERSION) {
+    printf("'%s' is not a dump file.\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  Session session;
+  db_open_session(&session, table, STDOUT_FILENO);
+  LoadedTable loaded[MAX_TABLES];
+  uint32_t num_loaded = 0;
+  uint64_t total = 0;
+  while (true) {
+    DumpTable entry;
+    dump_read(file, &entry, sizeof(entry));
+    if (entry.name[0] == '\0') {
+      break;
+    }
+    TableInfo *info = load_table_info(&session, &entry);
+    for (uint32_t i = 0; i < num_loaded; i++) {
+      if (loaded[i].info == info) {
+        printf("Table '%s' appears twice in the dump.\n", info->name);
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    LoadedTable *next = &loaded[num_loaded++];
+    uint32_t cell_size = sizeof(uint32_t) + entry.row_size;
+    bool sorted;
+    next->info = info;
+    next->space = table_space(table, info);
+    next->spool = spool_open();
+    next->num_cells = load_rows(file, next->spool, cell_size, &sorted);
+    total += next->num_cells;
+    if (!sorted) {
+      next->spool =
+          sort_spool(next->spool, next->num_cells, cell_size, info->name);
+    }
+    next->spool = merge_spool(next, cell_size);
+  }
+  fclose(file);
+  db_close_session(&session);
+
+  db_begin_statement(table);
+  for (uint32_t i = 0; i < num_loaded; i++) {
+    uint32_t cell_size = sizeof(uint32_t) + table_row_size(loaded[i].info);
+    bulk_load_tree(loaded[i].space, loaded[i].info->root_page_num,
+                   sizeof(uint32_t), table_row_size(loaded[i].info),
+                   loaded[i].spool, loaded[i].num_cells);
+    if (strcmp(loaded[i].info->name, "users") == 0) {
+      load_username_index(&loaded[i], cell_size);
+    }
+    fclose(loaded[i].spool);
+  }
+  db_end_statement(table);
+  printf("Loaded %llu rows into %u tables.\n", (unsigned long long)total,
+         num_loaded);
+}
@@ -0,0 +1,262 @@
+#include "lock.h"
+#include "table.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The transaction whose statement this thread is running, if any
+static __thread Transaction *current_transaction;
+
+void lock_table_init(LockTable *locks) {
+  pthread_mutex_init(&locks->mutex, NULL);
+  pthread_cond_init(&locks->released, NULL);
+  memset(locks->buckets, 0, sizeof(locks->buckets));
+  locks->num_grants = 0;
+  locks->next_id = 1;
+  locks->search = 0;
+  lock_reset_stats(locks);
+}
+
+// Sessions end their transactions before the database is closed, so there
+// are no locks left to free
+void lock_table_destroy(LockTable *locks) {
+  pthread_cond_destroy(&locks->released);
+  pthread_mutex_destroy(&locks->mutex);
+}
+
+void lock_begin(LockTable *locks, Transaction *transaction, struct Table *db) {
+  pthread_mutex_lock(&locks->mutex);
+  transaction->id = locks->next_id++;
+  if (locks->next_id == 0) {
+    locks->next_id = 1; // 0 means no transaction
+  }
+  pthread_mutex_unlock(&locks->mutex);
+
+  transaction->locks = locks;
+  transaction->db = db;
+  transaction->grants = NULL;
+  transaction->waiting_for = NULL;
+  transaction->visited = 0;
+  transaction->abort = NULL;
+}
+
+static PageLock **lock_bucket(LockTable *locks, struct Pager *pager,
+                              uint32_t page_num) {
+  uintptr_t hash = ((uintptr_t)pager >> 4) ^ (page_num * 2654435761u);
+  return &locks->buckets[hash % LOCK_BUCKETS];
+}
+
+static bool lock_conflicts(LockGrant *grant, Transaction *transaction,
+                           LockMode mode) {
+  return grant->transaction != transaction &&
+         (mode == LOCK_EXCLUSIVE || grant->mode == LOCK_EXCLUSIVE);
+}
+
+static bool lock_available(PageLock *lock, Transaction *transaction,
+                           LockMode mode) {
+  for (LockGrant *grant = lock->grants; grant != NULL; grant = grant->next) {
+    if (lock_conflicts(grant, transaction, mode)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Whether a transaction that waits is held up, directly or through other
+ * waiters, by origin. Each search stamps the transactions it has been
+ * through so that it visits every one at most once.
+ */
+static bool lock_waits_for(LockTable *locks, Transaction *transaction,
+                           Transaction *origin) {
+  transaction->visited = locks->search;
+  for (LockGrant *grant = transaction->waiting_for->grants; grant != NULL;
+       grant = grant->next) {
+    if (!lock_conflicts(grant, transaction, transaction->waiting_mode)) {
+      continue;
+    }
+    Transaction *holder = grant->transaction;
+    if (holder == origin) {
+      return true;
+    }
+    if (holder->waiting_for != NULL && holder->visited != locks->search &&
+        lock_waits_for(locks, holder, origin)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Frees a lock nobody holds or waits for any more
+static void lock_drop_if_unused(LockTable *locks, PageLock *lock) {
+  if (lock->grants != NULL || lock->waiters > 0) {
+    return;
+  }
+  PageLock **link = lock_bucket(locks, lock->pager, lock->page_num);
+  while (*link != lock) {
+    link = &(*link)->next;
+  }
+  *link = lock->next;
+  free(lock);
+}
+
+/*
+ * Locks a page for the calling thread's transaction, waiting for the
+ * transactions that hold it in a conflicting mode. The statement gate is let
+ * go of while waiting, so that they can go on and finish. If they are, in
+ * turn, waiting for this transaction, it is the one rolled back.
+ */
+void lock_page(struct Pager *pager, uint32_t page_num, LockMode mode) {
+  Transaction *transaction = current_transaction;
+  if (transaction == NULL || transaction->id == 0 || page_num == 0) {
+    return;
+  }
+  LockTable *locks = transaction->locks;
+  pthread_mutex_lock(&locks->mutex);
+
+  PageLock **bucket = lock_bucket(locks, pager, page_num);
+  PageLock *lock = *bucket;
+  while (lock != NULL && (lock->pager != pager || lock->page_num != page_num)) {
+    lock = lock->next;
+  }
+  if (lock == NULL) {
+    lock = malloc(sizeof(PageLock));
+    lock->pager = pager;
+    lock->page_num = page_num;
+    lock->grants = NULL;
+    lock->waiters = 0;
+    lock->next = *bucket;
+    *bucket = lock;
+  }
+
+  LockGrant *own = NULL;
+  for (LockGrant *grant = lock->grants; grant != NULL; grant = grant->next) {
+    if (grant->transaction == transaction) {
+      own = grant;
+      break;
+    }
+  }
+  if (own != NULL && (own->mode == LOCK_EXCLUSIVE || mode == LOCK_SHARED)) {
+    pthread_mutex_unlock(&locks->mutex);
+    return;
+  }
+
+  if (!lock_available(lock, transaction, mode)) {
+    locks->stats.lock_waits++;
+    lock->waiters++;
+    transaction->waiting_for = lock;
+    transaction->waiting_mode = mode;
+    do {
+      locks->search++;
+      if (lock_waits_for(locks, transaction, transaction)) {
+        locks->stats.deadlocks++;
+        transaction->waiting_for = NULL;
+        lock->waiters--;
+        pthread_mutex_unlock(&locks->mutex);
+        longjmp(*transaction->abort, 1);
+      }
+      pthread_mutex_unlock(&locks->mutex);
+      db_end_statement(transaction->db);
+
+      pthread_mutex_lock(&locks->mutex);
+      while (!lock_available(lock, transaction, mode)) {
+        pthread_cond_wait(&locks->released, &locks->mutex);
+      }
+      pthread_mutex_unlock(&locks->mutex);
+
+      // Others may have run and taken the page again by the time the gate
+      // is back
+      db_begin_statement(transaction->db);
+      pthread_mutex_lock(&locks->mutex);
+    } while (!lock_available(lock, transaction, mode));
+    transaction->waiting_for = NULL;
+    lock->waiters--;
+  }
+
+  if (own != NULL) {
+    own->mode = LOCK_EXCLUSIVE;
+  } else {
+    LockGrant *grant = malloc(sizeof(LockGrant));
+    grant->transaction = transaction;
+    grant->mode = mode;
+    grant->lock = lock;
+    grant->next = lock->grants;
+    lock->grants = grant;
+    grant->transaction_next = transaction->grants;
+    transaction->grants = grant;
+    locks->num_grants++;
+  }
+  pthread_mutex_unlock(&locks->mutex);
+}
+
+void lock_release_all(Transaction *transaction) {
+  LockTable *locks = transaction->locks;
+  pthread_mutex_lock(&locks->mutex);
+  LockGrant *grant = transaction->grants;
+  while (grant != NULL) {
+    LockGrant *next = grant->transaction_next;
+    PageLock *lock = grant->lock;
+    LockGrant **link = &lock->grants;
+    while (*link != grant) {
+      link = &(*link)->next;
+    }
+    *link = grant->next;
+    lock_drop_if_unused(locks, lock);
+    free(grant);
+    locks->num_grants--;
+    grant = next;
+  }
+  transaction->grants = NULL;
+  transaction->id = 0;
+  pthread_cond_broadcast(&locks->released);
+  pthread_mutex_unlock(&locks->mutex);
+}
+
+// Whether any transaction holds locks, so that a statement outside one has
+// to take them as well
+bool lock_busy(LockTable *locks) {
+  pthread_mutex_lock(&locks->mutex);
+  bool busy = locks->num_grants > 0;
+  pthread_mutex_unlock(&locks->mutex);
+  return busy;
+}
+
+// Waits, with the statement gate let go of, until no transaction holds locks
+void lock_wait_until_idle(LockTable *locks, struct Table *db) {
+  pthread_mutex_lock(&locks->mutex);
+  while (locks->num_grants > 0) {
+    pthread_mutex_unlock(&locks->mutex);
+    db_end_statement(db);
+
+    pthread_mutex_lock(&locks->mutex);
+    while (locks->num_grants > 0) {
+      pthread_cond_wait(&locks->released, &locks->mutex);
+    }
+    pthread_mutex_unlock(&locks->mutex);
+
+    db_begin_statement(db);
+    pthread_mutex_lock(&locks->mutex);
+  }
+  pthread_mutex_unlock(&locks->mutex);
+}
+
+void lock_set_current(Transaction *transaction) {
+  current_transaction = transaction;
+}
+
+Transaction *lock_current(void) { return current_transaction; }
+
+uint32_t lock_current_id(void) {
+  return current_transaction != NULL ? current_transaction->id : 0;
+}
+
+void lock_print_stats(LockTable *locks, int out_fd) {
+  dprintf(out_fd, "lock_waits %lu\n", (unsigned long)locks->stats.lock_waits);
+  dprintf(out_fd, "deadlocks %lu\n", (unsigned long)locks->stats.deadlocks);
+}
+
+void lock_reset_stats(LockTable *locks) {
+  locks->stats.lock_waits = 0;
+  locks->stats.deadlocks = 0;
+}
@@ -1,4 +1,5 @@
 #include "compiler.h"
+#include "dump.h"
 #include "input_buffer.h"
 #include "table.h"
 #include "vm.h"
@@ -7,25 +8,113 @@
 #include <string.h>
 #include <unistd.h>
 
+#define DEFAULT_PORT 8088
+
 // Forward declaration
-void run_server(const char *filename);
+void run_server(const char *filename, PagerOptions *options, int port,
+                int replication_port, const char *primary);
+
+static void print_usage(const char *program) {
+  printf("Usage: %s <filename> [--server] [--cache-pages <n>] [--mmap] "
+         "[--io-uring] [--page-size <bytes>] [--direct-io] "
+         "[--huge-pages] [--compress] [--warm-up] [--background-flush] "
+         "[--flush-rate <pages/s>] [--file-per-table] [--wal] "
+         "[--dump <file>] [--load <file>] [--port <n>] "
+         "[--replicate <port>] [--replica-of <host:port>]\n",
+         program);
+  fflush(stdout);
+}
 
 int main(int argc, char *argv[]) {
   if (argc < 2) {
     printf("Must supply a database filename.\n");
-    printf("Usage: %s <filename> [--server]\n", argv[0]);
-    fflush(stdout);
+    print_usage(argv[0]);
     exit(EXIT_FAILURE);
   }
 
   char *filename = argv[1];
+  bool server_mode = false;
+  const char *dump_path = NULL;
+  const char *load_path = NULL;
+  int port = DEFAULT_PORT;
+  int replication_port = 0;
+  const char *primary = NULL;
+  PagerOptions options;
+  pager_options_init(&options);
+
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--server") == 0) {
+      server_mode = true;
+    } else if (strcmp(argv[i], "--cache-pages") == 0 && i + 1 < argc) {
+      options.cache_frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--mmap") == 0) {
+      options.use_mmap = true;
+    } else if (strcmp(argv[i], "--io-uring") == 0) {
+      options.use_io_uring = true;
+    } else if (strcmp(argv[i], "--direct-io") == 0) {
+      options.use_direct_io = true;
+    } else if (strcmp(argv[i], "--huge-pages") == 0) {
+      options.use_huge_pages = true;
+    } else if (strcmp(argv[i], "--compress") == 0) {
+      options.compress = true;
+    } else if (strcmp(argv[i], "--warm-up") == 0) {
+      options.warm_up = true;
+    } else if (strcmp(argv[i], "--background-flush") == 0) {
+      options.background_flush = true;
+    } else if (strcmp(argv[i], "--flush-rate") == 0 && i + 1 < argc) {
+      options.flush_rate = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--file-per-table") == 0) {
+      options.file_per_table = true;
+    } else if (strcmp(argv[i], "--wal") == 0) {
+      options.use_wal = true;
+    } else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+      dump_path = argv[++i];
+    } else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+      load_path = argv[++i];
+    } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+      port = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--replicate") == 0 && i + 1 < argc) {
+      replication_port = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--replica-of") == 0 && i + 1 < argc) {
+      primary = argv[++i];
+    } else if (strcmp(argv[i], "--page-size") == 0 && i + 1 < argc) {
+      options.page_size = atoi(argv[++i]);
+      if (!pager_valid_page_size(options.page_size)) {
+        printf("Page size must be a power of two between %d and %d.\n",
+               MIN_PAGE_SIZE, MAX_PAGE_SIZE);
+        exit(EXIT_FAILURE);
+      }
+    } else {
+      printf("Unknown option '%s'\n", argv[i]);
+      print_usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if ((replication_port != 0 || primary != NULL) && !server_mode) {
+    printf("--replicate and --replica-of need --server.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (server_mode) {
+    run_server(filename, &options, port, replication_port, primary);
+    return 0;
+  }
 
-  if (argc > 2 && strcmp(argv[2], "--server") == 0) {
-    run_server(filename);
+  Table *table = db_open(filename, &options);
+  if (load_path != NULL || dump_path != NULL) {
+    // Offline modes: restore a dump, write one, or both in that order
+    if (load_path != NULL) {
+      load_database(table, load_path);
+    }
+    if (dump_path != NULL) {
+      dump_database(table, dump_path);
+    }
+    db_close(table);
     return 0;
   }
 
-  Table *table = db_open(filename);
+  Session session;
+  db_open_session(&session, table, STDOUT_FILENO);
 
   InputBuffer *input_buffer = new_input_buffer();
   while (1) {
@@ -61,7 +150,7 @@ int main(int argc, char *argv[]) {
       continue;
     }
 
-    switch (execute_statement(&statement, table, STDOUT_FILENO)) {
+    switch (execute_statement(&statement, &session)) {
     case EXECUTE_SUCCESS:
       printf("Executed.\n");
       break;
@@ -71,6 +160,12 @@ int main(int argc, char *argv[]) {
     case EXECUTE_TABLE_FULL:
       printf("Error: Table full.\n");
       break;
+    case EXECUTE_DEADLOCK:
+      printf("Error: Deadlock detected. Transaction rolled back.\n");
+      break;
+    case EXECUTE_READ_ONLY:
+      printf("Error: Read-only replica.\n");
+      break;
     }
   }
 }
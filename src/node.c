@@ -35,6 +35,7 @@ void initialize_internal_node(void *node) {
   set_node_type(node, NODE_INTERNAL);
   set_node_root(node, false);
   *internal_node_num_keys(node) = 0;
+  *internal_node_right_child(node) = INVALID_PAGE_NUM;
 }
 
 uint32_t *internal_node_num_keys(void *node) {
@@ -104,63 +105,109 @@ int compare_keys(void *k1, void *k2, KeyType type, uint32_t key_size) {
   }
 }
 
-// Helper to get pointer to max key
-void *get_node_max_key_ptr(void *node, uint32_t key_size, uint32_t child_size,
-                           uint32_t leaf_cell_size) {
-  switch (get_node_type(node)) {
-  case NODE_INTERNAL:
-    return internal_node_key(node, *internal_node_num_keys(node) - 1, key_size,
-                             child_size);
-  case NODE_LEAF:
-    return leaf_node_key(node, *leaf_node_num_cells(node) - 1, leaf_cell_size);
+// Copies the largest key stored under node into key_out. For internal nodes
+// that is the max key of the rightmost subtree.
+void get_node_max_key(Pager *pager, void *node, void *key_out,
+                      uint32_t key_size, uint32_t child_size,
+                      uint32_t leaf_cell_size) {
+  if (get_node_type(node) == NODE_LEAF) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (num_cells == 0) {
+      memset(key_out, 0, key_size);
+      return;
+    }
+    memcpy(key_out, leaf_node_key(node, num_cells - 1, leaf_cell_size),
+           key_size);
+    return;
   }
-  return NULL;
+  void *right_child = get_page(pager, *internal_node_right_child(node));
+  get_node_max_key(pager, right_child, key_out, key_size, child_size,
+                   leaf_cell_size);
+}
+
+// Trees allocate their pages by root page number, see pager_allocate_page()
+static uint32_t node_tree_root(Pager *pager, uint32_t page_num) {
+  void *node = get_page(pager, page_num);
+  while (!is_node_root(node)) {
+    page_num = *node_parent(node);
+    if (page_num == 0 || page_num >= pager->num_pages) {
+      return NO_PAGE; // Dangling parent pointer, allocate without an extent
+    }
+    node = get_page(pager, page_num);
+  }
+  return page_num;
 }
 
 void create_new_root(Table *table, uint32_t root_page_num,
                      uint32_t right_child_page_num, uint32_t key_size,
                      uint32_t child_size, uint32_t leaf_cell_size) {
-  void *root = get_page(table->pager, root_page_num);
-  void *right_child = get_page(table->pager, right_child_page_num);
-  uint32_t left_child_page_num = get_unused_page_num(table->pager);
-  void *left_child = get_page(table->pager, left_child_page_num);
+  Pager *pager = table->pager;
+  void *root = pin_page(pager, root_page_num);
+  void *right_child = pin_page(pager, right_child_page_num);
+  uint32_t left_child_page_num = pager_allocate_page(pager, root_page_num);
+  void *left_child = pin_page(pager, left_child_page_num);
+  pager_mark_dirty(pager, root_page_num);
+  pager_mark_dirty(pager, right_child_page_num);
+  pager_mark_dirty(pager, left_child_page_num);
 
   if (get_node_type(root) == NODE_INTERNAL) {
     initialize_internal_node(right_child);
     initialize_internal_node(left_child);
   }
 
-  memcpy(left_child, root, PAGE_SIZE);
+  memcpy(left_child, root, pager->page_size);
   set_node_root(left_child, false);
 
+  if (get_node_type(left_child) == NODE_INTERNAL) {
+    // The old root's children now hang off the left child
+    for (uint32_t i = 0; i < *internal_node_num_keys(left_child); i++) {
+      uint32_t child_page_num =
+          *internal_node_child(left_child, i, key_size, child_size);
+      void *child = get_page(pager, child_page_num);
+      pager_mark_dirty(pager, child_page_num);
+      *node_parent(child) = left_child_page_num;
+    }
+    uint32_t child_page_num = *internal_node_right_child(left_child);
+    void *child = get_page(pager, child_page_num);
+    pager_mark_dirty(pager, child_page_num);
+    *node_parent(child) = left_child_page_num;
+  }
+
   initialize_internal_node(root);
   set_node_root(root, true);
   *internal_node_num_keys(root) = 1;
-  *internal_node_right_child(root) = right_child_page_num;
-
-  void *left_max_key =
-      get_node_max_key_ptr(left_child, key_size, child_size, leaf_cell_size);
-  memcpy(internal_node_key(root, 0, key_size, child_size), left_max_key,
-         key_size);
-
   *internal_node_child(root, 0, key_size, child_size) = left_child_page_num;
+  get_node_max_key(pager, left_child,
+                   internal_node_key(root, 0, key_size, child_size), key_size,
+                   child_size, leaf_cell_size);
+  *internal_node_right_child(root) = right_child_page_num;
   *node_parent(left_child) = root_page_num;
   *node_parent(right_child) = root_page_num;
+
+  unpin_page(pager, left_child_page_num);
+  unpin_page(pager, right_child_page_num);
+  unpin_page(pager, root_page_num);
 }
 
 void leaf_node_split_and_insert(Cursor *cursor, void *key, uint32_t key_size,
                                 void *value, uint32_t value_size,
                                 KeyType key_type) {
-  void *old_node = get_page(cursor->table->pager, cursor->page_num);
+  Pager *pager = cursor->table->pager;
+  void *old_node = pin_page(pager, cursor->page_num);
 
   uint32_t cell_size = key_size + value_size;
-  uint32_t max_cells = (PAGE_SIZE - LEAF_NODE_HEADER_SIZE) / cell_size;
+  uint32_t max_cells = LEAF_NODE_SPACE_FOR_CELLS(pager->page_size) / cell_size;
 
-  void *old_max_key =
-      leaf_node_key(old_node, *leaf_node_num_cells(old_node) - 1, cell_size);
+  uint8_t old_max_key[NODE_MAX_KEY_SIZE];
+  memcpy(old_max_key,
+         leaf_node_key(old_node, *leaf_node_num_cells(old_node) - 1, cell_size),
+         key_size);
 
-  uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
-  void *new_node = get_page(cursor->table->pager, new_page_num);
+  uint32_t new_page_num =
+      pager_allocate_page(pager, node_tree_root(pager, cursor->page_num));
+  void *new_node = pin_page(pager, new_page_num);
+  pager_mark_dirty(pager, cursor->page_num);
+  pager_mark_dirty(pager, new_page_num);
   initialize_leaf_node(new_node);
   set_node_root(new_node, false);
   *node_parent(new_node) = *node_parent(old_node);
@@ -199,35 +246,27 @@ void leaf_node_split_and_insert(Cursor *cursor, void *key, uint32_t key_size,
 
   if (is_node_root(old_node)) {
     create_new_root(cursor->table, cursor->page_num, new_page_num, key_size,
-                    sizeof(uint32_t), cell_size);
+                    INTERNAL_NODE_CHILD_SIZE, cell_size);
   } else {
     uint32_t parent_page_num = *node_parent(old_node);
-    void *new_max_key =
-        leaf_node_key(old_node, *leaf_node_num_cells(old_node) - 1, cell_size);
-
-    void *parent = get_page(cursor->table->pager, parent_page_num);
-
-    uint32_t index = internal_node_find_child(parent, old_max_key, key_size,
-                                              sizeof(uint32_t), key_type);
-    uint32_t num_keys = *internal_node_num_keys(parent);
-
-    if (index == num_keys) {
-      /* Splitting right child */
-      *internal_node_child(parent, index, key_size, sizeof(uint32_t)) =
-          cursor->page_num;
-      memcpy(internal_node_key(parent, index, key_size, sizeof(uint32_t)),
-             new_max_key, key_size);
-      *internal_node_right_child(parent) = new_page_num;
-      *internal_node_num_keys(parent) = num_keys + 1;
-    } else {
-      /* Splitting regular child */
-      memcpy(internal_node_key(parent, index, key_size, sizeof(uint32_t)),
-             new_max_key, key_size);
-      internal_node_insert(cursor->table, parent_page_num, new_page_num,
-                           key_size, sizeof(uint32_t), key_type, cell_size);
-    }
-    return;
+    uint8_t new_max_key[NODE_MAX_KEY_SIZE];
+    memcpy(new_max_key,
+           leaf_node_key(old_node, *leaf_node_num_cells(old_node) - 1,
+                         cell_size),
+           key_size);
+
+    void *parent = pin_page(pager, parent_page_num);
+    pager_mark_dirty(pager, parent_page_num);
+    update_internal_node_key(parent, old_max_key, new_max_key, key_size,
+                             INTERNAL_NODE_CHILD_SIZE, key_type);
+    internal_node_insert(cursor->table, parent_page_num, new_page_num,
+                         key_size, INTERNAL_NODE_CHILD_SIZE, key_type,
+                         cell_size);
+    unpin_page(pager, parent_page_num);
   }
+
+  unpin_page(pager, new_page_num);
+  unpin_page(pager, cursor->page_num);
 }
 
 Cursor *leaf_node_find(Table *table, uint32_t page_num, void *key,
@@ -236,7 +275,7 @@ Cursor *leaf_node_find(Table *table, uint32_t page_num, void *key,
   void *node = get_page(table->pager, page_num);
   uint32_t num_cells = *leaf_node_num_cells(node);
 
-  Cursor *cursor = malloc(sizeof(Cursor));
+  Cursor *cursor = calloc(1, sizeof(Cursor));
   cursor->table = table;
   cursor->page_num = page_num;
 
@@ -266,11 +305,12 @@ Cursor *leaf_node_find(Table *table, uint32_t page_num, void *key,
 
 void leaf_node_insert(Cursor *cursor, void *key, uint32_t key_size, void *value,
                       uint32_t value_size, KeyType key_type) {
-  void *node = get_page(cursor->table->pager, cursor->page_num);
+  Pager *pager = cursor->table->pager;
+  void *node = get_page(pager, cursor->page_num);
 
   uint32_t num_cells = *leaf_node_num_cells(node);
   uint32_t cell_size = key_size + value_size;
-  uint32_t max_cells = (PAGE_SIZE - LEAF_NODE_HEADER_SIZE) / cell_size;
+  uint32_t max_cells = LEAF_NODE_SPACE_FOR_CELLS(pager->page_size) / cell_size;
 
   if (num_cells >= max_cells) {
     leaf_node_split_and_insert(cursor, key, key_size, value, value_size,
@@ -278,6 +318,8 @@ void leaf_node_insert(Cursor *cursor, void *key, uint32_t key_size, void *value,
     return;
   }
 
+  pager_mark_dirty(pager, cursor->page_num);
+
   if (cursor->cell_num < num_cells) {
     // Make room for new cell
     for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
@@ -292,6 +334,8 @@ void leaf_node_insert(Cursor *cursor, void *key, uint32_t key_size, void *value,
          value_size);
 }
 
+static void leaf_node_remove(Cursor *cursor, uint32_t key_size);
+
 void leaf_node_delete(Cursor *cursor, void *key, uint32_t key_size,
                       uint32_t value_size, KeyType key_type) {
   void *node = get_page(cursor->table->pager, cursor->page_num);
@@ -308,6 +352,8 @@ void leaf_node_delete(Cursor *cursor, void *key, uint32_t key_size,
     return; // Key mismatch
   }
 
+  pager_mark_dirty(cursor->table->pager, cursor->page_num);
+
   // Shift cells left
   for (uint32_t i = cursor->cell_num; i < num_cells - 1; i++) {
     memcpy(leaf_node_cell(node, i, cell_size),
@@ -315,93 +361,268 @@ void leaf_node_delete(Cursor *cursor, void *key, uint32_t key_size,
   }
 
   *(leaf_node_num_cells(node)) -= 1;
+
+  if (*leaf_node_num_cells(node) == 0 && !is_node_root(node)) {
+    leaf_node_remove(cursor, key_size);
+  }
+}
+
+// Slot of parent that points at child: a cell index, or num_keys for the
+// right child
+static uint32_t internal_node_child_index(void *parent,
+                                          uint32_t child_page_num,
+                                          uint32_t key_size,
+                                          uint32_t child_size) {
+  uint32_t num_keys = *internal_node_num_keys(parent);
+  for (uint32_t i = 0; i < num_keys; i++) {
+    if (*internal_node_child(parent, i, key_size, child_size) ==
+        child_page_num) {
+      return i;
+    }
+  }
+  return num_keys;
+}
+
+// Leaf that precedes page_num in key order, or INVALID_PAGE_NUM for the
+// leftmost leaf
+static uint32_t previous_leaf(Pager *pager, uint32_t page_num,
+                              uint32_t key_size, uint32_t child_size) {
+  uint32_t node_page_num = page_num;
+  while (!is_node_root(get_page(pager, node_page_num))) {
+    uint32_t parent_page_num = *node_parent(get_page(pager, node_page_num));
+    void *parent = get_page(pager, parent_page_num);
+    uint32_t index =
+        internal_node_child_index(parent, node_page_num, key_size, child_size);
+    if (index > 0) {
+      uint32_t leaf_page_num =
+          *internal_node_child(parent, index - 1, key_size, child_size);
+      void *leaf = get_page(pager, leaf_page_num);
+      while (get_node_type(leaf) == NODE_INTERNAL) {
+        leaf_page_num = *internal_node_right_child(leaf);
+        leaf = get_page(pager, leaf_page_num);
+      }
+      return leaf_page_num;
+    }
+    node_page_num = parent_page_num;
+  }
+  return INVALID_PAGE_NUM;
+}
+
+/*
+ * Unhooks child from parent. An internal node left without children is
+ * removed from its own parent and freed in turn; an emptied root becomes an
+ * empty leaf so the table keeps its root page.
+ */
+static void internal_node_remove_child(Table *table, uint32_t parent_page_num,
+                                       uint32_t child_page_num,
+                                       uint32_t key_size, uint32_t child_size) {
+  Pager *pager = table->pager;
+  void *parent = pin_page(pager, parent_page_num);
+  pager_mark_dirty(pager, parent_page_num);
+
+  uint32_t num_keys = *internal_node_num_keys(parent);
+  uint32_t index =
+      internal_node_child_index(parent, child_page_num, key_size, child_size);
+  uint32_t cell_size = key_size + child_size;
+
+  if (num_keys == 0) {
+    /* child was the only child */
+    if (is_node_root(parent)) {
+      initialize_leaf_node(parent);
+      set_node_root(parent, true);
+    } else {
+      internal_node_remove_child(table, *node_parent(parent), parent_page_num,
+                                 key_size, child_size);
+      unpin_page(pager, parent_page_num);
+      pager_free_page(pager, parent_page_num);
+      return;
+    }
+  } else if (index == num_keys) {
+    /* Removing right child: the last cell takes its place */
+    *internal_node_right_child(parent) =
+        *internal_node_child(parent, num_keys - 1, key_size, child_size);
+    *internal_node_num_keys(parent) = num_keys - 1;
+  } else {
+    for (uint32_t i = index; i < num_keys - 1; i++) {
+      memcpy(internal_node_cell(parent, i, cell_size),
+             internal_node_cell(parent, i + 1, cell_size), cell_size);
+    }
+    *internal_node_num_keys(parent) = num_keys - 1;
+  }
+
+  unpin_page(pager, parent_page_num);
+}
+
+/*
+ * Takes an emptied, non-root leaf out of the tree and the leaf chain and
+ * returns its page to the freelist. The cursor is left where the next row
+ * now lives.
+ */
+static void leaf_node_remove(Cursor *cursor, uint32_t key_size) {
+  Pager *pager = cursor->table->pager;
+  uint32_t child_size = sizeof(uint32_t);
+  uint32_t page_num = cursor->page_num;
+
+  void *node = get_page(pager, page_num);
+  uint32_t next_page_num = *leaf_node_next_leaf(node);
+  uint32_t parent_page_num = *node_parent(node);
+
+  uint32_t root_page_num = page_num;
+  while (!is_node_root(get_page(pager, root_page_num))) {
+    root_page_num = *node_parent(get_page(pager, root_page_num));
+  }
+
+  uint32_t prev_page_num = previous_leaf(pager, page_num, key_size, child_size);
+  if (prev_page_num != INVALID_PAGE_NUM) {
+    void *prev = get_page(pager, prev_page_num);
+    pager_mark_dirty(pager, prev_page_num);
+    *leaf_node_next_leaf(prev) = next_page_num;
+  }
+
+  internal_node_remove_child(cursor->table, parent_page_num, page_num,
+                             key_size, child_size);
+  pager_free_page(pager, page_num);
+
+  if (next_page_num != 0) {
+    cursor->page_num = next_page_num;
+    cursor->cell_num = 0;
+  } else if (prev_page_num != INVALID_PAGE_NUM) {
+    cursor->page_num = prev_page_num;
+    cursor->cell_num = *leaf_node_num_cells(get_page(pager, prev_page_num));
+    cursor->end_of_table = true;
+  } else {
+    cursor->page_num = root_page_num;
+    cursor->cell_num = 0;
+    cursor->end_of_table = true;
+  }
 }
 
 void internal_node_insert(Table *table, uint32_t parent_page_num,
                           uint32_t child_page_num, uint32_t key_size,
                           uint32_t child_size, KeyType key_type,
                           uint32_t leaf_cell_size) {
-  void *parent = get_page(table->pager, parent_page_num);
-  void *child = get_page(table->pager, child_page_num);
+  Pager *pager = table->pager;
+  void *parent = pin_page(pager, parent_page_num);
+  void *child = pin_page(pager, child_page_num);
 
-  void *child_max_key =
-      get_node_max_key_ptr(child, key_size, child_size, leaf_cell_size);
+  uint8_t child_max_key[NODE_MAX_KEY_SIZE];
+  get_node_max_key(pager, child, child_max_key, key_size, child_size,
+                   leaf_cell_size);
   uint32_t num_keys = *internal_node_num_keys(parent);
 
   uint32_t cell_size = key_size + child_size;
-  uint32_t max_cells = (PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE) / cell_size;
+  uint32_t max_cells =
+      INTERNAL_NODE_SPACE_FOR_CELLS(pager->page_size) / cell_size;
+
+  uint32_t right_child_page_num = *internal_node_right_child(parent);
 
   if (num_keys >= max_cells) {
     internal_node_split_and_insert(table, parent_page_num, child_page_num,
                                    key_size, child_size, key_type,
                                    leaf_cell_size);
-    return;
-  }
-
-  uint32_t index = internal_node_find_child(parent, child_max_key, key_size,
-                                            child_size, key_type);
-
-  for (uint32_t i = num_keys; i > index; i--) {
-    memcpy(internal_node_cell(parent, i, cell_size),
-           internal_node_cell(parent, i - 1, cell_size), cell_size);
+  } else if (right_child_page_num == INVALID_PAGE_NUM) {
+    /* Empty internal node */
+    pager_mark_dirty(pager, parent_page_num);
+    *internal_node_right_child(parent) = child_page_num;
+  } else {
+    pager_mark_dirty(pager, parent_page_num);
+    uint8_t right_max_key[NODE_MAX_KEY_SIZE];
+    get_node_max_key(pager, get_page(pager, right_child_page_num),
+                     right_max_key, key_size, child_size, leaf_cell_size);
+
+    if (compare_keys(child_max_key, right_max_key, key_type, key_size) > 0) {
+      /* Replace right child */
+      *internal_node_child(parent, num_keys, key_size, child_size) =
+          right_child_page_num;
+      memcpy(internal_node_key(parent, num_keys, key_size, child_size),
+             right_max_key, key_size);
+      *internal_node_right_child(parent) = child_page_num;
+    } else {
+      /* Make room for the new cell */
+      uint32_t index = internal_node_find_child(parent, child_max_key,
+                                                key_size, child_size, key_type);
+      for (uint32_t i = num_keys; i > index; i--) {
+        memcpy(internal_node_cell(parent, i, cell_size),
+               internal_node_cell(parent, i - 1, cell_size), cell_size);
+      }
+      *internal_node_child(parent, index, key_size, child_size) =
+          child_page_num;
+      memcpy(internal_node_key(parent, index, key_size, child_size),
+             child_max_key, key_size);
+    }
+    *internal_node_num_keys(parent) = num_keys + 1;
   }
 
-  *internal_node_num_keys(parent) = num_keys + 1;
-  *internal_node_child(parent, index, key_size, child_size) = child_page_num;
-  memcpy(internal_node_key(parent, index, key_size, child_size), child_max_key,
-         key_size);
+  unpin_page(pager, child_page_num);
+  unpin_page(pager, parent_page_num);
 }
 
 void internal_node_split_and_insert(Table *table, uint32_t parent_page_num,
                                     uint32_t child_page_num, uint32_t key_size,
                                     uint32_t child_size, KeyType key_type,
                                     uint32_t leaf_cell_size) {
+  Pager *pager = table->pager;
   uint32_t old_page_num = parent_page_num;
-  void *old_node = get_page(table->pager, parent_page_num);
+  void *old_node = pin_page(pager, parent_page_num);
 
-  void *old_max =
-      get_node_max_key_ptr(old_node, key_size, child_size, leaf_cell_size);
+  uint8_t old_max[NODE_MAX_KEY_SIZE];
+  get_node_max_key(pager, old_node, old_max, key_size, child_size,
+                   leaf_cell_size);
 
-  void *child = get_page(table->pager, child_page_num);
-  void *child_max =
-      get_node_max_key_ptr(child, key_size, child_size, leaf_cell_size);
+  void *child = pin_page(pager, child_page_num);
+  uint8_t child_max[NODE_MAX_KEY_SIZE];
+  get_node_max_key(pager, child, child_max, key_size, child_size,
+                   leaf_cell_size);
 
-  uint32_t new_page_num = get_unused_page_num(table->pager);
+  uint32_t new_page_num =
+      pager_allocate_page(pager, node_tree_root(pager, parent_page_num));
   uint32_t splitting_root = is_node_root(old_node);
 
   void *parent;
-  void *new_node;
+  void *new_node = NULL;
+  uint32_t grandparent_page_num;
   if (splitting_root) {
     create_new_root(table, parent_page_num, new_page_num, key_size, child_size,
                     leaf_cell_size);
-    parent = get_page(table->pager, parent_page_num);
+    grandparent_page_num = parent_page_num;
+    parent = pin_page(pager, grandparent_page_num);
     old_page_num = *internal_node_child(parent, 0, key_size, child_size);
-    old_node = get_page(table->pager, old_page_num);
+    old_node = pin_page(pager, old_page_num);
   } else {
-    parent = get_page(table->pager, *node_parent(old_node));
-    new_node = get_page(table->pager, new_page_num);
+    grandparent_page_num = *node_parent(old_node);
+    parent = pin_page(pager, grandparent_page_num);
+    new_node = pin_page(pager, new_page_num);
+    pager_mark_dirty(pager, new_page_num);
     initialize_internal_node(new_node);
   }
+  pager_mark_dirty(pager, old_page_num);
+  pager_mark_dirty(pager, grandparent_page_num);
+  pager_mark_dirty(pager, child_page_num);
 
   uint32_t *old_num_keys = internal_node_num_keys(old_node);
   uint32_t cur_page_num = *internal_node_right_child(old_node);
-  void *cur_node = get_page(table->pager, cur_page_num);
+  void *cur_node = pin_page(pager, cur_page_num);
 
   internal_node_insert(table, new_page_num, cur_page_num, key_size, child_size,
                        key_type, leaf_cell_size);
+  pager_mark_dirty(pager, cur_page_num);
   *node_parent(cur_node) = new_page_num;
   *internal_node_right_child(old_node) = INVALID_PAGE_NUM;
+  unpin_page(pager, cur_page_num);
 
   uint32_t cell_size = key_size + child_size;
-  uint32_t max_cells = (PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE) / cell_size;
+  uint32_t max_cells =
+      INTERNAL_NODE_SPACE_FOR_CELLS(pager->page_size) / cell_size;
 
   for (uint32_t i = max_cells - 1; i > max_cells / 2; i--) {
     cur_page_num = *internal_node_child(old_node, i, key_size, child_size);
-    cur_node = get_page(table->pager, cur_page_num);
+    cur_node = pin_page(pager, cur_page_num);
 
     internal_node_insert(table, new_page_num, cur_page_num, key_size,
                          child_size, key_type, leaf_cell_size);
+    pager_mark_dirty(pager, cur_page_num);
     *node_parent(cur_node) = new_page_num;
+    unpin_page(pager, cur_page_num);
 
     (*old_num_keys)--;
   }
@@ -410,8 +631,9 @@ void internal_node_split_and_insert(Table *table, uint32_t parent_page_num,
       *internal_node_child(old_node, *old_num_keys - 1, key_size, child_size);
   (*old_num_keys)--;
 
-  void *max_after_split =
-      get_node_max_key_ptr(old_node, key_size, child_size, leaf_cell_size);
+  uint8_t max_after_split[NODE_MAX_KEY_SIZE];
+  get_node_max_key(pager, old_node, max_after_split, key_size, child_size,
+                   leaf_cell_size);
 
   uint32_t destination_page_num = old_page_num;
   if (compare_keys(child_max, max_after_split, key_type, key_size) > 0) {
@@ -422,16 +644,24 @@ void internal_node_split_and_insert(Table *table, uint32_t parent_page_num,
                        child_size, key_type, leaf_cell_size);
   *node_parent(child) = destination_page_num;
 
-  update_internal_node_key(
-      parent, old_max,
-      get_node_max_key_ptr(old_node, key_size, child_size, leaf_cell_size),
-      key_size, child_size, key_type);
+  uint8_t new_old_max[NODE_MAX_KEY_SIZE];
+  get_node_max_key(pager, old_node, new_old_max, key_size, child_size,
+                   leaf_cell_size);
+  update_internal_node_key(parent, old_max, new_old_max, key_size, child_size,
+                           key_type);
 
   if (!splitting_root) {
     internal_node_insert(table, *node_parent(old_node), new_page_num, key_size,
                          child_size, key_type, leaf_cell_size);
     *node_parent(new_node) = *node_parent(old_node);
+    unpin_page(pager, new_page_num);
+  } else {
+    unpin_page(pager, old_page_num);
   }
+
+  unpin_page(pager, grandparent_page_num);
+  unpin_page(pager, child_page_num);
+  unpin_page(pager, parent_page_num);
 }
 
 void update_internal_node_key(void *node, void *old_key, void *new_key,
@@ -439,6 +669,9 @@ void update_internal_node_key(void *node, void *old_key, void *new_key,
                               KeyType key_type) {
   uint32_t old_child_index =
       internal_node_find_child(node, old_key, key_size, child_size, key_type);
+  if (old_child_index >= *internal_node_num_keys(node)) {
+    return; // The right child has no key of its own
+  }
   memcpy(internal_node_key(node, old_child_index, key_size, child_size),
          new_key, key_size);
 }
@@ -463,3 +696,186 @@ uint32_t internal_node_find_child(void *node, void *key, uint32_t key_size,
 
   return min_index;
 }
+
+static void spool_read(FILE *spool, void *destination, uint32_t cell_size,
+                       uint32_t count) {
+  if (fread(destination, cell_size, count, spool) != count) {
+    printf("Error reading rebuild spool file.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Returns every node below page_num to the freelist
+static void free_subtree(Pager *pager, uint32_t page_num, uint32_t key_size) {
+  void *node = pin_page(pager, page_num);
+  if (get_node_type(node) == NODE_INTERNAL) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= num_keys; i++) {
+      uint32_t child_page_num =
+          i < num_keys ? *internal_node_child(node, i, key_size,
+                                              INTERNAL_NODE_CHILD_SIZE)
+                       : *internal_node_right_child(node);
+      if (child_page_num == INVALID_PAGE_NUM) {
+        continue;
+      }
+      free_subtree(pager, child_page_num, key_size);
+      pager_free_page(pager, child_page_num);
+    }
+  }
+  unpin_page(pager, page_num);
+}
+
+// Frees every node of the tree except the root, which becomes an empty leaf
+void clear_tree(Table *table, uint32_t root_page_num, uint32_t key_size) {
+  Pager *pager = table->pager;
+  free_subtree(pager, root_page_num, key_size);
+  void *root = get_page(pager, root_page_num);
+  pager_mark_dirty(pager, root_page_num);
+  initialize_leaf_node(root);
+  set_node_root(root, true);
+}
+
+// Makes page_num an internal node over children, given their max keys
+static void fill_internal_node(Pager *pager, uint32_t page_num,
+                               uint32_t *children, uint8_t *keys,
+                               uint32_t count, uint32_t key_size) {
+  void *node = pin_page(pager, page_num);
+  pager_mark_dirty(pager, page_num);
+  initialize_internal_node(node);
+  for (uint32_t i = 0; i + 1 < count; i++) {
+    *internal_node_child(node, i, key_size, INTERNAL_NODE_CHILD_SIZE) =
+        children[i];
+    memcpy(internal_node_key(node, i, key_size, INTERNAL_NODE_CHILD_SIZE),
+           keys + (size_t)i * key_size, key_size);
+  }
+  *internal_node_num_keys(node) = count - 1;
+  *internal_node_right_child(node) = children[count - 1];
+  unpin_page(pager, page_num);
+
+  for (uint32_t i = 0; i < count; i++) {
+    void *child = get_page(pager, children[i]);
+    pager_mark_dirty(pager, children[i]);
+    *node_parent(child) = page_num;
+  }
+}
+
+/*
+ * Rewrites the tree rooted at root_page_num with full nodes on pages in key
+ * order. The cells are spooled to a temporary file, from which
+ * bulk_load_tree() builds the tree again.
+ */
+void rebuild_tree(Table *table, uint32_t root_page_num, uint32_t key_size,
+                  uint32_t value_size) {
+  Pager *pager = table->pager;
+  uint32_t cell_size = key_size + value_size;
+
+  FILE *spool = tmpfile();
+  if (spool == NULL) {
+    printf("Unable to create rebuild spool file.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  Cursor *cursor = table_start(table, root_page_num);
+  uint32_t page_num = cursor->page_num;
+  free(cursor);
+  uint32_t num_cells = 0;
+  while (page_num != 0) {
+    void *node = get_page(pager, page_num);
+    uint32_t cells = *leaf_node_num_cells(node);
+    if (fwrite(leaf_node_cell(node, 0, cell_size), cell_size, cells, spool) !=
+        cells) {
+      printf("Error writing rebuild spool file.\n");
+      exit(EXIT_FAILURE);
+    }
+    num_cells += cells;
+    page_num = *leaf_node_next_leaf(node);
+  }
+  rewind(spool);
+
+  bulk_load_tree(table, root_page_num, key_size, value_size, spool,
+                 num_cells);
+  fclose(spool);
+}
+
+/*
+ * Replaces the tree rooted at root_page_num with the num_cells cells read
+ * from spool, which must be sorted by key and free of duplicates. The old
+ * nodes are freed and the freelist compacted, so the new nodes take the
+ * lowest free pages, leaves first. The tree is built bottom up from full
+ * nodes, and the root keeps its page number.
+ */
+void bulk_load_tree(Table *table, uint32_t root_page_num, uint32_t key_size,
+                    uint32_t value_size, FILE *spool, uint32_t num_cells) {
+  Pager *pager = table->pager;
+  uint32_t cell_size = key_size + value_size;
+
+  free_subtree(pager, root_page_num, key_size);
+  pager_compact(pager);
+
+  uint32_t leaf_max_cells =
+      LEAF_NODE_SPACE_FOR_CELLS(pager->page_size) / cell_size;
+  uint32_t internal_max_children =
+      INTERNAL_NODE_SPACE_FOR_CELLS(pager->page_size) /
+          (key_size + INTERNAL_NODE_CHILD_SIZE) +
+      1;
+
+  if (num_cells <= leaf_max_cells) {
+    void *root = pin_page(pager, root_page_num);
+    pager_mark_dirty(pager, root_page_num);
+    initialize_leaf_node(root);
+    set_node_root(root, true);
+    spool_read(spool, leaf_node_cell(root, 0, cell_size), cell_size,
+               num_cells);
+    *leaf_node_num_cells(root) = num_cells;
+    unpin_page(pager, root_page_num);
+    return;
+  }
+
+  // Cells are spread evenly so the last leaf is not left nearly empty
+  uint32_t count = (num_cells + leaf_max_cells - 1) / leaf_max_cells;
+  uint32_t *pages = malloc(sizeof(uint32_t) * count);
+  uint8_t *keys = malloc((size_t)key_size * count);
+  for (uint32_t i = 0; i < count; i++) {
+    pages[i] = get_unused_page_num(pager);
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t cells = num_cells / count + (i < num_cells % count);
+    void *leaf = pin_page(pager, pages[i]);
+    pager_mark_dirty(pager, pages[i]);
+    initialize_leaf_node(leaf);
+    spool_read(spool, leaf_node_cell(leaf, 0, cell_size), cell_size, cells);
+    *leaf_node_num_cells(leaf) = cells;
+    *leaf_node_next_leaf(leaf) = i + 1 < count ? pages[i + 1] : 0;
+    memcpy(keys + (size_t)i * key_size,
+           leaf_node_key(leaf, cells - 1, cell_size), key_size);
+    unpin_page(pager, pages[i]);
+  }
+
+  // Internal levels, until the top one fits in the root
+  while (count > internal_max_children) {
+    uint32_t parents =
+        (count + internal_max_children - 1) / internal_max_children;
+    uint32_t *parent_pages = malloc(sizeof(uint32_t) * parents);
+    uint8_t *parent_keys = malloc((size_t)key_size * parents);
+    uint32_t first = 0;
+    for (uint32_t i = 0; i < parents; i++) {
+      uint32_t children = count / parents + (i < count % parents);
+      parent_pages[i] = get_unused_page_num(pager);
+      fill_internal_node(pager, parent_pages[i], pages + first,
+                         keys + (size_t)first * key_size, children, key_size);
+      memcpy(parent_keys + (size_t)i * key_size,
+             keys + (size_t)(first + children - 1) * key_size, key_size);
+      first += children;
+    }
+    free(pages);
+    free(keys);
+    pages = parent_pages;
+    keys = parent_keys;
+    count = parents;
+  }
+
+  fill_internal_node(pager, root_page_num, pages, keys, count, key_size);
+  set_node_root(get_page(pager, root_page_num), true);
+  free(pages);
+  free(keys);
+}
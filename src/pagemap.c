@@ -0,0 +1,381 @@
+#include "pagemap.h"
+#include "compress.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t page_size;
+  uint32_t num_pages;
+  uint64_t map_offset;
+  uint32_t map_length;
+  uint32_t map_capacity;
+} PageMapHeader;
+
+static uint64_t round_to_sector(uint64_t length) {
+  return (length + PAGE_MAP_SECTOR_SIZE - 1) &
+         ~(uint64_t)(PAGE_MAP_SECTOR_SIZE - 1);
+}
+
+static void free_extent_remove(PageMap *map, uint32_t index) {
+  memmove(&map->free[index], &map->free[index + 1],
+          sizeof(FreeExtent) * (map->num_free - index - 1));
+  map->num_free--;
+}
+
+// Returns space to the free list, merging it with its neighbours
+static void free_extent_add(PageMap *map, uint64_t offset, uint64_t length) {
+  if (length == 0) {
+    return;
+  }
+
+  uint32_t index = 0;
+  while (index < map->num_free && map->free[index].offset < offset) {
+    index++;
+  }
+
+  if (map->num_free == map->free_capacity) {
+    map->free_capacity = map->free_capacity ? map->free_capacity * 2 : 16;
+    map->free = realloc(map->free, sizeof(FreeExtent) * map->free_capacity);
+  }
+  memmove(&map->free[index + 1], &map->free[index],
+          sizeof(FreeExtent) * (map->num_free - index));
+  map->free[index].offset = offset;
+  map->free[index].length = length;
+  map->num_free++;
+
+  if (index + 1 < map->num_free &&
+      offset + length == map->free[index + 1].offset) {
+    map->free[index].length += map->free[index + 1].length;
+    free_extent_remove(map, index + 1);
+  }
+  if (index > 0 &&
+      map->free[index - 1].offset + map->free[index - 1].length == offset) {
+    map->free[index - 1].length += map->free[index].length;
+    free_extent_remove(map, index);
+    index--;
+  }
+
+  // Free space at the end of the file is given back by truncating
+  FreeExtent *last = &map->free[map->num_free - 1];
+  if (last->offset + last->length == map->file_end) {
+    map->file_end = last->offset;
+    map->num_free--;
+  }
+}
+
+// Holds back space the checkpointed map may still point at
+static void pending_extent_add(PageMap *map, uint64_t offset,
+                               uint64_t length) {
+  if (map->num_pending == map->pending_capacity) {
+    map->pending_capacity =
+        map->pending_capacity ? map->pending_capacity * 2 : 16;
+    map->pending =
+        realloc(map->pending, sizeof(FreeExtent) * map->pending_capacity);
+  }
+  map->pending[map->num_pending].offset = offset;
+  map->pending[map->num_pending].length = length;
+  map->num_pending++;
+}
+
+// Gives up a page's slot: at once if only this run of writes used it,
+// otherwise once the next checkpoint is durable
+static void page_map_release_slot(PageMap *map, uint32_t page_num) {
+  PageSlot *slot = &map->slots[page_num];
+  if (slot->offset == 0) {
+    return;
+  }
+  if (map->unsynced[page_num]) {
+    free_extent_add(map, slot->offset, slot->capacity);
+  } else {
+    pending_extent_add(map, slot->offset, slot->capacity);
+  }
+}
+
+static void page_map_sync(PageMap *map) {
+  if (fdatasync(map->file_descriptor) == -1) {
+    printf("Error syncing db file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// First fit, falling back to extending the file
+static uint64_t free_extent_allocate(PageMap *map, uint64_t length) {
+  for (uint32_t i = 0; i < map->num_free; i++) {
+    FreeExtent *extent = &map->free[i];
+    if (extent->length >= length) {
+      uint64_t offset = extent->offset;
+      extent->offset += length;
+      extent->length -= length;
+      if (extent->length == 0) {
+        free_extent_remove(map, i);
+      }
+      return offset;
+    }
+  }
+
+  uint64_t offset = map->file_end;
+  map->file_end += length;
+  return offset;
+}
+
+static int compare_slot_offset(const void *a, const void *b) {
+  uint64_t offset_a = ((const PageSlot *)a)->offset;
+  uint64_t offset_b = ((const PageSlot *)b)->offset;
+  return (offset_a > offset_b) - (offset_a < offset_b);
+}
+
+// The free list is not stored; it is whatever the slots leave uncovered
+static void page_map_rebuild_free_list(PageMap *map) {
+  PageSlot *used = malloc(sizeof(PageSlot) * (map->num_pages + 1));
+  uint32_t num_used = 0;
+  for (uint32_t i = 0; i < map->num_pages; i++) {
+    if (map->slots[i].offset != 0) {
+      used[num_used++] = map->slots[i];
+    }
+  }
+  if (map->map_slot.offset != 0) {
+    used[num_used++] = map->map_slot;
+  }
+  qsort(used, num_used, sizeof(PageSlot), compare_slot_offset);
+
+  map->file_end = PAGE_MAP_HEADER_SIZE;
+  for (uint32_t i = 0; i < num_used; i++) {
+    if (used[i].offset + used[i].capacity > map->file_end) {
+      map->file_end = used[i].offset + used[i].capacity;
+    }
+  }
+
+  uint64_t position = PAGE_MAP_HEADER_SIZE;
+  for (uint32_t i = 0; i < num_used; i++) {
+    if (used[i].offset > position) {
+      free_extent_add(map, position, used[i].offset - position);
+    }
+    if (used[i].offset + used[i].capacity > position) {
+      position = used[i].offset + used[i].capacity;
+    }
+  }
+  free(used);
+}
+
+static void page_map_write_header(PageMap *map) {
+  uint8_t buffer[PAGE_MAP_HEADER_SIZE];
+  memset(buffer, 0, sizeof(buffer));
+
+  PageMapHeader *header = (PageMapHeader *)buffer;
+  header->magic = PAGE_MAP_MAGIC;
+  header->version = PAGE_MAP_VERSION;
+  header->page_size = map->page_size;
+  header->num_pages = map->num_pages;
+  header->map_offset = map->map_slot.offset;
+  header->map_length = map->map_slot.length;
+  header->map_capacity = map->map_slot.capacity;
+
+  if (pwrite(map->file_descriptor, buffer, sizeof(buffer), 0) == -1) {
+    printf("Error writing: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+}
+
+bool page_map_probe(int fd, uint32_t *page_size) {
+  PageMapHeader header;
+  if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      header.magic != PAGE_MAP_MAGIC) {
+    return false;
+  }
+  *page_size = header.page_size;
+  return true;
+}
+
+PageMap *page_map_open(int fd, uint32_t page_size, bool create) {
+  PageMap *map = calloc(1, sizeof(PageMap));
+  map->file_descriptor = fd;
+  map->page_size = page_size;
+  map->scratch = malloc(page_size);
+  map->file_end = PAGE_MAP_HEADER_SIZE;
+
+  if (create) {
+    // Stamp the header first so the file is recognised even if it is never
+    // checkpointed
+    page_map_write_header(map);
+    return map;
+  }
+
+  PageMapHeader header;
+  if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      header.magic != PAGE_MAP_MAGIC || header.version != PAGE_MAP_VERSION) {
+    printf("Compressed db file has an invalid header. Corrupt file.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  map->num_pages = header.num_pages;
+  map->slots_capacity = map->num_pages;
+  map->slots = calloc(map->slots_capacity + 1, sizeof(PageSlot));
+  map->unsynced = calloc(map->slots_capacity + 1, sizeof(bool));
+  map->map_slot.offset = header.map_offset;
+  map->map_slot.length = header.map_length;
+  map->map_slot.capacity = header.map_capacity;
+
+  if (header.map_length != header.num_pages * sizeof(PageSlot) ||
+      (header.map_length > 0 &&
+       pread(fd, map->slots, header.map_length, header.map_offset) !=
+           (ssize_t)header.map_length)) {
+    printf("Compressed db file has an unreadable page map. Corrupt file.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  page_map_rebuild_free_list(map);
+  return map;
+}
+
+void page_map_close(PageMap *map) {
+  free(map->slots);
+  free(map->unsynced);
+  free(map->free);
+  free(map->pending);
+  free(map->scratch);
+  free(map);
+}
+
+uint32_t page_map_read(PageMap *map, uint32_t page_num, void *destination) {
+  if (page_num >= map->num_pages || map->slots[page_num].offset == 0) {
+    memset(destination, 0, map->page_size);
+    return 0;
+  }
+
+  PageSlot *slot = &map->slots[page_num];
+  bool raw = slot->length == map->page_size;
+  void *buffer = raw ? destination : map->scratch;
+
+  ssize_t bytes_read =
+      pread(map->file_descriptor, buffer, slot->length, slot->offset);
+  if (bytes_read != (ssize_t)slot->length) {
+    printf("Error reading file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  if (!raw && !lz_decompress(map->scratch, slot->length, destination,
+                             map->page_size)) {
+    printf("Compressed page %d is damaged. Corrupt file.\n", page_num);
+    exit(EXIT_FAILURE);
+  }
+  return slot->length;
+}
+
+uint32_t page_map_write(PageMap *map, uint32_t page_num, const void *source) {
+  // Pages that do not shrink are stored as they are
+  const void *data = map->scratch;
+  uint32_t length =
+      lz_compress(source, map->page_size, map->scratch, map->page_size - 1);
+  if (length == 0) {
+    data = source;
+    length = map->page_size;
+  }
+  uint64_t needed = round_to_sector(length);
+
+  if (page_num >= map->slots_capacity) {
+    uint32_t capacity = map->slots_capacity ? map->slots_capacity : 64;
+    while (capacity <= page_num) {
+      capacity *= 2;
+    }
+    map->slots = realloc(map->slots, sizeof(PageSlot) * capacity);
+    memset(&map->slots[map->slots_capacity], 0,
+           sizeof(PageSlot) * (capacity - map->slots_capacity));
+    map->unsynced = realloc(map->unsynced, sizeof(bool) * capacity);
+    memset(&map->unsynced[map->slots_capacity], 0,
+           sizeof(bool) * (capacity - map->slots_capacity));
+    map->slots_capacity = capacity;
+  }
+  if (page_num >= map->num_pages) {
+    map->num_pages = page_num + 1;
+  }
+
+  PageSlot *slot = &map->slots[page_num];
+  if (map->unsynced[page_num] && slot->capacity >= needed) {
+    // No checkpoint has seen this slot, so it can be rewritten in place;
+    // hand back what it no longer needs
+    free_extent_add(map, slot->offset + needed, slot->capacity - needed);
+  } else {
+    page_map_release_slot(map, page_num);
+    slot->offset = free_extent_allocate(map, needed);
+    map->unsynced[page_num] = true;
+  }
+  slot->capacity = needed;
+  slot->length = length;
+  map->dirty = true;
+
+  if (pwrite(map->file_descriptor, data, length, slot->offset) !=
+      (ssize_t)length) {
+    printf("Error writing: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  return length;
+}
+
+void page_map_truncate(PageMap *map, uint32_t num_pages) {
+  for (uint32_t i = num_pages; i < map->num_pages; i++) {
+    page_map_release_slot(map, i);
+    memset(&map->slots[i], 0, sizeof(PageSlot));
+    map->unsynced[i] = false;
+  }
+  if (num_pages < map->num_pages) {
+    map->num_pages = num_pages;
+    map->dirty = true;
+  }
+}
+
+void page_map_checkpoint(PageMap *map) {
+  if (!map->dirty) {
+    return;
+  }
+  map->dirty = false;
+
+  uint32_t length = map->num_pages * sizeof(PageSlot);
+  PageSlot old_slot = map->map_slot;
+
+  // The new copy goes to fresh space so the old one stays valid until the
+  // header durably points away from it
+  PageSlot new_slot = {0, length, 0};
+  if (length > 0) {
+    new_slot.capacity = round_to_sector(length);
+    new_slot.offset = free_extent_allocate(map, new_slot.capacity);
+    if (pwrite(map->file_descriptor, map->slots, length, new_slot.offset) !=
+        (ssize_t)length) {
+      printf("Error writing: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // Pages and map must be on disk before the header can point at them, and
+  // the header before anything it used to point at is reused
+  page_map_sync(map);
+  map->map_slot = new_slot;
+  page_map_write_header(map);
+  page_map_sync(map);
+
+  if (old_slot.offset != 0) {
+    free_extent_add(map, old_slot.offset, old_slot.capacity);
+  }
+  for (uint32_t i = 0; i < map->num_pending; i++) {
+    free_extent_add(map, map->pending[i].offset, map->pending[i].length);
+  }
+  map->num_pending = 0;
+  memset(map->unsynced, 0, sizeof(bool) * map->slots_capacity);
+  if (ftruncate(map->file_descriptor, map->file_end) == -1) {
+    printf("Error truncating db file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+}
+
+uint64_t page_map_stored_bytes(PageMap *map) {
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < map->num_pages; i++) {
+    if (map->slots[i].offset != 0) {
+      total += map->slots[i].length;
+    }
+  }
+  return total;
+}
@@ -1,13 +1,116 @@
 #include "pager.h"
+#include "lock.h"
+#include "pagemap.h"
+#include "replication.h"
+#include "wal.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
-#define PAGE_SIZE 4096
+void pager_options_init(PagerOptions *options) {
+  options->cache_frames = DEFAULT_CACHE_FRAMES;
+  options->use_mmap = false;
+  options->use_io_uring = false;
+  options->page_size = DEFAULT_PAGE_SIZE;
+  options->use_direct_io = false;
+  options->use_huge_pages = false;
+  options->compress = false;
+  options->warm_up = false;
+  options->background_flush = false;
+  options->flush_rate = DEFAULT_FLUSH_RATE;
+  options->file_per_table = false;
+  options->use_wal = false;
+}
+
+bool pager_valid_page_size(uint32_t page_size) {
+  return page_size >= MIN_PAGE_SIZE && page_size <= MAX_PAGE_SIZE &&
+         (page_size & (page_size - 1)) == 0;
+}
+
+// Header of a warm-up file; the page numbers follow
+typedef struct {
+  uint32_t magic;
+  uint32_t page_size;
+  uint32_t count;
+} WarmListHeader;
+
+// Always computed in 64 bits: page_num * page_size passes 4GB long before
+// page numbers run out
+static off_t pager_page_offset(Pager *pager, uint32_t page_num) {
+  return (off_t)((uint64_t)page_num * pager->page_size);
+}
+
+/*
+ * Reserves one page-aligned buffer per frame up front, so a cache miss never
+ * allocates. Anonymous memory is only backed once a frame is first used.
+ */
+static void pager_allocate_arena(Pager *pager, bool use_huge_pages) {
+  pager->arena_size = (size_t)pager->num_frames * pager->page_size;
+  pager->arena = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+  if (use_huge_pages) {
+    // Explicit huge pages need a whole number of them
+    size_t huge_size = (pager->arena_size + HUGE_PAGE_SIZE - 1) &
+                       ~(size_t)(HUGE_PAGE_SIZE - 1);
+    pager->arena = mmap(NULL, huge_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (pager->arena != MAP_FAILED) {
+      pager->arena_size = huge_size;
+    }
+  }
+#endif
+
+  if (pager->arena == MAP_FAILED) {
+    pager->arena = mmap(NULL, pager->arena_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pager->arena == MAP_FAILED) {
+      printf("Unable to allocate buffer pool (%d)\n", errno);
+      exit(EXIT_FAILURE);
+    }
+#ifdef MADV_HUGEPAGE
+    if (use_huge_pages) {
+      // No reserved huge pages; let the kernel back the arena transparently
+      madvise(pager->arena, pager->arena_size, MADV_HUGEPAGE);
+    }
+#endif
+  }
+
+  for (uint32_t i = 0; i < pager->num_frames; i++) {
+    pager->frames[i].buffer =
+        (char *)pager->arena + (size_t)i * pager->page_size;
+  }
+}
+
+static void *pager_flusher_thread(void *arg);
+static void pager_release_extents(Pager *pager);
+static void pager_free_versions(Pager *pager, uint64_t oldest);
+
+// The calling thread's open snapshots, at most one per pager
+static __thread PagerSnapshot *thread_snapshots;
+
+// Pins the calling thread holds through pin_page(), so that a statement
+// unwound by a deadlock can give them back, see pager_unpin_thread()
+typedef struct {
+  Pager *pager;
+  uint32_t page_num;
+} ThreadPin;
+static __thread ThreadPin thread_pins[THREAD_PINS];
+static __thread uint32_t thread_pin_count;
 
-Pager *pager_open(const char *filename) {
+// The pages the calling thread last fetched with get_page(), oldest next.
+// A slot with no pager is unused.
+static __thread ThreadPin recent_pins[RECENT_PINS];
+static __thread uint32_t next_recent_pin;
+
+Pager *pager_open(const char *filename, PagerOptions *options) {
   int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
 
   if (fd == -1) {
@@ -16,100 +119,2443 @@ Pager *pager_open(const char *filename) {
     exit(EXIT_FAILURE);
   }
 
+  // Whatever a crashed run committed goes into the file before anything
+  // else reads it, whether or not this run uses a log
+  wal_recover(filename, fd);
+
   off_t file_length = lseek(fd, 0, SEEK_END);
 
   Pager *pager = malloc(sizeof(Pager));
   pager->file_descriptor = fd;
   pager->file_length = file_length;
-  pager->num_pages = (file_length / PAGE_SIZE);
 
-  if (file_length % PAGE_SIZE != 0) {
+  // An existing file keeps the page size and format it was created with.
+  // Files from before the size was recorded hold 0 there and use the old
+  // fixed size.
+  bool compressed = options->compress && file_length == 0;
+  pager->page_size = options->page_size;
+  if (file_length > 0) {
+    compressed = page_map_probe(fd, &pager->page_size);
+  }
+  if (file_length > 0 && !compressed) {
+    uint32_t stored = 0;
+    pread(fd, &stored, sizeof(stored), META_PAGE_SIZE_OFFSET);
+    pager->page_size = stored == 0 ? DEFAULT_PAGE_SIZE : stored;
+  }
+  if (!pager_valid_page_size(pager->page_size)) {
+    printf("Unsupported page size %d.\n", pager->page_size);
+    exit(EXIT_FAILURE);
+  }
+
+  pager->page_map = NULL;
+  if (compressed) {
+    pager->page_map = page_map_open(fd, pager->page_size, file_length == 0);
+    // From here on the length is what the file would be uncompressed
+    file_length = pager_page_offset(pager, pager->page_map->num_pages);
+    pager->file_length = file_length;
+  }
+  if (file_length % pager->page_size != 0) {
     printf("Db file is not a whole number of pages. Corrupt file.\n");
     exit(EXIT_FAILURE);
   }
+  if ((uint64_t)file_length / pager->page_size > MAX_PAGES) {
+    printf("Db file has more pages than page numbers can address.\n");
+    exit(EXIT_FAILURE);
+  }
+  pager->num_pages = (file_length / pager->page_size);
+
+  pager->num_frames = options->cache_frames;
+  if (pager->num_frames < MIN_CACHE_FRAMES) {
+    pager->num_frames = MIN_CACHE_FRAMES;
+  }
+  pager->frames_used = 0;
+  pager->frames = calloc(pager->num_frames, sizeof(Frame));
+  for (uint32_t i = 0; i < pager->num_frames; i++) {
+    pager->frames[i].page_num = NO_PAGE;
+    pager->frames[i].hash_next = NO_FRAME;
+    pthread_rwlock_init(&pager->frames[i].latch, NULL);
+  }
+  pager->clock_hand = 0;
+  pthread_mutex_init(&pager->clock_latch, NULL);
+  pager_allocate_arena(pager, options->use_huge_pages);
+
+  pager->page_table_size = 1;
+  while (pager->page_table_size < pager->num_frames * 2) {
+    pager->page_table_size <<= 1;
+  }
+  pager->page_table = malloc(sizeof(uint32_t) * pager->page_table_size);
+  for (uint32_t i = 0; i < pager->page_table_size; i++) {
+    pager->page_table[i] = NO_FRAME;
+  }
+  for (uint32_t i = 0; i < PAGER_PARTITIONS; i++) {
+    pthread_mutex_init(&pager->partitions[i].latch, NULL);
+    pthread_cond_init(&pager->partitions[i].loaded, NULL);
+  }
+  pthread_mutex_init(&pager->alloc_latch, NULL);
+  pthread_mutex_init(&pager->io_latch, NULL);
+  pager->extents = NULL;
+  pager->num_extents = 0;
+  pager->extents_capacity = 0;
+  pager->pending_pages = NULL;
+  pager->num_pending_pages = 0;
+  pager->pending_pages_capacity = 0;
+
+  pager->dirty_pages = 0;
+  pager->unsynced = false;
+  pager->read_ahead_frames = 0;
+  // Like the frame arena, only the slots that are used get backed
+  int undo_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+  undo_flags |= MAP_NORESERVE;
+#endif
+  pager->undo_arena = mmap(NULL, (size_t)pager->num_frames * pager->page_size,
+                           PROT_READ | PROT_WRITE, undo_flags, -1, 0);
+  if (pager->undo_arena == MAP_FAILED) {
+    printf("Unable to allocate undo images (%d)\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_init(&pager->statement_latch, NULL);
+
+  pthread_mutex_init(&pager->version_lock, NULL);
+  pthread_cond_init(&pager->snapshots_done, NULL);
+  pager->commit_ts = 0;
+  pager->write_ts = 0;
+  pager->versioned = false;
+  pager->snapshots = NULL;
+  pager->versions = calloc(VERSION_BUCKETS, sizeof(PageVersion *));
+  pager->live_versions = 0;
+  pager->window_pages = NULL;
+  pager->window_count = 0;
+  pager->window_capacity = 0;
+  pthread_mutex_init(&pager->backup_lock, NULL);
+  pager->backup_running = false;
+  pager->backup_written = NULL;
+  pager->backup_pages = 0;
+
+  // Switched on only now: the page size probe above is not block aligned
+  pager->direct_io = false;
+  if (options->use_direct_io && compressed) {
+    // Compressed slots are not block aligned
+    printf("--direct-io is ignored for compressed databases\n");
+  } else if (options->use_direct_io) {
+#ifdef O_DIRECT
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT) == 0) {
+      pager->direct_io = true;
+    }
+#endif
+    if (!pager->direct_io) {
+      printf("O_DIRECT unavailable, falling back to buffered I/O\n");
+    }
+  }
+
+  pager->wal = NULL;
+  pager->replication = NULL;
+  if (options->use_wal && compressed) {
+    // Compressed pages get the log's crash safety from the page map
+    // instead: changed pages and the map go to fresh space and are synced
+    // before the header switches to them, see page_map_checkpoint()
+    printf("--wal is ignored for compressed databases\n");
+  } else if (options->use_wal) {
+    pager->wal = wal_open(filename, pager->page_size, pager->num_pages);
+  }
+
+  pager->map = NULL;
+  pager->map_pages = 0;
+  pager->access_pattern = ACCESS_RANDOM;
+  if (options->use_mmap && pager->wal != NULL) {
+    // The file lags behind the log, so the mapping would show stale pages
+    printf("--mmap is ignored in WAL mode\n");
+  } else if (options->use_mmap && pager->direct_io) {
+    // A mapping is served from the page cache that O_DIRECT bypasses
+    printf("--mmap is ignored in O_DIRECT mode\n");
+  } else if (options->use_mmap && compressed) {
+    printf("--mmap is ignored for compressed databases\n");
+  } else if (options->use_mmap) {
+    // Reserve room for the file to grow; pages past EOF are never touched
+    // through the mapping, so the tail of the window costs nothing.
+    pager->map_pages = MMAP_WINDOW_SIZE / pager->page_size;
+    if (pager->num_pages > pager->map_pages) {
+      pager->map_pages = pager->num_pages;
+    }
+    int flags = MAP_PRIVATE;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    void *map = mmap(NULL, (size_t)pager->map_pages * pager->page_size,
+                     PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (map == MAP_FAILED) {
+      printf("mmap failed (%d), falling back to read()\n", errno);
+      pager->map_pages = 0;
+    } else {
+      pager->map = map;
+      madvise(pager->map, (size_t)pager->map_pages * pager->page_size,
+              MADV_RANDOM);
+    }
+  }
+
+  memset(&pager->stats, 0, sizeof(PagerStats));
+
+  pager->warm_pages = NULL;
+  pager->warm_count = 0;
+  pager->warm_running = false;
+  pager->warm_stop = false;
+
+  pager->ring = NULL;
+  if (options->use_io_uring) {
+    pager->ring = io_ring_open(IO_RING_ENTRIES);
+    if (pager->ring == NULL) {
+      printf("io_uring unavailable, falling back to synchronous I/O\n");
+    }
+  }
 
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-    pager->pages[i] = NULL;
+  pager->flusher_running = false;
+  pager->flusher_stop = false;
+  pager->flush_rate = options->flush_rate > 0 ? options->flush_rate : 1;
+  pthread_mutex_init(&pager->flusher_lock, NULL);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&pager->flusher_wake, &attr);
+  pthread_condattr_destroy(&attr);
+  if (options->background_flush &&
+      pthread_create(&pager->flusher_thread, NULL, pager_flusher_thread,
+                     pager) == 0) {
+    pager->flusher_running = true;
   }
 
   return pager;
 }
 
-void *get_page(Pager *pager, uint32_t page_num) {
-  if (page_num > TABLE_MAX_PAGES) {
-    printf("Tried to fetch page number out of bounds. %d > %d\n", page_num,
-           TABLE_MAX_PAGES);
-    fflush(stdout);
+static uint32_t page_table_bucket(Pager *pager, uint32_t page_num) {
+  return page_num & (pager->page_table_size - 1);
+}
+
+// Buckets never straddle partitions: both are chosen by the low bits
+static PagePartition *page_partition(Pager *pager, uint32_t page_num) {
+  return &pager->partitions[page_num & (PAGER_PARTITIONS - 1)];
+}
+
+// Raises value to at least minimum; concurrent raises all take effect
+static void atomic_raise(_Atomic uint64_t *value, uint64_t minimum) {
+  uint64_t current = atomic_load(value);
+  while (current < minimum &&
+         !atomic_compare_exchange_weak(value, &current, minimum)) {
+  }
+}
+
+static uint32_t page_table_lookup(Pager *pager, uint32_t page_num) {
+  uint32_t frame_index = pager->page_table[page_table_bucket(pager, page_num)];
+  while (frame_index != NO_FRAME) {
+    if (pager->frames[frame_index].page_num == page_num) {
+      return frame_index;
+    }
+    frame_index = pager->frames[frame_index].hash_next;
+  }
+  return NO_FRAME;
+}
+
+static void page_table_insert(Pager *pager, uint32_t frame_index) {
+  Frame *frame = &pager->frames[frame_index];
+  uint32_t bucket = page_table_bucket(pager, frame->page_num);
+  frame->hash_next = pager->page_table[bucket];
+  pager->page_table[bucket] = frame_index;
+}
+
+static void page_table_remove(Pager *pager, uint32_t frame_index) {
+  Frame *frame = &pager->frames[frame_index];
+  uint32_t *link =
+      &pager->page_table[page_table_bucket(pager, frame->page_num)];
+  while (*link != NO_FRAME) {
+    if (*link == frame_index) {
+      *link = frame->hash_next;
+      break;
+    }
+    link = &pager->frames[*link].hash_next;
+  }
+  frame->hash_next = NO_FRAME;
+}
+
+// Drops the private copy of a mapped page so it reads from the file again
+static void pager_discard_mapped(Pager *pager, Frame *frame) {
+#ifdef __linux__
+  (void)pager;
+  madvise(frame->data, pager->page_size, MADV_DONTNEED);
+#else
+  mmap(frame->data, pager->page_size, PROT_READ | PROT_WRITE,
+       MAP_PRIVATE | MAP_FIXED,
+       pager->file_descriptor, pager_page_offset(pager, frame->page_num));
+#endif
+}
+
+// Tells a running backup to copy the page again, see pager_backup()
+static void pager_backup_note(Pager *pager, uint32_t page_num) {
+  pthread_mutex_lock(&pager->backup_lock);
+  if (pager->backup_written != NULL && page_num < pager->backup_pages) {
+    pager->backup_written[page_num / 8] |= 1 << (page_num % 8);
+  }
+  pthread_mutex_unlock(&pager->backup_lock);
+}
+
+// Bookkeeping once a frame's contents have reached the file
+static void pager_frame_written(Pager *pager, Frame *frame, uint64_t end) {
+  atomic_raise(&pager->file_length, end);
+  if (pager->backup_running) {
+    pager_backup_note(pager, frame->page_num);
+  }
+  Replication *replication = pager->replication;
+  if (replication != NULL) {
+    replication_capture(replication, frame->page_num, frame->data);
+  }
+  pager->unsynced = true;
+  if (frame->dirty) {
+    frame->dirty = false;
+    pager->dirty_pages--;
+  }
+
+  // The file now holds the same bytes, so let the mapping share them again
+  if (frame->mapped) {
+    pager_discard_mapped(pager, frame);
+  }
+}
+
+static uint64_t monotonic_us(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void latency_record(_Atomic uint64_t *histogram, uint64_t start_us) {
+  uint64_t elapsed = monotonic_us() - start_us;
+  uint32_t bucket = 0;
+  while (elapsed > 0 && bucket < LATENCY_BUCKETS - 1) {
+    elapsed >>= 1;
+    bucket++;
+  }
+  histogram[bucket]++;
+}
+
+static void pager_write_frame(Pager *pager, Frame *frame, uint32_t size) {
+  if (pager->direct_io) {
+    // O_DIRECT transfers whole blocks only
+    size = pager->page_size;
+  }
+  off_t offset = pager_page_offset(pager, frame->page_num);
+  uint64_t start = monotonic_us();
+  ssize_t bytes_written;
+  if (pager->page_map != NULL) {
+    pthread_mutex_lock(&pager->io_latch);
+    bytes_written =
+        page_map_write(pager->page_map, frame->page_num, frame->data);
+    pthread_mutex_unlock(&pager->io_latch);
+    size = pager->page_size;
+  } else if (pager->wal != NULL) {
+    // The file itself only grows at checkpoints
+    wal_append(pager->wal, &frame->page_num, &frame->data, 1);
+    bytes_written = pager->page_size;
+    pager->stats.wal_frames++;
+    offset = 0;
+    size = 0;
+  } else {
+    bytes_written = pwrite(pager->file_descriptor, frame->data, size, offset);
+  }
+
+  if (bytes_written == -1) {
+    printf("Error writing: %d\n", errno);
     exit(EXIT_FAILURE);
   }
-  // printf("Debug: get_page %d\n", page_num);
-  // fflush(stdout);
 
-  if (pager->pages[page_num] == NULL) {
-    // Cache miss. Allocate memory and load from file.
-    void *page = malloc(PAGE_SIZE);
-    uint32_t num_pages = pager->file_length / PAGE_SIZE;
+  latency_record(pager->stats.flush_latency, start);
+  pager->stats.flushes++;
+  pager->stats.pages_written++;
+  pager->stats.bytes_written += bytes_written;
+
+  pager_frame_written(pager, frame, offset + size);
+}
+
+/*
+ * Issues a batch of vectored reads and writes. With io_uring the whole batch
+ * is in flight at once; otherwise the requests run one after another.
+ */
+static void pager_submit(Pager *pager, IoRequest *requests, uint32_t count) {
+  if (pager->ring != NULL) {
+    pthread_mutex_lock(&pager->io_latch);
+    io_ring_run(pager->ring, requests, count);
+    pthread_mutex_unlock(&pager->io_latch);
+    return;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    IoRequest *request = &requests[i];
+    ssize_t result =
+        request->write
+            ? pwritev(request->fd, request->iov, request->iovcnt,
+                      request->offset)
+            : preadv(request->fd, request->iov, request->iovcnt,
+                     request->offset);
+    request->result = result == -1 ? -errno : result;
+    request->done = true;
+  }
+}
+
+static int compare_page_num(const void *a, const void *b) {
+  uint32_t page_a = *(const uint32_t *)a;
+  uint32_t page_b = *(const uint32_t *)b;
+  return (page_a > page_b) - (page_a < page_b);
+}
+
+static int compare_frame_page_num(const void *a, const void *b) {
+  uint32_t page_a = (*(Frame *const *)a)->page_num;
+  uint32_t page_b = (*(Frame *const *)b)->page_num;
+  return (page_a > page_b) - (page_a < page_b);
+}
+
+/*
+ * Returns a frame that can receive a new page: an untouched frame while the
+ * pool is still filling up, otherwise a CLOCK victim. Dirty victims are
+ * written back before their frame is reused. The frame comes back pinned and
+ * out of the page table, so no other thread can claim it.
+ */
+static uint32_t pager_allocate_frame(Pager *pager) {
+  pthread_mutex_lock(&pager->clock_latch);
+  if (pager->frames_used < pager->num_frames) {
+    uint32_t frame_index = pager->frames_used++;
+    pager->frames[frame_index].pin_count = 1;
+    pthread_mutex_unlock(&pager->clock_latch);
+    return frame_index;
+  }
+
+  // Two sweeps: the first may only clear reference bits
+  for (uint32_t scanned = 0; scanned < 2 * pager->num_frames; scanned++) {
+    uint32_t frame_index = pager->clock_hand;
+    Frame *frame = &pager->frames[frame_index];
+    pager->clock_hand = (pager->clock_hand + 1) % pager->num_frames;
+
+    // Unpinned frames only change owner here, under the clock latch, so
+    // page_num is stable once the pin count reads zero
+    if (frame->pin_count > 0) {
+      continue;
+    }
+    if (frame->page_num == NO_PAGE) {
+      frame->pin_count = 1;
+      pthread_mutex_unlock(&pager->clock_latch);
+      return frame_index;
+    }
+    if (atomic_exchange(&frame->referenced, false)) {
+      continue;
+    }
 
-    // We might save a partial page at the end of the file
-    if (pager->file_length % PAGE_SIZE) {
-      num_pages += 1;
+    // Hits pin under the partition latch, so check again holding it
+    PagePartition *partition = page_partition(pager, frame->page_num);
+    pthread_mutex_lock(&partition->latch);
+    if (frame->pin_count > 0 || (frame->dirty && frame->undo_owner != 0)) {
+      pthread_mutex_unlock(&partition->latch);
+      continue;
     }
+    frame->pin_count = 1;
 
-    if (page_num <= num_pages) {
-      lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-      ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
-      if (bytes_read == -1) {
-        printf("Error reading file: %d\n", errno);
-        exit(EXIT_FAILURE);
-      }
+    pager->stats.evictions++;
+    if (frame->dirty) {
+      pager->stats.dirty_evictions++;
+      pager_write_frame(pager, frame, pager->page_size);
+    }
+    page_table_remove(pager, frame_index);
+    frame->page_num = NO_PAGE;
+    pthread_mutex_unlock(&partition->latch);
+    pthread_mutex_unlock(&pager->clock_latch);
+    return frame_index;
+  }
+
+  printf("Buffer pool exhausted: all %d frames are pinned or hold "
+         "uncommitted changes.\n",
+         pager->num_frames);
+  fflush(stdout);
+  exit(EXIT_FAILURE);
+}
+
+// Pins a frame found in the page table. Called with the partition latch held.
+static void pager_pin_cached(PagePartition *partition, Frame *frame) {
+  frame->pin_count++;
+  frame->referenced = true;
+  frame->accesses++;
+  while (frame->loading) {
+    pthread_cond_wait(&partition->loaded, &partition->latch);
+  }
+}
+
+static void *pager_undo_slot(Pager *pager, Frame *frame) {
+  return (char *)pager->undo_arena +
+         (size_t)(frame - pager->frames) * pager->page_size;
+}
+
+/*
+ * Saves the page as it was before the open transaction first changed it, so
+ * a rollback can put it back without a read. Called with the partition latch
+ * held, before the change is made.
+ */
+static void pager_save_undo(Pager *pager, Frame *frame, uint32_t owner) {
+  memcpy(pager_undo_slot(pager, frame), frame->data, pager->page_size);
+  frame->undo_owner = owner;
+  frame->undo_dirty = frame->dirty;
+  pager->stats.undo_images++;
+}
+
+// The calling thread's open transaction, for a page that transactions lock.
+// The meta page holds allocator state, which is not transactional.
+static uint32_t pager_transaction(uint32_t page_num) {
+  return page_num == 0 ? 0 : lock_current_id();
+}
+
+/*
+ * The version of the page that a snapshot of window ts reads, or NULL if it
+ * reads the page as it is now. Chains are newest first, so the last match is
+ * the oldest version replaced after ts. Called with version_lock held.
+ */
+static PageVersion *pager_find_version(Pager *pager, uint32_t page_num,
+                                       uint64_t ts) {
+  PageVersion *found = NULL;
+  for (PageVersion *version = pager->versions[page_num % VERSION_BUCKETS];
+       version != NULL; version = version->next) {
+    if (version->page_num == page_num && version->valid_until > ts) {
+      found = version;
     }
+  }
+  return found;
+}
 
-    pager->pages[page_num] = page;
+static void pager_save_version(Pager *pager, uint32_t page_num,
+                               const void *data, uint64_t valid_until) {
+  pthread_mutex_lock(&pager->version_lock);
+  // Nobody is left to read it if the last snapshot ended meanwhile
+  if (pager->snapshots == NULL) {
+    pthread_mutex_unlock(&pager->version_lock);
+    return;
+  }
+  PageVersion **bucket = &pager->versions[page_num % VERSION_BUCKETS];
+  // A page evicted and fetched again in the same window was saved already
+  for (PageVersion *version = *bucket; version != NULL;
+       version = version->next) {
+    if (version->page_num == page_num && version->valid_until == valid_until) {
+      pthread_mutex_unlock(&pager->version_lock);
+      return;
+    }
+  }
+  if (pager->window_count == pager->window_capacity) {
+    pager->window_capacity =
+        pager->window_capacity ? pager->window_capacity * 2 : 64;
+    pager->window_pages = realloc(pager->window_pages,
+                                  sizeof(uint32_t) * pager->window_capacity);
+  }
+  pager->window_pages[pager->window_count++] = page_num;
+  PageVersion *version = malloc(sizeof(PageVersion) + pager->page_size);
+  version->page_num = page_num;
+  version->valid_until = valid_until;
+  memcpy(version->data, data, pager->page_size);
+  version->next = *bucket;
+  *bucket = version;
+  pager->live_versions++;
+  pager->stats.versions_saved++;
+  pthread_mutex_unlock(&pager->version_lock);
+}
 
-    if (page_num >= pager->num_pages) {
-      pager->num_pages = page_num + 1;
+// Frees the versions that no snapshot of window oldest or later reads.
+// Called with version_lock held, or once no other thread is left.
+static void pager_free_versions(Pager *pager, uint64_t oldest) {
+  for (uint32_t i = 0; i < VERSION_BUCKETS && pager->live_versions > 0; i++) {
+    PageVersion **link = &pager->versions[i];
+    while (*link != NULL) {
+      PageVersion *version = *link;
+      if (version->valid_until > oldest) {
+        link = &version->next;
+        continue;
+      }
+      *link = version->next;
+      free(version);
+      pager->live_versions--;
     }
   }
+}
 
-  return pager->pages[page_num];
+/*
+ * Copies the frame's page, as the snapshot sees it, into the copy the
+ * snapshot is filling. Called with the partition latch held, so no writer
+ * can start changing the page or finish a window that changed it meanwhile.
+ */
+static void pager_snapshot_copy(Pager *pager, Frame *frame,
+                                PagerSnapshot *snapshot) {
+  const void *source = frame->data;
+  pthread_mutex_lock(&pager->version_lock);
+  PageVersion *version =
+      pager_find_version(pager, frame->page_num, snapshot->ts);
+  if (version != NULL) {
+    source = version->data;
+  } else if (frame->undo_owner != 0) {
+    // Changed by an open transaction, which saved it first
+    source = pager_undo_slot(pager, frame);
+  }
+  if (source != frame->data) {
+    pager->stats.version_reads++;
+  }
+  memcpy(snapshot->target, source, pager->page_size);
+  pthread_mutex_unlock(&pager->version_lock);
 }
 
-void pager_flush(Pager *pager, uint32_t page_num, uint32_t size) {
-  if (pager->pages[page_num] == NULL) {
-    printf("Tried to flush null page\n");
+/*
+ * Called on every fetch with the partition latch held. A snapshot reader
+ * takes its copy here. For the writer this is its first sight of the page
+ * in the open window, and the last chance to save what snapshots need
+ * before the page changes. Transactions keep undo images instead, which
+ * become versions when they commit.
+ */
+static void pager_touch(Pager *pager, Frame *frame, PagerSnapshot *snapshot) {
+  if (snapshot != NULL) {
+    pager_snapshot_copy(pager, frame, snapshot);
+    return;
+  }
+
+  uint64_t window = pager->write_ts;
+  if (window == 0 || frame->write_ts == window) {
+    return;
+  }
+  frame->write_ts = window;
+  if (pager->versioned && pager_transaction(frame->page_num) == 0) {
+    pager_save_version(pager, frame->page_num, frame->data, window);
+  }
+}
+
+// Frame no longer needed by the thread that allocated it
+static void pager_release_frame(Frame *frame) {
+  frame->page_num = NO_PAGE;
+  frame->pin_count = 0;
+}
+
+static void pager_count_page(Pager *pager, uint32_t page_num) {
+  uint32_t num_pages = pager->num_pages;
+  while (page_num >= num_pages &&
+         !atomic_compare_exchange_weak(&pager->num_pages, &num_pages,
+                                       page_num + 1)) {
+  }
+}
+
+// Returns the page's frame, pinned. Snapshot readers pass their snapshot.
+static uint32_t pager_fetch(Pager *pager, uint32_t page_num,
+                            PagerSnapshot *snapshot) {
+  if (page_num == NO_PAGE) {
+    printf("Tried to fetch page number out of bounds. %d\n", page_num);
+    fflush(stdout);
     exit(EXIT_FAILURE);
   }
+  if (snapshot == NULL) {
+    lock_page(pager, page_num, LOCK_SHARED);
+  }
+
+  PagePartition *partition = page_partition(pager, page_num);
+  pthread_mutex_lock(&partition->latch);
+  uint32_t frame_index = page_table_lookup(pager, page_num);
+  if (frame_index != NO_FRAME) {
+    pager_pin_cached(partition, &pager->frames[frame_index]);
+    pager_touch(pager, &pager->frames[frame_index], snapshot);
+    pthread_mutex_unlock(&partition->latch);
+    pager->stats.hits++;
+    return frame_index;
+  }
+  pthread_mutex_unlock(&partition->latch);
+
+  // Cache miss. Find a frame and load from file.
+  pager->stats.misses++;
+  frame_index = pager_allocate_frame(pager);
+  Frame *frame = &pager->frames[frame_index];
+
+  // Another thread may have loaded the page while we looked for a frame
+  pthread_mutex_lock(&partition->latch);
+  uint32_t existing = page_table_lookup(pager, page_num);
+  if (existing != NO_FRAME) {
+    pager_release_frame(frame);
+    pager_pin_cached(partition, &pager->frames[existing]);
+    pager_touch(pager, &pager->frames[existing], snapshot);
+    pthread_mutex_unlock(&partition->latch);
+    return existing;
+  }
+  frame->page_num = page_num;
+  frame->referenced = true;
+  frame->dirty = false;
+  frame->loading = true;
+  frame->accesses = 1;
+  frame->undo_owner = 0;
+  frame->undo_dirty = false;
+  frame->write_ts = 0;
+  page_table_insert(pager, frame_index);
+  pthread_mutex_unlock(&partition->latch);
+
+  uint32_t num_pages = pager->file_length / pager->page_size;
+
+  if (page_num < num_pages && page_num < pager->map_pages) {
+    // Whole page already in the file: point into the mapping, no copy
+    frame->data = (char *)pager->map + (size_t)page_num * pager->page_size;
+    frame->mapped = true;
+  } else {
+    frame->data = frame->buffer;
+    frame->mapped = false;
+    memset(frame->data, 0, pager->page_size);
+  }
+
+  // We might save a partial page at the end of the file
+  if (pager->file_length % pager->page_size) {
+    num_pages += 1;
+  }
+
+  // In WAL mode the newest image of the page may still be in the log
+  uint64_t log_start = monotonic_us();
+  bool logged =
+      pager->wal != NULL && wal_read_page(pager->wal, page_num, frame->data);
+  if (logged) {
+    latency_record(pager->stats.read_latency, log_start);
+    pager->stats.pages_read++;
+    pager->stats.bytes_read += pager->page_size;
+  }
+
+  if (!frame->mapped && !logged && page_num < num_pages) {
+    uint64_t start = monotonic_us();
+    ssize_t bytes_read;
+    if (pager->page_map != NULL) {
+      pthread_mutex_lock(&pager->io_latch);
+      bytes_read = page_map_read(pager->page_map, page_num, frame->data);
+      pthread_mutex_unlock(&pager->io_latch);
+    } else {
+      bytes_read = pread(pager->file_descriptor, frame->data, pager->page_size,
+                         pager_page_offset(pager, page_num));
+    }
+    if (bytes_read == -1) {
+      printf("Error reading file: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    latency_record(pager->stats.read_latency, start);
+    pager->stats.pages_read++;
+    pager->stats.bytes_read += bytes_read;
+  }
+
+  pthread_mutex_lock(&partition->latch);
+  frame->loading = false;
+  pthread_cond_broadcast(&partition->loaded);
+  pager_touch(pager, frame, snapshot);
+  pthread_mutex_unlock(&partition->latch);
+
+  pager_count_page(pager, page_num);
+  return frame_index;
+}
+
+// Returns NO_FRAME if the page is not cached; the partition stays latched
+// either way
+static uint32_t pager_lookup_locked(Pager *pager, uint32_t page_num) {
+  pthread_mutex_lock(&page_partition(pager, page_num)->latch);
+  return page_table_lookup(pager, page_num);
+}
+
+static void pager_unlock_partition(Pager *pager, uint32_t page_num) {
+  pthread_mutex_unlock(&page_partition(pager, page_num)->latch);
+}
+
+static PagerSnapshot *pager_thread_snapshot(Pager *pager) {
+  for (PagerSnapshot *snapshot = thread_snapshots; snapshot != NULL;
+       snapshot = snapshot->thread_next) {
+    if (snapshot->pager == pager) {
+      return snapshot;
+    }
+  }
+  return NULL;
+}
+
+// The snapshot's copy of the page, made now if it has none
+static void *pager_snapshot_page(Pager *pager, PagerSnapshot *snapshot,
+                                 uint32_t page_num) {
+  for (uint32_t i = 0; i < SNAPSHOT_COPIES; i++) {
+    if (snapshot->copy_pages[i] == page_num) {
+      return (char *)snapshot->copies + (size_t)i * pager->page_size;
+    }
+  }
 
-  off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
+  uint32_t slot = snapshot->next_copy;
+  snapshot->next_copy = (slot + 1) % SNAPSHOT_COPIES;
+  snapshot->copy_pages[slot] = NO_PAGE;
+  snapshot->target = (char *)snapshot->copies + (size_t)slot * pager->page_size;
+  pager->frames[pager_fetch(pager, page_num, snapshot)].pin_count--;
+  snapshot->copy_pages[slot] = page_num;
+  return snapshot->target;
+}
 
-  if (offset == -1) {
-    printf("Error seeking: %d\n", errno);
+static void pager_unpin_frame(Pager *pager, uint32_t page_num) {
+  uint32_t frame_index = pager_lookup_locked(pager, page_num);
+  if (frame_index == NO_FRAME || pager->frames[frame_index].pin_count == 0) {
+    printf("Tried to unpin page %d that is not pinned\n", page_num);
     exit(EXIT_FAILURE);
   }
+  pager->frames[frame_index].pin_count--;
+  pager_unlock_partition(pager, page_num);
+}
+
+/*
+ * The returned page stays pinned until the calling thread has fetched
+ * RECENT_PINS other pages with get_page() or its statement ends, so that
+ * snapshot readers and read-ahead cannot reuse the frame meanwhile. Callers
+ * that hold on to a page for longer must use pin_page()/unpin_page() or
+ * pager_acquire()/pager_release() instead, and callers that modify a page
+ * must report it with pager_mark_dirty().
+ */
+void *get_page(Pager *pager, uint32_t page_num) {
+  PagerSnapshot *snapshot = pager_thread_snapshot(pager);
+  if (snapshot != NULL) {
+    return pager_snapshot_page(pager, snapshot, page_num);
+  }
+  Frame *frame = &pager->frames[pager_fetch(pager, page_num, NULL)];
+  for (uint32_t i = 0; i < RECENT_PINS; i++) {
+    if (recent_pins[i].pager == pager && recent_pins[i].page_num == page_num) {
+      frame->pin_count--; // Pinned already
+      return frame->data;
+    }
+  }
+  ThreadPin *oldest = &recent_pins[next_recent_pin];
+  next_recent_pin = (next_recent_pin + 1) % RECENT_PINS;
+  if (oldest->pager != NULL) {
+    pager_unpin_frame(oldest->pager, oldest->page_num);
+  }
+  oldest->pager = pager;
+  oldest->page_num = page_num;
+  return frame->data;
+}
 
-  ssize_t bytes_written =
-      write(pager->file_descriptor, pager->pages[page_num], size);
+// Gives back the calling thread's get_page() pins on pages of pager from
+// first_page on
+static void pager_unpin_recent(Pager *pager, uint32_t first_page) {
+  for (uint32_t i = 0; i < RECENT_PINS; i++) {
+    ThreadPin *pin = &recent_pins[i];
+    if (pin->pager == pager && pin->page_num >= first_page) {
+      pager_unpin_frame(pager, pin->page_num);
+      pin->pager = NULL;
+    }
+  }
+}
 
-  if (bytes_written == -1) {
-    printf("Error writing: %d\n", errno);
+static void thread_pin_push(Pager *pager, uint32_t page_num) {
+  if (thread_pin_count == THREAD_PINS) {
+    printf("Too many pages pinned at once (%d)\n", THREAD_PINS);
     exit(EXIT_FAILURE);
   }
+  thread_pins[thread_pin_count].pager = pager;
+  thread_pins[thread_pin_count].page_num = page_num;
+  thread_pin_count++;
 }
 
-void pager_rollback(Pager *pager) {
-  // Discard all cached pages
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-    if (pager->pages[i] != NULL) {
-      free(pager->pages[i]);
-      pager->pages[i] = NULL;
+static void thread_pin_pop(Pager *pager, uint32_t page_num) {
+  for (uint32_t i = thread_pin_count; i > 0; i--) {
+    if (thread_pins[i - 1].pager == pager &&
+        thread_pins[i - 1].page_num == page_num) {
+      thread_pins[i - 1] = thread_pins[--thread_pin_count];
+      return;
     }
   }
+}
 
-  // Reset file length to actual file size on disk
-  // This handles case where we extended file in memory but didn't flush
-  off_t file_length = lseek(pager->file_descriptor, 0, SEEK_END);
-  pager->file_length = file_length;
-  pager->num_pages = (file_length / PAGE_SIZE);
+// Snapshot copies are not pinned, see SNAPSHOT_COPIES
+void *pin_page(Pager *pager, uint32_t page_num) {
+  PagerSnapshot *snapshot = pager_thread_snapshot(pager);
+  if (snapshot != NULL) {
+    return pager_snapshot_page(pager, snapshot, page_num);
+  }
+  void *data = pager->frames[pager_fetch(pager, page_num, NULL)].data;
+  thread_pin_push(pager, page_num);
+  return data;
+}
+
+void unpin_page(Pager *pager, uint32_t page_num) {
+  if (pager_thread_snapshot(pager) != NULL) {
+    return;
+  }
+  thread_pin_pop(pager, page_num);
+  pager_unpin_frame(pager, page_num);
+}
+
+// Gives back every pin the calling thread still holds, once its statement
+// has been unwound
+void pager_unpin_thread(void) {
+  while (thread_pin_count > 0) {
+    ThreadPin *pin = &thread_pins[--thread_pin_count];
+    pager_unpin_frame(pin->pager, pin->page_num);
+  }
+  for (uint32_t i = 0; i < RECENT_PINS; i++) {
+    if (recent_pins[i].pager != NULL) {
+      pager_unpin_recent(recent_pins[i].pager, 0);
+    }
+  }
+}
+
+/*
+ * Pins the page and latches its contents: shared for readers, exclusive for
+ * a writer, who must still call pager_mark_dirty(). Latches are not
+ * reentrant, and a thread holding several should take them in page order.
+ */
+void *pager_acquire(Pager *pager, uint32_t page_num, bool exclusive) {
+  PagerSnapshot *snapshot = pager_thread_snapshot(pager);
+  if (snapshot != NULL) {
+    return pager_snapshot_page(pager, snapshot, page_num);
+  }
+  Frame *frame = &pager->frames[pager_fetch(pager, page_num, NULL)];
+  if (exclusive) {
+    pthread_rwlock_wrlock(&frame->latch);
+  } else {
+    pthread_rwlock_rdlock(&frame->latch);
+  }
+  return frame->data;
+}
+
+void pager_release(Pager *pager, uint32_t page_num) {
+  if (pager_thread_snapshot(pager) != NULL) {
+    return;
+  }
+  uint32_t frame_index = pager_lookup_locked(pager, page_num);
+  if (frame_index == NO_FRAME || pager->frames[frame_index].pin_count == 0) {
+    printf("Tried to release page %d that is not acquired\n", page_num);
+    exit(EXIT_FAILURE);
+  }
+  pthread_rwlock_unlock(&pager->frames[frame_index].latch);
+  pager->frames[frame_index].pin_count--;
+  pager_unlock_partition(pager, page_num);
+}
+
+void pager_mark_dirty(Pager *pager, uint32_t page_num) {
+  if (pager_thread_snapshot(pager) != NULL) {
+    printf("Tried to change page %d from a snapshot\n", page_num);
+    exit(EXIT_FAILURE);
+  }
+  uint32_t frame_index = pager_lookup_locked(pager, page_num);
+  if (frame_index == NO_FRAME) {
+    printf("Tried to mark page %d dirty that is not cached\n", page_num);
+    exit(EXIT_FAILURE);
+  }
+  Frame *frame = &pager->frames[frame_index];
+  uint32_t owner = pager_transaction(page_num);
+  if (owner != 0 && frame->undo_owner != owner) {
+    // First change by this transaction. Other statements may run while it
+    // waits for the lock, so the frame stays pinned meanwhile.
+    frame->pin_count++;
+    thread_pin_push(pager, page_num);
+    pager_unlock_partition(pager, page_num);
+    lock_page(pager, page_num, LOCK_EXCLUSIVE);
+    pager_lookup_locked(pager, page_num);
+    thread_pin_pop(pager, page_num);
+    frame->pin_count--;
+    pager_save_undo(pager, frame, owner);
+  }
+  if (!frame->dirty) {
+    frame->dirty = true;
+    frame->dirtied_at = monotonic_us();
+    pager->dirty_pages++;
+  }
+  pager->unsynced = true;
+  pager_unlock_partition(pager, page_num);
+}
+
+void pager_flush(Pager *pager, uint32_t page_num, uint32_t size) {
+  uint32_t frame_index = pager_lookup_locked(pager, page_num);
+  if (frame_index == NO_FRAME) {
+    printf("Tried to flush null page\n");
+    exit(EXIT_FAILURE);
+  }
+
+  pager_write_frame(pager, &pager->frames[frame_index], size);
+  pager_unlock_partition(pager, page_num);
+}
+
+/*
+ * Pins every dirty frame into dirty[], which has room for the whole pool, so
+ * that read-ahead running alongside cannot evict them. Returns the count.
+ * Pages changed by open transactions are left out: they must not reach the
+ * file before they commit.
+ */
+static uint32_t pager_collect_dirty(Pager *pager, Frame **dirty) {
+  uint32_t num_dirty = 0;
+  for (uint32_t p = 0; p < PAGER_PARTITIONS; p++) {
+    pthread_mutex_lock(&pager->partitions[p].latch);
+    for (uint32_t bucket = p; bucket < pager->page_table_size;
+         bucket += PAGER_PARTITIONS) {
+      for (uint32_t f = pager->page_table[bucket]; f != NO_FRAME;
+           f = pager->frames[f].hash_next) {
+        if (pager->frames[f].dirty && pager->frames[f].undo_owner == 0) {
+          pager->frames[f].pin_count++;
+          dirty[num_dirty++] = &pager->frames[f];
+        }
+      }
+    }
+    pthread_mutex_unlock(&pager->partitions[p].latch);
+  }
+  return num_dirty;
 }
 
-uint32_t get_unused_page_num(Pager *pager) { return pager->num_pages; }
+/*
+ * Writes back pinned dirty frames in page order, merging runs of adjacent
+ * pages into single vectored writes that are submitted together, and unpins
+ * them.
+ */
+static void pager_write_dirty(Pager *pager, Frame **dirty, uint32_t num_dirty) {
+  qsort(dirty, num_dirty, sizeof(Frame *), compare_frame_page_num);
+
+  if (pager->page_map != NULL) {
+    // Each page is compressed into its own slot, then the map is saved
+    for (uint32_t i = 0; i < num_dirty; i++) {
+      PagePartition *partition = page_partition(pager, dirty[i]->page_num);
+      pthread_mutex_lock(&partition->latch);
+      pager_write_frame(pager, dirty[i], pager->page_size);
+      dirty[i]->pin_count--;
+      pthread_mutex_unlock(&partition->latch);
+    }
+    pthread_mutex_lock(&pager->io_latch);
+    page_map_checkpoint(pager->page_map);
+    pthread_mutex_unlock(&pager->io_latch);
+    return;
+  }
+
+  if (num_dirty == 0) {
+    return;
+  }
+
+  if (pager->wal != NULL) {
+    // The whole batch is one sequential append to the log
+    uint32_t *page_nums = malloc(sizeof(uint32_t) * num_dirty);
+    void **pages = malloc(sizeof(void *) * num_dirty);
+    for (uint32_t i = 0; i < num_dirty; i++) {
+      page_nums[i] = dirty[i]->page_num;
+      pages[i] = dirty[i]->data;
+    }
+    uint64_t start = monotonic_us();
+    wal_append(pager->wal, page_nums, pages, num_dirty);
+    latency_record(pager->stats.flush_latency, start);
+    pager->stats.flushes++;
+    pager->stats.pages_written += num_dirty;
+    pager->stats.bytes_written += (uint64_t)num_dirty * pager->page_size;
+    pager->stats.wal_frames += num_dirty;
+
+    for (uint32_t i = 0; i < num_dirty; i++) {
+      PagePartition *partition = page_partition(pager, dirty[i]->page_num);
+      pthread_mutex_lock(&partition->latch);
+      pager_frame_written(pager, dirty[i], 0);
+      dirty[i]->pin_count--;
+      pthread_mutex_unlock(&partition->latch);
+    }
+    free(pages);
+    free(page_nums);
+    return;
+  }
+
+  // At most one request per dirty page, and one iovec per dirty page
+  struct iovec *iov = malloc(sizeof(struct iovec) * num_dirty);
+  IoRequest *requests = malloc(sizeof(IoRequest) * num_dirty);
+  uint32_t *first = malloc(sizeof(uint32_t) * num_dirty);
+  uint32_t num_requests = 0;
+
+  for (uint32_t i = 0; i < num_dirty; i++) {
+    iov[i].iov_base = dirty[i]->data;
+    iov[i].iov_len = pager->page_size;
+
+    IoRequest *request = num_requests ? &requests[num_requests - 1] : NULL;
+    if (request == NULL || dirty[i]->page_num != dirty[i - 1]->page_num + 1 ||
+        request->iovcnt == IO_REQUEST_MAX_IOVECS) {
+      request = &requests[num_requests];
+      first[num_requests] = i;
+      num_requests++;
+      request->fd = pager->file_descriptor;
+      request->write = true;
+      request->iov = &iov[i];
+      request->iovcnt = 0;
+      request->offset = pager_page_offset(pager, dirty[i]->page_num);
+    }
+    request->iovcnt++;
+  }
+
+  uint64_t start = monotonic_us();
+  pager_submit(pager, requests, num_requests);
+  latency_record(pager->stats.flush_latency, start);
+  pager->stats.flushes++;
+  pager->stats.pages_written += num_dirty;
+  pager->stats.bytes_written += (uint64_t)num_dirty * pager->page_size;
+
+  for (uint32_t r = 0; r < num_requests; r++) {
+    IoRequest *request = &requests[r];
+    if (request->result != (ssize_t)request->iovcnt * pager->page_size) {
+      printf("Error writing: %d\n",
+             request->result < 0 ? (int)-request->result : 0);
+      exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < request->iovcnt; i++) {
+      Frame *frame = dirty[first[r] + i];
+      PagePartition *partition = page_partition(pager, frame->page_num);
+      pthread_mutex_lock(&partition->latch);
+      pager_frame_written(pager, frame,
+                          request->offset + pager_page_offset(pager, i + 1));
+      frame->pin_count--;
+      pthread_mutex_unlock(&partition->latch);
+    }
+  }
+
+  free(first);
+  free(requests);
+  free(iov);
+}
+
+// Moves the logged pages into the file and empties the log
+static void pager_checkpoint(Pager *pager) {
+  wal_checkpoint(pager->wal, pager->file_descriptor, &pager->file_length);
+  pager->stats.checkpoints++;
+}
+
+/*
+ * Writes back every dirty page. In WAL mode this is a commit: the pages are
+ * followed by a commit record. Returns the LSN to pass to
+ * pager_wait_for_commit() before the commit counts as durable, or 0 if there
+ * is nothing to wait for. On a primary, the pages written since the last
+ * call then go to the replicas as one commit.
+ */
+uint64_t pager_commit(Pager *pager) {
+  Frame **dirty = malloc(sizeof(Frame *) * pager->num_frames);
+  uint32_t num_dirty = pager_collect_dirty(pager, dirty);
+  pager_write_dirty(pager, dirty, num_dirty);
+  free(dirty);
+
+  uint64_t lsn = 0;
+  if (pager->wal != NULL) {
+    lsn = wal_commit(pager->wal, pager->num_pages);
+    if (lsn != 0) {
+      pager->stats.wal_commits++;
+    }
+    // The checkpoint syncs the database file, which covers the commit
+    if (pager->wal->num_frames >= WAL_CHECKPOINT_FRAMES) {
+      pager_checkpoint(pager);
+    }
+  }
+
+  // Replicas get the commit once it is in the file or the log
+  if (pager->replication != NULL) {
+    replication_commit(pager->replication);
+  }
+  return lsn;
+}
+
+/*
+ * Waits until the log is durable up to lsn. Callers that can do so outside
+ * the statement gate let the commits of other sessions arriving meanwhile
+ * share one fdatasync(), see wal_sync().
+ */
+void pager_wait_for_commit(Pager *pager, uint64_t lsn) {
+  if (lsn != 0 && wal_sync(pager->wal, lsn)) {
+    pager->stats.wal_syncs++;
+  }
+}
+
+// pager_commit() and waiting for it, for callers inside the gate
+void pager_flush_all(Pager *pager) {
+  pager_wait_for_commit(pager, pager_commit(pager));
+}
+
+/*
+ * Writes back every dirty page and waits until the file, or in WAL mode the
+ * log, has them on disk. Does nothing if no page changed since the last
+ * call.
+ */
+void pager_sync(Pager *pager) {
+  if (!atomic_exchange(&pager->unsynced, false)) {
+    return;
+  }
+  pager_flush_all(pager);
+  // A WAL commit has synced the log already
+  if (pager->wal == NULL && fdatasync(pager->file_descriptor) == -1) {
+    printf("Error syncing db file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  pager->stats.syncs++;
+}
+
+// Opens the next write window. Called with the statement latch held.
+static void pager_open_window(Pager *pager) {
+  pthread_mutex_lock(&pager->version_lock);
+  pager->versioned = pager->snapshots != NULL;
+  pager->write_ts = pager->commit_ts + 1;
+  pthread_mutex_unlock(&pager->version_lock);
+}
+
+/*
+ * Drops the versions the window saved of pages it did not change after all.
+ * Writes are only reported once they are done, so every page the window
+ * fetched was saved.
+ */
+static void pager_prune_versions(Pager *pager) {
+  for (uint32_t i = 0; i < pager->window_count; i++) {
+    uint32_t page_num = pager->window_pages[i];
+    uint32_t frame_index = pager_lookup_locked(pager, page_num);
+    pthread_mutex_lock(&pager->version_lock);
+    PageVersion **link = &pager->versions[page_num % VERSION_BUCKETS];
+    while (*link != NULL && ((*link)->page_num != page_num ||
+                             (*link)->valid_until != pager->write_ts)) {
+      link = &(*link)->next;
+    }
+    PageVersion *version = *link;
+    // A frame a snapshot reader is still loading is kept to be safe
+    if (version != NULL && frame_index != NO_FRAME &&
+        !pager->frames[frame_index].loading &&
+        memcmp(version->data, pager->frames[frame_index].data,
+               pager->page_size) == 0) {
+      *link = version->next;
+      free(version);
+      pager->live_versions--;
+    }
+    pthread_mutex_unlock(&pager->version_lock);
+    pager_unlock_partition(pager, page_num);
+  }
+  pager->window_count = 0;
+}
+
+static void pager_commit_window(Pager *pager) {
+  pager_prune_versions(pager);
+  pthread_mutex_lock(&pager->version_lock);
+  pager->commit_ts = pager->write_ts;
+  pager->write_ts = 0;
+  pthread_mutex_unlock(&pager->version_lock);
+}
+
+/*
+ * Statements that modify pages run between these two calls, so the
+ * background flusher only ever sees pages between statements and never
+ * writes one that is half updated.
+ */
+void pager_begin_statement(Pager *pager) {
+  pthread_mutex_lock(&pager->statement_latch);
+  if (pager->write_ts == 0) {
+    pager_open_window(pager);
+  }
+}
+
+// Commits the statement's write window
+void pager_end_statement(Pager *pager) {
+  pager_unpin_recent(pager, 0);
+  if (pager->write_ts != 0) {
+    pager_commit_window(pager);
+  }
+  pthread_mutex_unlock(&pager->statement_latch);
+}
+
+static int compare_frame_dirtied_at(const void *a, const void *b) {
+  uint64_t dirtied_a = (*(Frame *const *)a)->dirtied_at;
+  uint64_t dirtied_b = (*(Frame *const *)b)->dirtied_at;
+  return (dirtied_a > dirtied_b) - (dirtied_a < dirtied_b);
+}
+
+// One flusher round: writes back the oldest pages that are due, if any
+static void pager_flusher_round(Pager *pager, Frame **dirty) {
+  if (pager->dirty_pages == 0) {
+    return;
+  }
+
+  pager_begin_statement(pager);
+  uint32_t num_dirty = pager_collect_dirty(pager, dirty);
+  // While open transactions have allocated or freed pages, the freelist in
+  // the meta page goes out with a commit rather than ahead of it
+  pthread_mutex_lock(&pager->alloc_latch);
+  bool hold_meta = pager->num_pending_pages > 0;
+  pthread_mutex_unlock(&pager->alloc_latch);
+  for (uint32_t i = 0; hold_meta && i < num_dirty; i++) {
+    if (dirty[i]->page_num == 0) {
+      dirty[i]->pin_count--;
+      dirty[i] = dirty[--num_dirty];
+      break;
+    }
+  }
+  qsort(dirty, num_dirty, sizeof(Frame *), compare_frame_dirtied_at);
+
+  uint32_t budget = pager->flush_rate * FLUSHER_INTERVAL_MS / 1000;
+  if (budget == 0) {
+    budget = 1;
+  }
+  bool over_ratio =
+      (uint64_t)num_dirty * 100 >
+      (uint64_t)pager->num_frames * FLUSHER_DIRTY_PERCENT;
+  uint64_t now = monotonic_us();
+
+  // Oldest first: past the age limit everything due is written, past the
+  // ratio the oldest pages are written regardless of age
+  uint32_t due = 0;
+  while (due < num_dirty && due < budget &&
+         (over_ratio ||
+          now - dirty[due]->dirtied_at >= FLUSHER_MAX_AGE_MS * 1000ull)) {
+    due++;
+  }
+  for (uint32_t i = due; i < num_dirty; i++) {
+    dirty[i]->pin_count--;
+  }
+
+  pager_write_dirty(pager, dirty, due);
+  pager->stats.background_pages += due;
+  pager_end_statement(pager);
+}
+
+static void *pager_flusher_thread(void *arg) {
+  Pager *pager = arg;
+  Frame **dirty = malloc(sizeof(Frame *) * pager->num_frames);
+
+  pthread_mutex_lock(&pager->flusher_lock);
+  while (!pager->flusher_stop) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += FLUSHER_INTERVAL_MS * 1000000l;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000l;
+    deadline.tv_nsec %= 1000000000l;
+    pthread_cond_timedwait(&pager->flusher_wake, &pager->flusher_lock,
+                           &deadline);
+    if (pager->flusher_stop) {
+      break;
+    }
+
+    pthread_mutex_unlock(&pager->flusher_lock);
+    pager_flusher_round(pager, dirty);
+    pthread_mutex_lock(&pager->flusher_lock);
+  }
+  pthread_mutex_unlock(&pager->flusher_lock);
+
+  free(dirty);
+  return NULL;
+}
+
+void pager_close(Pager *pager) {
+  pager_unpin_recent(pager, 0);
+  if (pager->flusher_running) {
+    pthread_mutex_lock(&pager->flusher_lock);
+    pager->flusher_stop = true;
+    pthread_cond_signal(&pager->flusher_wake);
+    pthread_mutex_unlock(&pager->flusher_lock);
+    pthread_join(pager->flusher_thread, NULL);
+  }
+  pager->warm_stop = true;
+  if (pager->warm_running) {
+    pthread_join(pager->warm_thread, NULL);
+  }
+  free(pager->warm_pages);
+
+  pager_release_extents(pager);
+  pager_flush_all(pager);
+  if (pager->wal != NULL) {
+    pager_checkpoint(pager);
+    wal_close(pager->wal);
+  }
+
+  int result = close(pager->file_descriptor);
+  if (result == -1) {
+    printf("Error closing db file.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  munmap(pager->arena, pager->arena_size);
+  munmap(pager->undo_arena, (size_t)pager->num_frames * pager->page_size);
+  pager_free_versions(pager, UINT64_MAX);
+  free(pager->versions);
+  free(pager->window_pages);
+  if (pager->map != NULL) {
+    munmap(pager->map, (size_t)pager->map_pages * pager->page_size);
+  }
+  io_ring_close(pager->ring);
+  if (pager->page_map != NULL) {
+    page_map_close(pager->page_map);
+  }
+  for (uint32_t i = 0; i < pager->num_frames; i++) {
+    pthread_rwlock_destroy(&pager->frames[i].latch);
+  }
+  for (uint32_t i = 0; i < PAGER_PARTITIONS; i++) {
+    pthread_mutex_destroy(&pager->partitions[i].latch);
+    pthread_cond_destroy(&pager->partitions[i].loaded);
+  }
+  pthread_mutex_destroy(&pager->clock_latch);
+  pthread_mutex_destroy(&pager->alloc_latch);
+  pthread_mutex_destroy(&pager->io_latch);
+  pthread_mutex_destroy(&pager->statement_latch);
+  pthread_mutex_destroy(&pager->version_lock);
+  pthread_mutex_destroy(&pager->backup_lock);
+  pthread_cond_destroy(&pager->snapshots_done);
+  pthread_mutex_destroy(&pager->flusher_lock);
+  pthread_cond_destroy(&pager->flusher_wake);
+  free(pager->extents);
+  free(pager->pending_pages);
+  free(pager->frames);
+  free(pager->page_table);
+  free(pager);
+}
+
+// Pages in the file as last committed, not counting later writes
+static uint32_t pager_committed_pages(Pager *pager) {
+  if (pager->wal != NULL) {
+    // The log may hold committed pages past the end of the file
+    return pager->wal->db_pages;
+  }
+  off_t file_length =
+      pager->page_map != NULL
+          ? pager_page_offset(pager, pager->page_map->num_pages)
+          : lseek(pager->file_descriptor, 0, SEEK_END);
+  return file_length / pager->page_size;
+}
+
+/*
+ * Ends a transaction's hold on the pool. On commit the pages it changed
+ * become ordinary dirty pages, their undo images become versions for the
+ * snapshots that are older, and the pages it freed go on the freelist. On
+ * rollback the pages are copied back from their undo images and stay
+ * cached, pages it added past the old end of the file are dropped, and the
+ * pages it allocated go on the freelist instead. Called with the statement
+ * latch held, once the transaction is no longer the thread's current one.
+ */
+void pager_end_transaction(Pager *pager, uint32_t transaction, bool commit) {
+  uint32_t num_pages = 0;
+  if (!commit) {
+    pager->stats.rollbacks++;
+    num_pages = pager_committed_pages(pager);
+  }
+  pthread_mutex_lock(&pager->version_lock);
+  bool save_versions = commit && pager->snapshots != NULL;
+  pthread_mutex_unlock(&pager->version_lock);
+  uint64_t window = pager->write_ts;
+
+  for (uint32_t p = 0; p < PAGER_PARTITIONS; p++) {
+    pthread_mutex_lock(&pager->partitions[p].latch);
+    for (uint32_t bucket = p; bucket < pager->page_table_size;
+         bucket += PAGER_PARTITIONS) {
+      uint32_t *link = &pager->page_table[bucket];
+      while (*link != NO_FRAME) {
+        Frame *frame = &pager->frames[*link];
+        if (frame->undo_owner != transaction) {
+          link = &frame->hash_next;
+          continue;
+        }
+        frame->undo_owner = 0;
+        void *undo = pager_undo_slot(pager, frame);
+        if (commit) {
+          if (save_versions &&
+              memcmp(undo, frame->data, pager->page_size) != 0) {
+            pager_save_version(pager, frame->page_num, undo, window);
+          }
+          link = &frame->hash_next;
+          continue;
+        }
+
+        if (frame->dirty != frame->undo_dirty) {
+          frame->dirty = frame->undo_dirty;
+          if (frame->dirty) {
+            pager->dirty_pages++;
+          } else {
+            pager->dirty_pages--;
+          }
+        }
+        if (frame->dirty || frame->page_num < num_pages ||
+            frame->pin_count > 0) {
+          memcpy(frame->data, undo, pager->page_size);
+          pager->stats.rollback_restores++;
+          link = &frame->hash_next;
+          continue;
+        }
+        // Added past the old end of the file: nothing to keep
+        pager->stats.rollback_discards++;
+        if (frame->mapped) {
+          pager_discard_mapped(pager, frame);
+        }
+        *link = frame->hash_next;
+        frame->hash_next = NO_FRAME;
+        frame->page_num = NO_PAGE;
+        frame->referenced = false;
+      }
+    }
+    pthread_mutex_unlock(&pager->partitions[p].latch);
+  }
+
+  // The freelist changes that were held back until the outcome was known
+  pthread_mutex_lock(&pager->alloc_latch);
+  uint32_t *release = malloc(sizeof(uint32_t) * (pager->num_pending_pages + 1));
+  uint32_t num_release = 0;
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < pager->num_pending_pages; i++) {
+    PendingPage *pending = &pager->pending_pages[i];
+    if (pending->owner != transaction) {
+      pager->pending_pages[kept++] = *pending;
+    } else if (pending->allocated != commit) {
+      release[num_release++] = pending->page_num;
+    }
+  }
+  pager->num_pending_pages = kept;
+  pthread_mutex_unlock(&pager->alloc_latch);
+  for (uint32_t i = 0; i < num_release; i++) {
+    pager_free_page(pager, release[i]);
+  }
+  free(release);
+}
+
+/*
+ * Starts a snapshot for the calling thread: until pager_end_snapshot() its
+ * get_page() and friends return pages as of the last committed window.
+ * Called with the statement latch held, so no window is half done.
+ */
+void pager_begin_snapshot(Pager *pager) {
+  PagerSnapshot *snapshot = malloc(sizeof(PagerSnapshot));
+  snapshot->pager = pager;
+  snapshot->copies = malloc((size_t)SNAPSHOT_COPIES * pager->page_size);
+  for (uint32_t i = 0; i < SNAPSHOT_COPIES; i++) {
+    snapshot->copy_pages[i] = NO_PAGE;
+  }
+  snapshot->next_copy = 0;
+
+  pthread_mutex_lock(&pager->version_lock);
+  snapshot->ts = pager->commit_ts;
+  snapshot->next = pager->snapshots;
+  pager->snapshots = snapshot;
+  pthread_mutex_unlock(&pager->version_lock);
+
+  snapshot->thread_next = thread_snapshots;
+  thread_snapshots = snapshot;
+  pager->stats.snapshots++;
+}
+
+// Ends the calling thread's snapshot and frees the versions only it needed
+void pager_end_snapshot(Pager *pager) {
+  PagerSnapshot **link = &thread_snapshots;
+  while ((*link)->pager != pager) {
+    link = &(*link)->thread_next;
+  }
+  PagerSnapshot *snapshot = *link;
+  *link = snapshot->thread_next;
+
+  pthread_mutex_lock(&pager->version_lock);
+  link = &pager->snapshots;
+  while (*link != snapshot) {
+    link = &(*link)->next;
+  }
+  *link = snapshot->next;
+
+  uint64_t oldest = UINT64_MAX;
+  for (PagerSnapshot *other = pager->snapshots; other != NULL;
+       other = other->next) {
+    if (other->ts < oldest) {
+      oldest = other->ts;
+    }
+  }
+  pager_free_versions(pager, oldest);
+  if (pager->snapshots == NULL) {
+    pthread_cond_broadcast(&pager->snapshots_done);
+  }
+  pthread_mutex_unlock(&pager->version_lock);
+
+  free(snapshot->copies);
+  free(snapshot);
+}
+
+// For changes snapshots cannot follow, such as moving pages around
+void pager_wait_for_snapshots(Pager *pager) {
+  pthread_mutex_lock(&pager->version_lock);
+  while (pager->snapshots != NULL) {
+    pthread_cond_wait(&pager->snapshots_done, &pager->version_lock);
+  }
+  pthread_mutex_unlock(&pager->version_lock);
+}
+
+// Claims the next page past the end of the file for the calling thread
+static uint32_t pager_extend(Pager *pager) {
+  uint32_t page_num = atomic_fetch_add(&pager->num_pages, 1);
+  if (page_num >= MAX_PAGES) {
+    printf("Database is full: %u pages is the limit.\n", MAX_PAGES);
+    exit(EXIT_FAILURE);
+  }
+  return page_num;
+}
+
+// Pops the head of the freelist, or returns NO_PAGE if it is empty. The
+// caller holds alloc_latch.
+static uint32_t pager_pop_free_page(Pager *pager) {
+  if (pager->num_pages == 0) {
+    return NO_PAGE;
+  }
+
+  void *meta_page = pin_page(pager, 0);
+  uint32_t *head = (uint32_t *)((char *)meta_page + META_FREELIST_HEAD_OFFSET);
+  uint32_t *count =
+      (uint32_t *)((char *)meta_page + META_FREELIST_COUNT_OFFSET);
+
+  uint32_t page_num = *head;
+  if (page_num == 0 || page_num >= pager->num_pages) {
+    // Empty list (or a file from before the freelist existed)
+    unpin_page(pager, 0);
+    return NO_PAGE;
+  }
+
+  // Free pages belong to the allocator, which never waits for page locks
+  Transaction *transaction = lock_current();
+  lock_set_current(NULL);
+  void *page = get_page(pager, page_num);
+  lock_set_current(transaction);
+  uint32_t next = *(uint32_t *)((char *)page + FREE_PAGE_NEXT_OFFSET);
+  pager_mark_dirty(pager, 0);
+  *head = next < pager->num_pages ? next : 0;
+  *count = *head == 0 ? 0 : *count - 1;
+
+  unpin_page(pager, 0);
+  return page_num;
+}
+
+// Remembers a page the calling thread's open transaction allocated or
+// freed, see PendingPage. The caller holds alloc_latch.
+static void pager_add_pending(Pager *pager, uint32_t page_num, uint32_t owner,
+                              bool allocated) {
+  if (pager->num_pending_pages == pager->pending_pages_capacity) {
+    pager->pending_pages_capacity =
+        pager->pending_pages_capacity ? pager->pending_pages_capacity * 2 : 64;
+    pager->pending_pages =
+        realloc(pager->pending_pages,
+                sizeof(PendingPage) * pager->pending_pages_capacity);
+  }
+  PendingPage *pending = &pager->pending_pages[pager->num_pending_pages++];
+  pending->page_num = page_num;
+  pending->owner = owner;
+  pending->allocated = allocated;
+}
+
+// A transaction's allocations are given back if it rolls back
+static uint32_t pager_allocated(Pager *pager, uint32_t page_num) {
+  uint32_t owner = pager_transaction(page_num);
+  if (owner != 0) {
+    pager_add_pending(pager, page_num, owner, true);
+  }
+  return page_num;
+}
+
+/*
+ * Hands out the head of the freelist if there is one, otherwise a page past
+ * the end of the file. The caller is expected to initialize the page.
+ */
+uint32_t get_unused_page_num(Pager *pager) {
+  pthread_mutex_lock(&pager->alloc_latch);
+  uint32_t page_num = pager_pop_free_page(pager);
+  if (page_num == NO_PAGE) {
+    page_num = pager_extend(pager);
+  }
+  pager_allocated(pager, page_num);
+  pthread_mutex_unlock(&pager->alloc_latch);
+  return page_num;
+}
+
+static Extent *pager_find_extent(Pager *pager, uint32_t owner) {
+  for (uint32_t i = 0; i < pager->num_extents; i++) {
+    if (pager->extents[i].owner == owner) {
+      return &pager->extents[i];
+    }
+  }
+  return NULL;
+}
+
+// Claims the next EXTENT_PAGES pages past the end of the file for owner,
+// replacing its previous extent. The caller holds alloc_latch.
+static Extent *pager_reserve_extent(Pager *pager, uint32_t owner) {
+  uint32_t start = atomic_fetch_add(&pager->num_pages, EXTENT_PAGES);
+  if (start > MAX_PAGES - EXTENT_PAGES) {
+    printf("Database is full: %u pages is the limit.\n", MAX_PAGES);
+    exit(EXIT_FAILURE);
+  }
+
+#ifdef FALLOC_FL_KEEP_SIZE
+  // Only a hint to the file system: the file length still grows as pages
+  // are written, so unused reservations never show up as pages
+  (void)fallocate(pager->file_descriptor, FALLOC_FL_KEEP_SIZE,
+                  pager_page_offset(pager, start),
+                  (off_t)EXTENT_PAGES * pager->page_size);
+#endif
+
+  Extent *extent = pager_find_extent(pager, owner);
+  if (extent == NULL) {
+    if (pager->num_extents == pager->extents_capacity) {
+      pager->extents_capacity =
+          pager->extents_capacity ? pager->extents_capacity * 2 : 8;
+      pager->extents =
+          realloc(pager->extents, sizeof(Extent) * pager->extents_capacity);
+    }
+    extent = &pager->extents[pager->num_extents++];
+    extent->owner = owner;
+  }
+  extent->next = start;
+  extent->end = start + EXTENT_PAGES;
+  pager->stats.extents_reserved++;
+  return extent;
+}
+
+/*
+ * Like get_unused_page_num(), for a page of the tree rooted at owner. Pages
+ * left in the tree's extent come first, then the freelist, then a new
+ * extent. Compressed files place pages wherever they fit, so there the
+ * extents would buy nothing and owner is ignored.
+ */
+uint32_t pager_allocate_page(Pager *pager, uint32_t owner) {
+  if (owner == NO_PAGE || pager->page_map != NULL) {
+    return get_unused_page_num(pager);
+  }
+
+  pthread_mutex_lock(&pager->alloc_latch);
+  Extent *extent = pager_find_extent(pager, owner);
+  if (extent == NULL || extent->next == extent->end) {
+    uint32_t page_num = pager_pop_free_page(pager);
+    if (page_num != NO_PAGE) {
+      pager_allocated(pager, page_num);
+      pthread_mutex_unlock(&pager->alloc_latch);
+      return page_num;
+    }
+    extent = pager_reserve_extent(pager, owner);
+  }
+  uint32_t page_num = pager_allocated(pager, extent->next++);
+  pthread_mutex_unlock(&pager->alloc_latch);
+  return page_num;
+}
+
+void pager_free_page(Pager *pager, uint32_t page_num) {
+  pthread_mutex_lock(&pager->alloc_latch);
+  uint32_t owner = pager_transaction(page_num);
+  if (owner != 0) {
+    // A rollback may still need the page where it is
+    pager_add_pending(pager, page_num, owner, false);
+    pthread_mutex_unlock(&pager->alloc_latch);
+    return;
+  }
+  void *meta_page = pin_page(pager, 0);
+  uint32_t *head = (uint32_t *)((char *)meta_page + META_FREELIST_HEAD_OFFSET);
+  uint32_t *count =
+      (uint32_t *)((char *)meta_page + META_FREELIST_COUNT_OFFSET);
+
+  void *page = get_page(pager, page_num);
+  pager_mark_dirty(pager, page_num);
+  memset(page, 0, pager->page_size);
+  *(uint32_t *)((char *)page + FREE_PAGE_NEXT_OFFSET) = *head;
+
+  pager_mark_dirty(pager, 0);
+  *head = page_num;
+  *count += 1;
+
+  unpin_page(pager, 0);
+  pthread_mutex_unlock(&pager->alloc_latch);
+}
+
+/*
+ * Gives back the unused part of every extent on close. Reservations at the
+ * end of the file are simply dropped, since those pages were never written;
+ * the rest go on the freelist.
+ */
+static void pager_release_extents(Pager *pager) {
+  bool trimmed = true;
+  while (trimmed) {
+    trimmed = false;
+    for (uint32_t i = 0; i < pager->num_extents; i++) {
+      Extent *extent = &pager->extents[i];
+      if (extent->next < extent->end && extent->end == pager->num_pages) {
+        pager->num_pages = extent->next;
+        extent->end = extent->next;
+        trimmed = true;
+      }
+    }
+  }
+
+  for (uint32_t i = 0; i < pager->num_extents; i++) {
+    Extent *extent = &pager->extents[i];
+    while (extent->next < extent->end) {
+      pager_free_page(pager, extent->next++);
+    }
+  }
+  pager->num_extents = 0;
+}
+
+// Cuts the file down to end pages; every page past it must be free
+static void pager_truncate(Pager *pager, uint32_t end) {
+  pager_unpin_recent(pager, end);
+  // Warm-up could bring a page past the new end back into the pool
+  pager->warm_stop = true;
+  if (pager->warm_running) {
+    pthread_join(pager->warm_thread, NULL);
+    pager->warm_running = false;
+  }
+
+  for (uint32_t p = 0; p < PAGER_PARTITIONS; p++) {
+    pthread_mutex_lock(&pager->partitions[p].latch);
+    for (uint32_t bucket = p; bucket < pager->page_table_size;
+         bucket += PAGER_PARTITIONS) {
+      uint32_t *link = &pager->page_table[bucket];
+      while (*link != NO_FRAME) {
+        Frame *frame = &pager->frames[*link];
+        if (frame->page_num < end) {
+          link = &frame->hash_next;
+          continue;
+        }
+        if (frame->mapped) {
+          pager_discard_mapped(pager, frame);
+        }
+        if (frame->dirty) {
+          frame->dirty = false;
+          pager->dirty_pages--;
+        }
+        *link = frame->hash_next;
+        frame->hash_next = NO_FRAME;
+        frame->page_num = NO_PAGE;
+        frame->referenced = false;
+        frame->pin_count = 0;
+      }
+    }
+    pthread_mutex_unlock(&pager->partitions[p].latch);
+  }
+
+  pager->num_pages = end;
+  uint64_t length = pager_page_offset(pager, end);
+  if (pager->page_map != NULL) {
+    pthread_mutex_lock(&pager->io_latch);
+    page_map_truncate(pager->page_map, end);
+    pthread_mutex_unlock(&pager->io_latch);
+  } else if (pager->wal != NULL) {
+    // The file is cut at the next checkpoint, once the new size is
+    // committed; until then a crash must find the old pages intact
+    wal_forget(pager->wal, end);
+  } else if (pager->file_length > length) {
+    if (ftruncate(pager->file_descriptor, length) == -1) {
+      printf("Error truncating db file: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (pager->file_length > length) {
+    pager->file_length = length;
+  }
+}
+
+/*
+ * Rewrites the freelist in page order, so the lowest free pages are handed
+ * out first, and gives free pages at the end of the file back to the file
+ * system. Returns the number of pages the file lost.
+ */
+uint32_t pager_compact(Pager *pager) {
+  pager_release_extents(pager);
+  if (pager->num_pages == 0) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&pager->alloc_latch);
+  void *meta_page = pin_page(pager, 0);
+  uint32_t *head = (uint32_t *)((char *)meta_page + META_FREELIST_HEAD_OFFSET);
+  uint32_t *count =
+      (uint32_t *)((char *)meta_page + META_FREELIST_COUNT_OFFSET);
+
+  uint32_t num_free = 0;
+  uint32_t capacity = 64;
+  uint32_t *free_pages = malloc(sizeof(uint32_t) * capacity);
+  // Bounded by num_pages in case the chain is damaged and loops
+  for (uint32_t page_num = *head;
+       page_num != 0 && page_num < pager->num_pages &&
+       num_free < pager->num_pages;
+       page_num = *(uint32_t *)((char *)get_page(pager, page_num) +
+                                FREE_PAGE_NEXT_OFFSET)) {
+    if (num_free == capacity) {
+      capacity *= 2;
+      free_pages = realloc(free_pages, sizeof(uint32_t) * capacity);
+    }
+    free_pages[num_free++] = page_num;
+  }
+  qsort(free_pages, num_free, sizeof(uint32_t), compare_page_num);
+
+  uint32_t end = pager->num_pages;
+  while (num_free > 0 && free_pages[num_free - 1] == end - 1) {
+    num_free--;
+    end--;
+  }
+
+  for (uint32_t i = 0; i < num_free; i++) {
+    uint32_t next = i + 1 < num_free ? free_pages[i + 1] : 0;
+    uint32_t *link = (uint32_t *)((char *)get_page(pager, free_pages[i]) +
+                                  FREE_PAGE_NEXT_OFFSET);
+    if (*link != next) {
+      *link = next;
+      pager_mark_dirty(pager, free_pages[i]);
+    }
+  }
+  *head = num_free > 0 ? free_pages[0] : 0;
+  *count = num_free;
+  pager_mark_dirty(pager, 0);
+  unpin_page(pager, 0);
+  pthread_mutex_unlock(&pager->alloc_latch);
+  free(free_pages);
+
+  uint32_t removed = pager->num_pages - end;
+  if (removed > 0) {
+    pager_truncate(pager, end);
+  }
+  return removed;
+}
+
+/*
+ * Starts an online backup of the file, see pager_backup(). Called with the
+ * statement latch held, once the dirty pages are written back and just
+ * before the backup's snapshot begins. In WAL mode the log is moved into
+ * the file, which then holds every page as the snapshot will see it, save
+ * those that open transactions have changed. They are noted for copying
+ * again straight away, like every page written from now on.
+ */
+void pager_begin_backup(Pager *pager) {
+  if (pager->wal != NULL && pager->wal->num_frames > 0) {
+    pager_checkpoint(pager);
+  }
+
+  uint32_t num_pages = pager_committed_pages(pager);
+  uint32_t num_owned = 0;
+  uint32_t *owned = malloc(sizeof(uint32_t) * pager->num_frames);
+  for (uint32_t p = 0; p < PAGER_PARTITIONS; p++) {
+    pthread_mutex_lock(&pager->partitions[p].latch);
+    for (uint32_t bucket = p; bucket < pager->page_table_size;
+         bucket += PAGER_PARTITIONS) {
+      for (uint32_t f = pager->page_table[bucket]; f != NO_FRAME;
+           f = pager->frames[f].hash_next) {
+        if (pager->frames[f].dirty) {
+          owned[num_owned++] = pager->frames[f].page_num;
+        }
+      }
+    }
+    pthread_mutex_unlock(&pager->partitions[p].latch);
+  }
+  // Committed changes to a page past the end of the file may be kept in its
+  // undo image
+  for (uint32_t i = 0; i < num_owned; i++) {
+    if (owned[i] >= num_pages) {
+      num_pages = owned[i] + 1;
+    }
+  }
+
+  pthread_mutex_lock(&pager->backup_lock);
+  pager->backup_pages = num_pages;
+  pager->backup_written = calloc(num_pages / 8 + 1, 1);
+  pager->backup_running = true;
+  pthread_mutex_unlock(&pager->backup_lock);
+  for (uint32_t i = 0; i < num_owned; i++) {
+    pager_backup_note(pager, owned[i]);
+  }
+  free(owned);
+}
+
+/*
+ * Copies the pages counted by pager_begin_backup() to a new file at path,
+ * as the calling thread's snapshot of the pager sees them. The database
+ * file is read in BACKUP_CHUNK_BYTES chunks without any latch, so other
+ * statements go on meanwhile. A page written during the copy may have been
+ * read half-way or too late, so it is copied once more from the snapshot.
+ * Stores the number of pages, and of pages copied twice. Returns false if
+ * the backup could not be written.
+ */
+bool pager_backup(Pager *pager, const char *path, uint32_t *pages,
+                  uint32_t *recopied) {
+  pthread_mutex_lock(&pager->backup_lock);
+  uint32_t num_pages = pager->backup_pages;
+  pthread_mutex_unlock(&pager->backup_lock);
+  *pages = num_pages;
+  *recopied = 0;
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+  bool written = fd != -1;
+  // Aligned for O_DIRECT, which also reads whole blocks only
+  void *chunk = NULL;
+  if (written && posix_memalign(&chunk, 4096, BACKUP_CHUNK_BYTES) != 0) {
+    printf("Unable to allocate backup buffer\n");
+    exit(EXIT_FAILURE);
+  }
+  uint64_t length = (uint64_t)num_pages * pager->page_size;
+  for (uint64_t offset = 0; written && offset < length;
+       offset += BACKUP_CHUNK_BYTES) {
+    size_t size = length - offset < BACKUP_CHUNK_BYTES ? length - offset
+                                                       : BACKUP_CHUNK_BYTES;
+    ssize_t bytes_read =
+        pread(pager->file_descriptor, chunk, BACKUP_CHUNK_BYTES, offset);
+    if (bytes_read == -1) {
+      printf("Error reading file: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    // Pages past the end of the file are reserved but not written yet
+    if ((size_t)bytes_read < size) {
+      memset((char *)chunk + bytes_read, 0, size - bytes_read);
+    }
+    written = pwrite(fd, chunk, size, offset) == (ssize_t)size;
+  }
+  free(chunk);
+
+  pthread_mutex_lock(&pager->backup_lock);
+  uint8_t *changed = pager->backup_written;
+  pager->backup_written = NULL;
+  pager->backup_running = false;
+  pthread_mutex_unlock(&pager->backup_lock);
+  for (uint32_t page_num = 0; written && page_num < num_pages; page_num++) {
+    if (changed[page_num / 8] & (1 << (page_num % 8))) {
+      void *page = get_page(pager, page_num);
+      written = pwrite(fd, page, pager->page_size,
+                       (off_t)page_num * pager->page_size) ==
+                (ssize_t)pager->page_size;
+      (*recopied)++;
+    }
+  }
+  free(changed);
+
+  if (fd != -1) {
+    written = written && fdatasync(fd) == 0;
+    close(fd);
+  }
+  return written;
+}
+
+/*
+ * Tells the kernel how the mapping is about to be read. Only meaningful in
+ * mmap mode; the hint is re-issued only when the pattern changes.
+ */
+void pager_access_hint(Pager *pager, AccessPattern pattern) {
+  if (pager->map == NULL || pager->access_pattern == pattern) {
+    return;
+  }
+  pager->access_pattern = pattern;
+  madvise(pager->map, (size_t)pager->map_pages * pager->page_size,
+          pattern == ACCESS_SEQUENTIAL ? MADV_SEQUENTIAL : MADV_RANDOM);
+}
+
+// Sorts the pages worth reading into pages[]: in the file, not cached, not
+// newer in the log and not repeated. Returns how many there are.
+static uint32_t pager_uncached_pages(Pager *pager, const uint32_t *page_nums,
+                                     uint32_t count, uint32_t *pages) {
+  uint32_t file_pages = pager->file_length / pager->page_size;
+  uint32_t num_pages = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t page_num = page_nums[i];
+    if (page_num == NO_PAGE || page_num >= file_pages ||
+        (pager->wal != NULL && wal_contains(pager->wal, page_num))) {
+      continue;
+    }
+    bool cached = pager_lookup_locked(pager, page_num) != NO_FRAME;
+    pager_unlock_partition(pager, page_num);
+    if (!cached) {
+      pages[num_pages++] = page_num;
+    }
+  }
+
+  qsort(pages, num_pages, sizeof(uint32_t), compare_page_num);
+  uint32_t unique = 0;
+  for (uint32_t i = 0; i < num_pages; i++) {
+    if (unique == 0 || pages[i] != pages[unique - 1]) {
+      pages[unique++] = pages[i];
+    }
+  }
+  return unique;
+}
+
+// Asks the kernel to start reading sorted pages into its page cache
+static void pager_advise_pages(Pager *pager, const uint32_t *pages,
+                               uint32_t num_pages) {
+  if (pager->page_map != NULL) {
+    // Slots are not laid out in page order, so hint each one on its own
+    pthread_mutex_lock(&pager->io_latch);
+    for (uint32_t i = 0; i < num_pages; i++) {
+      PageSlot *slot = &pager->page_map->slots[pages[i]];
+      if (pages[i] < pager->page_map->num_pages && slot->offset != 0) {
+        posix_fadvise(pager->file_descriptor, slot->offset, slot->length,
+                      POSIX_FADV_WILLNEED);
+      }
+    }
+    pthread_mutex_unlock(&pager->io_latch);
+    return;
+  }
+
+  uint32_t run_start = 0;
+  for (uint32_t i = 1; i <= num_pages; i++) {
+    if (i < num_pages && pages[i] == pages[i - 1] + 1) {
+      continue;
+    }
+    uint32_t first = pages[run_start];
+    uint32_t run_length = i - run_start;
+    if (first + run_length <= pager->map_pages) {
+      // The mapping serves misses, so this is all it takes
+      madvise((char *)pager->map + (size_t)first * pager->page_size,
+              (size_t)run_length * pager->page_size, MADV_WILLNEED);
+    } else {
+      posix_fadvise(pager->file_descriptor, pager_page_offset(pager, first),
+                    pager_page_offset(pager, run_length), POSIX_FADV_WILLNEED);
+    }
+    run_start = i;
+  }
+}
+
+/*
+ * Loads sorted pages into the pool with one batch of vectored reads, one per
+ * run of adjacent pages. Pages another thread fetches in the meantime are
+ * left alone. Returns how many pages were read.
+ *
+ * Every thread's batches together pin at most a quarter of the pool, so
+ * foreground queries never run out of frames; pages beyond what is left of
+ * that budget are dropped.
+ */
+static uint32_t pager_read_pages(Pager *pager, const uint32_t *pages,
+                                 uint32_t num_pages) {
+  uint32_t budget = pager->num_frames / 4;
+  uint32_t in_use = pager->read_ahead_frames;
+  uint32_t claimed;
+  do {
+    claimed = in_use < budget ? budget - in_use : 0;
+    if (claimed > num_pages) {
+      claimed = num_pages;
+    }
+  } while (claimed > 0 &&
+           !atomic_compare_exchange_weak(&pager->read_ahead_frames, &in_use,
+                                         in_use + claimed));
+  if (claimed == 0) {
+    return 0;
+  }
+  num_pages = claimed;
+
+  struct iovec *iov = malloc(sizeof(struct iovec) * num_pages);
+  IoRequest *requests = malloc(sizeof(IoRequest) * num_pages);
+  uint32_t *frame_indexes = malloc(sizeof(uint32_t) * num_pages);
+  uint32_t num_requests = 0;
+  uint32_t num_loading = 0;
+  uint32_t previous = NO_PAGE;
+
+  for (uint32_t i = 0; i < num_pages; i++) {
+    // Pinned until the batch completes so later allocations skip it
+    uint32_t frame_index = pager_allocate_frame(pager);
+    Frame *frame = &pager->frames[frame_index];
+
+    PagePartition *partition = page_partition(pager, pages[i]);
+    pthread_mutex_lock(&partition->latch);
+    if (page_table_lookup(pager, pages[i]) != NO_FRAME) {
+      pthread_mutex_unlock(&partition->latch);
+      pager_release_frame(frame);
+      continue;
+    }
+    frame->data = frame->buffer;
+    frame->mapped = false;
+    frame->page_num = pages[i];
+    frame->referenced = false;
+    frame->dirty = false;
+    frame->loading = true;
+    frame->accesses = 0;
+    frame->undo_owner = 0;
+    frame->undo_dirty = false;
+    frame->write_ts = 0;
+    page_table_insert(pager, frame_index);
+    pthread_mutex_unlock(&partition->latch);
+
+    memset(frame->data, 0, pager->page_size);
+    iov[num_loading].iov_base = frame->data;
+    iov[num_loading].iov_len = pager->page_size;
+
+    IoRequest *request = num_requests ? &requests[num_requests - 1] : NULL;
+    if (request == NULL || pages[i] != previous + 1 ||
+        request->iovcnt == IO_REQUEST_MAX_IOVECS) {
+      request = &requests[num_requests++];
+      request->fd = pager->file_descriptor;
+      request->write = false;
+      request->iov = &iov[num_loading];
+      request->iovcnt = 0;
+      request->offset = pager_page_offset(pager, pages[i]);
+    }
+    request->iovcnt++;
+    frame_indexes[num_loading++] = frame_index;
+    previous = pages[i];
+  }
+
+  if (num_loading > 0) {
+    uint64_t start = monotonic_us();
+    pager_submit(pager, requests, num_requests);
+    latency_record(pager->stats.read_latency, start);
+  }
+
+  for (uint32_t r = 0; r < num_requests; r++) {
+    if (requests[r].result < 0) {
+      printf("Error reading file: %d\n", (int)-requests[r].result);
+      exit(EXIT_FAILURE);
+    }
+    pager->stats.bytes_read += requests[r].result;
+  }
+  pager->stats.pages_read += num_loading;
+  for (uint32_t i = 0; i < num_loading; i++) {
+    Frame *frame = &pager->frames[frame_indexes[i]];
+    PagePartition *partition = page_partition(pager, frame->page_num);
+    pthread_mutex_lock(&partition->latch);
+    frame->loading = false;
+    frame->pin_count--;
+    pthread_cond_broadcast(&partition->loaded);
+    pthread_mutex_unlock(&partition->latch);
+  }
+  pager->read_ahead_frames -= claimed;
+
+  free(frame_indexes);
+  free(requests);
+  free(iov);
+  return num_loading;
+}
+
+/*
+ * Starts reading the listed pages ahead of use. With io_uring or O_DIRECT the
+ * pages are loaded into the pool with one batch of coalesced reads, spending
+ * at most a quarter of the pool so the working set survives; otherwise the
+ * kernel is asked to pull them into the page cache in the background. Pages
+ * that are already cached or not yet in the file are skipped. Returns how
+ * many entries of page_nums were considered.
+ */
+uint32_t pager_prefetch(Pager *pager, const uint32_t *page_nums,
+                        uint32_t count) {
+  uint32_t budget = pager->num_frames / 4;
+  if (count > budget) {
+    count = budget;
+  }
+
+  uint32_t *pages = malloc(sizeof(uint32_t) * (count + 1));
+  uint32_t num_pages = pager_uncached_pages(pager, page_nums, count, pages);
+  pager->stats.prefetched_pages += num_pages;
+
+  bool load = (pager->ring != NULL || pager->direct_io) &&
+              pager->map == NULL && pager->page_map == NULL;
+  if (num_pages > 0 && load) {
+    pager_read_pages(pager, pages, num_pages);
+  } else if (num_pages > 0) {
+    pager_advise_pages(pager, pages, num_pages);
+  }
+
+  free(pages);
+  return count;
+}
+
+static void *pager_warm_up_thread(void *arg) {
+  Pager *pager = arg;
+
+  // At most a quarter of the pool is pinned at a time, so foreground
+  // queries never run out of frames
+  uint32_t batch = pager->num_frames / 4;
+  if (batch > WARM_UP_BATCH_PAGES) {
+    batch = WARM_UP_BATCH_PAGES;
+  }
+  uint32_t *pages = malloc(sizeof(uint32_t) * batch);
+
+  for (uint32_t i = 0; i < pager->warm_count && !pager->warm_stop;
+       i += batch) {
+    uint32_t count = pager->warm_count - i < batch ? pager->warm_count - i
+                                                   : batch;
+    uint32_t num_pages =
+        pager_uncached_pages(pager, &pager->warm_pages[i], count, pages);
+
+    if (pager->map != NULL) {
+      // Mapped pages need no frame; faulting them in is the whole job
+      pager_advise_pages(pager, pages, num_pages);
+    } else if (pager->page_map != NULL) {
+      // Each slot is decompressed on its own anyway
+      for (uint32_t j = 0; j < num_pages; j++) {
+        pin_page(pager, pages[j]);
+        unpin_page(pager, pages[j]);
+      }
+    } else {
+      num_pages = pager_read_pages(pager, pages, num_pages);
+    }
+    pager->stats.warmed_pages += num_pages;
+  }
+
+  free(pages);
+  return NULL;
+}
+
+/*
+ * Starts loading the pages listed in a warm-up file, in page order, on a
+ * background thread. A missing or mismatched file is ignored.
+ */
+void pager_warm_up(Pager *pager, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return;
+  }
+
+  WarmListHeader header;
+  bool valid = read(fd, &header, sizeof(header)) == sizeof(header) &&
+               header.magic == WARM_LIST_MAGIC &&
+               header.page_size == pager->page_size;
+  // The list is hottest first, so a smaller pool keeps the right prefix
+  uint32_t count = valid ? header.count : 0;
+  if (count > pager->num_frames) {
+    count = pager->num_frames;
+  }
+
+  uint32_t *pages = malloc(sizeof(uint32_t) * (count + 1));
+  ssize_t length = sizeof(uint32_t) * count;
+  if (count == 0 || read(fd, pages, length) != length) {
+    free(pages);
+    close(fd);
+    return;
+  }
+  close(fd);
+
+  // Sorted so that neighbouring pages merge into large reads
+  qsort(pages, count, sizeof(uint32_t), compare_page_num);
+  pager->warm_pages = pages;
+  pager->warm_count = count;
+  pager->warm_stop = false;
+  if (pthread_create(&pager->warm_thread, NULL, pager_warm_up_thread,
+                     pager) == 0) {
+    pager->warm_running = true;
+  }
+}
+
+typedef struct {
+  uint32_t page_num;
+  uint32_t accesses;
+} WarmEntry;
+
+static int compare_warm_entry(const void *a, const void *b) {
+  uint32_t accesses_a = ((const WarmEntry *)a)->accesses;
+  uint32_t accesses_b = ((const WarmEntry *)b)->accesses;
+  return (accesses_a < accesses_b) - (accesses_a > accesses_b);
+}
+
+/*
+ * Writes the cached page numbers, most accessed first, for pager_warm_up()
+ * to load on the next start. The list is only a hint, so failures are
+ * reported and otherwise ignored.
+ */
+void pager_save_warm_list(Pager *pager, const char *path) {
+  WarmEntry *cached = malloc(sizeof(WarmEntry) * pager->num_frames);
+  uint32_t count = 0;
+  for (uint32_t p = 0; p < PAGER_PARTITIONS; p++) {
+    pthread_mutex_lock(&pager->partitions[p].latch);
+    for (uint32_t bucket = p; bucket < pager->page_table_size;
+         bucket += PAGER_PARTITIONS) {
+      for (uint32_t f = pager->page_table[bucket]; f != NO_FRAME;
+           f = pager->frames[f].hash_next) {
+        cached[count].page_num = pager->frames[f].page_num;
+        cached[count].accesses = pager->frames[f].accesses;
+        count++;
+      }
+    }
+    pthread_mutex_unlock(&pager->partitions[p].latch);
+  }
+  qsort(cached, count, sizeof(WarmEntry), compare_warm_entry);
+
+  WarmListHeader header = {WARM_LIST_MAGIC, pager->page_size, count};
+  uint32_t *pages = malloc(sizeof(uint32_t) * (count + 1));
+  for (uint32_t i = 0; i < count; i++) {
+    pages[i] = cached[i].page_num;
+  }
+  free(cached);
+
+  // Written aside and renamed, so a crash never leaves half a list
+  char temp_path[PATH_MAX];
+  snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+  int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+  ssize_t length = sizeof(uint32_t) * count;
+  bool written = fd != -1 &&
+                 write(fd, &header, sizeof(header)) == sizeof(header) &&
+                 write(fd, pages, length) == length;
+  if (fd != -1) {
+    close(fd);
+  }
+  if (!written || rename(temp_path, path) == -1) {
+    printf("Unable to save warm-up list %s (%d)\n", path, errno);
+    unlink(temp_path);
+  }
+  free(pages);
+}
+
+static void print_histogram(int out_fd, const char *name,
+                            const _Atomic uint64_t *histogram) {
+  for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+    if (histogram[i] == 0) {
+      continue;
+    }
+    if (i == LATENCY_BUCKETS - 1) {
+      dprintf(out_fd, "%s_us{ge=%llu} %llu\n", name,
+              (unsigned long long)1 << (i - 1),
+              (unsigned long long)histogram[i]);
+    } else {
+      dprintf(out_fd, "%s_us{lt=%llu} %llu\n", name,
+              (unsigned long long)1 << i, (unsigned long long)histogram[i]);
+    }
+  }
+}
+
+/*
+ * One "name value" pair per line so the output can be scraped and graphed.
+ * Histogram buckets that are still empty are left out.
+ */
+void pager_print_stats(Pager *pager, int out_fd) {
+  PagerStats *stats = &pager->stats;
+  uint32_t cached = 0;
+  uint32_t dirty = 0;
+  for (uint32_t p = 0; p < PAGER_PARTITIONS; p++) {
+    pthread_mutex_lock(&pager->partitions[p].latch);
+    for (uint32_t bucket = p; bucket < pager->page_table_size;
+         bucket += PAGER_PARTITIONS) {
+      for (uint32_t f = pager->page_table[bucket]; f != NO_FRAME;
+           f = pager->frames[f].hash_next) {
+        cached++;
+        dirty += pager->frames[f].dirty;
+      }
+    }
+    pthread_mutex_unlock(&pager->partitions[p].latch);
+  }
+  uint64_t lookups = stats->hits + stats->misses;
+
+  dprintf(out_fd, "page_size %u\n", pager->page_size);
+  dprintf(out_fd, "file_pages %u\n", pager->num_pages);
+  dprintf(out_fd, "cache_frames %u\n", pager->num_frames);
+  dprintf(out_fd, "cached_pages %u\n", cached);
+  dprintf(out_fd, "dirty_pages %u\n", dirty);
+  dprintf(out_fd, "hits %llu\n", (unsigned long long)stats->hits);
+  dprintf(out_fd, "misses %llu\n", (unsigned long long)stats->misses);
+  dprintf(out_fd, "hit_ratio %.4f\n",
+          lookups ? (double)stats->hits / lookups : 0.0);
+  dprintf(out_fd, "evictions %llu\n", (unsigned long long)stats->evictions);
+  dprintf(out_fd, "dirty_evictions %llu\n",
+          (unsigned long long)stats->dirty_evictions);
+  dprintf(out_fd, "pages_read %llu\n", (unsigned long long)stats->pages_read);
+  dprintf(out_fd, "bytes_read %llu\n", (unsigned long long)stats->bytes_read);
+  dprintf(out_fd, "pages_written %llu\n",
+          (unsigned long long)stats->pages_written);
+  dprintf(out_fd, "bytes_written %llu\n",
+          (unsigned long long)stats->bytes_written);
+  dprintf(out_fd, "flushes %llu\n", (unsigned long long)stats->flushes);
+  dprintf(out_fd, "prefetched_pages %llu\n",
+          (unsigned long long)stats->prefetched_pages);
+  dprintf(out_fd, "warmed_pages %llu\n",
+          (unsigned long long)stats->warmed_pages);
+  dprintf(out_fd, "background_pages %llu\n",
+          (unsigned long long)stats->background_pages);
+  dprintf(out_fd, "extents_reserved %llu\n",
+          (unsigned long long)stats->extents_reserved);
+  dprintf(out_fd, "syncs %llu\n", (unsigned long long)stats->syncs);
+  dprintf(out_fd, "rollbacks %llu\n", (unsigned long long)stats->rollbacks);
+  dprintf(out_fd, "rollback_discards %llu\n",
+          (unsigned long long)stats->rollback_discards);
+  dprintf(out_fd, "rollback_restores %llu\n",
+          (unsigned long long)stats->rollback_restores);
+  dprintf(out_fd, "undo_images %llu\n",
+          (unsigned long long)stats->undo_images);
+  dprintf(out_fd, "snapshots %llu\n", (unsigned long long)stats->snapshots);
+  dprintf(out_fd, "versions_saved %llu\n",
+          (unsigned long long)stats->versions_saved);
+  dprintf(out_fd, "version_reads %llu\n",
+          (unsigned long long)stats->version_reads);
+  pthread_mutex_lock(&pager->version_lock);
+  dprintf(out_fd, "versions %u\n", pager->live_versions);
+  pthread_mutex_unlock(&pager->version_lock);
+  if (pager->wal != NULL) {
+    dprintf(out_fd, "wal_frames %llu\n", (unsigned long long)stats->wal_frames);
+    dprintf(out_fd, "wal_commits %llu\n",
+            (unsigned long long)stats->wal_commits);
+    dprintf(out_fd, "wal_syncs %llu\n", (unsigned long long)stats->wal_syncs);
+    dprintf(out_fd, "checkpoints %llu\n",
+            (unsigned long long)stats->checkpoints);
+  }
+  if (pager->page_map != NULL) {
+    uint64_t stored = page_map_stored_bytes(pager->page_map);
+    uint64_t logical = (uint64_t)pager->page_map->num_pages * pager->page_size;
+    dprintf(out_fd, "stored_bytes %llu\n", (unsigned long long)stored);
+    dprintf(out_fd, "compression_ratio %.2f\n",
+            stored ? (double)logical / stored : 0.0);
+  }
+  print_histogram(out_fd, "read_latency", stats->read_latency);
+  print_histogram(out_fd, "flush_latency", stats->flush_latency);
+}
+
+void pager_reset_stats(Pager *pager) {
+  memset(&pager->stats, 0, sizeof(PagerStats));
+}
@@ -0,0 +1,533 @@
+#include "replication.h"
+#include "wal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The connection a replica reads the primary's commits from
+typedef struct {
+  Table *table;
+  int fd;
+} ReplicaStream;
+
+static bool send_all(int fd, const void *data, size_t size) {
+  const uint8_t *bytes = data;
+  while (size > 0) {
+    ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+    if (sent == -1 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return false;
+    }
+    bytes += sent;
+    size -= sent;
+  }
+  return true;
+}
+
+static bool recv_all(int fd, void *data, size_t size) {
+  uint8_t *bytes = data;
+  while (size > 0) {
+    ssize_t received = recv(fd, bytes, size, 0);
+    if (received == -1 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return false;
+    }
+    bytes += received;
+    size -= received;
+  }
+  return true;
+}
+
+/*
+ * Frees the batches every replica has been sent. Batches are sent in order,
+ * so those are at the front. Called with the lock held.
+ */
+static void replication_trim(Replication *replication) {
+  while (replication->batches != NULL &&
+         replication->batches->senders == 0) {
+    ReplicationBatch *batch = replication->batches;
+    replication->batches = batch->next;
+    if (replication->last == batch) {
+      replication->last = NULL;
+    }
+    free(batch);
+  }
+}
+
+static ReplicationBatch *replication_find(Replication *replication,
+                                          uint64_t seq) {
+  for (ReplicationBatch *batch = replication->batches; batch != NULL;
+       batch = batch->next) {
+    if (batch->seq == seq) {
+      return batch;
+    }
+  }
+  return NULL;
+}
+
+// Stops sending to a replica and gives up its claim on the batches left
+static void replication_remove(Replication *replication, Replica *replica) {
+  pthread_mutex_lock(&replication->lock);
+  Replica **link = &replication->replicas;
+  while (*link != replica) {
+    link = &(*link)->next;
+  }
+  *link = replica->next;
+  for (ReplicationBatch *batch = replication->batches; batch != NULL;
+       batch = batch->next) {
+    if (batch->seq >= replica->next_seq && batch->seq <= replica->last_seq) {
+      batch->senders--;
+    }
+  }
+  replication_trim(replication);
+  pthread_mutex_unlock(&replication->lock);
+}
+
+/*
+ * Sends every page as the calling thread's snapshot sees it, a backup
+ * chunk's worth at a time.
+ */
+static bool replication_send_copy(Replica *replica, Pager *pager,
+                                  uint32_t num_pages) {
+  ReplicationHeader header = {REPLICATION_MAGIC, pager->page_size, num_pages};
+  if (!send_all(replica->fd, &header, sizeof(header))) {
+    return false;
+  }
+  uint32_t chunk_pages = BACKUP_CHUNK_BYTES / pager->page_size;
+  uint8_t *chunk = malloc((size_t)chunk_pages * pager->page_size);
+  bool sent = true;
+  for (uint32_t first = 0; sent && first < num_pages; first += chunk_pages) {
+    uint32_t count = num_pages - first < chunk_pages ? num_pages - first
+                                                     : chunk_pages;
+    for (uint32_t i = 0; i < count; i++) {
+      memcpy(chunk + (size_t)i * pager->page_size, get_page(pager, first + i),
+             pager->page_size);
+    }
+    sent = send_all(replica->fd, chunk, (size_t)count * pager->page_size);
+  }
+  free(chunk);
+  return sent;
+}
+
+/*
+ * Serves one replica: a copy of the database as of the last commit, then
+ * every commit after it, until the replica goes away or falls too far
+ * behind.
+ */
+static void *replication_sender(void *arg) {
+  Replica *replica = arg;
+  Replication *replication = replica->replication;
+  Table *table = replication->table;
+
+  // Commits from here on are sent after the copy. The first one is the
+  // flush that makes the file match the snapshot.
+  db_begin_statement(table);
+  pthread_mutex_lock(&replication->lock);
+  replica->next_seq = replication->next_seq;
+  replica->last_seq = replica->next_seq - 1;
+  replica->next = replication->replicas;
+  replication->replicas = replica;
+  pthread_mutex_unlock(&replication->lock);
+  db_flush_all(table);
+  Table *snapshot = db_snapshot(table);
+  uint32_t num_pages = table->pager->num_pages;
+  db_end_statement(table);
+
+  bool sent = replication_send_copy(replica, snapshot->pager, num_pages);
+  db_end_snapshot(snapshot);
+  printf("Replica connected: %u pages copied\n", num_pages);
+
+  pthread_mutex_lock(&replication->lock);
+  while (sent && !replica->dropped) {
+    ReplicationBatch *batch = replication_find(replication, replica->next_seq);
+    if (batch == NULL) {
+      pthread_cond_wait(&replication->wake, &replication->lock);
+      continue;
+    }
+    // The batch is not freed before this replica gives it up
+    uint32_t size = batch->size;
+    pthread_mutex_unlock(&replication->lock);
+    sent = send_all(replica->fd, batch->data, size);
+    pthread_mutex_lock(&replication->lock);
+    batch->senders--;
+    replica->next_seq++;
+    replica->lag -= size;
+    replication_trim(replication);
+    if (sent) {
+      replication->batches_shipped++;
+      replication->bytes_shipped += size;
+    }
+  }
+  pthread_mutex_unlock(&replication->lock);
+
+  printf("Replica disconnected\n");
+  replication_remove(replication, replica);
+  close(replica->fd);
+  free(replica);
+  return NULL;
+}
+
+static void *replication_listener(void *arg) {
+  Replication *replication = arg;
+  while (1) {
+    int fd = accept(replication->listen_fd, NULL, NULL);
+    if (fd < 0) {
+      perror("accept");
+      continue;
+    }
+    Replica *replica = calloc(1, sizeof(Replica));
+    replica->replication = replication;
+    replica->fd = fd;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, replication_sender, replica) != 0) {
+      perror("pthread_create");
+      close(fd);
+      free(replica);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+  return NULL;
+}
+
+/*
+ * Makes the database a primary: replicas may connect on port from now on.
+ * Only a single-file, uncompressed database can be replicated.
+ */
+void replication_start(Table *table, int port) {
+  Pager *pager = table->pager;
+  if (table->file_per_table || pager->page_map != NULL) {
+    printf("Only single-file, uncompressed databases can be replicated.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    perror("socket failed");
+    exit(EXIT_FAILURE);
+  }
+  int opt = 1;
+  if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
+    perror("setsockopt");
+    exit(EXIT_FAILURE);
+  }
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = INADDR_ANY;
+  address.sin_port = htons(port);
+  if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    perror("bind failed");
+    exit(EXIT_FAILURE);
+  }
+  if (listen(listen_fd, 3) < 0) {
+    perror("listen");
+    exit(EXIT_FAILURE);
+  }
+
+  Replication *replication = calloc(1, sizeof(Replication));
+  replication->table = table;
+  replication->page_size = pager->page_size;
+  replication->listen_fd = listen_fd;
+  replication->next_seq = 1;
+  pthread_mutex_init(&replication->lock, NULL);
+  pthread_cond_init(&replication->wake, NULL);
+
+  // Pages are captured from the next statement on
+  db_begin_statement(table);
+  pager->replication = replication;
+  db_end_statement(table);
+  if (table->sync_mode == SYNC_OFF) {
+    db_set_sync_mode(table, SYNC_NORMAL);
+  }
+
+  if (pthread_create(&replication->accept_thread, NULL, replication_listener,
+                     replication) != 0) {
+    perror("pthread_create");
+    exit(EXIT_FAILURE);
+  }
+  printf("Replicating on port %d\n", port);
+}
+
+/*
+ * Called by the pager for every page it has just written. Nothing is kept
+ * while no replica is connected: one that connects later starts from a copy.
+ */
+void replication_capture(Replication *replication, uint32_t page_num,
+                         const void *page) {
+  pthread_mutex_lock(&replication->lock);
+  if (replication->replicas == NULL) {
+    pthread_mutex_unlock(&replication->lock);
+    return;
+  }
+  uint32_t size = sizeof(uint32_t) + replication->page_size;
+  if (replication->pending_size + size > replication->pending_capacity) {
+    uint32_t capacity = replication->pending_capacity
+                            ? replication->pending_capacity * 2
+                            : size * 64;
+    while (capacity < replication->pending_size + size) {
+      capacity *= 2;
+    }
+    replication->pending = realloc(replication->pending, capacity);
+    replication->pending_capacity = capacity;
+  }
+  uint8_t *frame = replication->pending + replication->pending_size;
+  memcpy(frame, &page_num, sizeof(uint32_t));
+  memcpy(frame + sizeof(uint32_t), page, replication->page_size);
+  replication->pending_size += size;
+  pthread_mutex_unlock(&replication->lock);
+}
+
+/*
+ * Called at the end of pager_commit(): the pages written since the last
+ * commit become a batch for every connected replica. A replica whose unsent
+ * batches would grow past REPLICATION_MAX_LAG_BYTES is disconnected instead.
+ */
+void replication_commit(Replication *replication) {
+  pthread_mutex_lock(&replication->lock);
+  if (replication->pending_size == 0 || replication->replicas == NULL) {
+    replication->pending_size = 0;
+    pthread_mutex_unlock(&replication->lock);
+    return;
+  }
+  uint32_t size = replication->pending_size + sizeof(uint32_t);
+  ReplicationBatch *batch = malloc(sizeof(ReplicationBatch) + size);
+  batch->seq = replication->next_seq++;
+  batch->size = size;
+  batch->senders = 0;
+  batch->next = NULL;
+  memcpy(batch->data, replication->pending, replication->pending_size);
+  uint32_t commit = REPLICATION_COMMIT;
+  memcpy(batch->data + replication->pending_size, &commit, sizeof(uint32_t));
+  replication->pending_size = 0;
+
+  for (Replica *replica = replication->replicas; replica != NULL;
+       replica = replica->next) {
+    if (replica->dropped) {
+      continue;
+    }
+    if (replica->lag + size > REPLICATION_MAX_LAG_BYTES) {
+      printf("Replica fell too far behind, disconnecting it\n");
+      replica->dropped = true;
+      shutdown(replica->fd, SHUT_RDWR);
+      continue;
+    }
+    replica->lag += size;
+    replica->last_seq = batch->seq;
+    batch->senders++;
+  }
+  if (batch->senders == 0) {
+    free(batch);
+  } else if (replication->last == NULL) {
+    replication->batches = replication->last = batch;
+  } else {
+    replication->last->next = batch;
+    replication->last = batch;
+  }
+  pthread_cond_broadcast(&replication->wake);
+  pthread_mutex_unlock(&replication->lock);
+}
+
+void replication_print_stats(Replication *replication, int out_fd) {
+  uint32_t replicas = 0;
+  pthread_mutex_lock(&replication->lock);
+  for (Replica *replica = replication->replicas; replica != NULL;
+       replica = replica->next) {
+    replicas++;
+  }
+  pthread_mutex_unlock(&replication->lock);
+  dprintf(out_fd, "replicas %u\n", replicas);
+  dprintf(out_fd, "replication_batches %lu\n",
+          (unsigned long)replication->batches_shipped);
+  dprintf(out_fd, "replication_bytes %lu\n",
+          (unsigned long)replication->bytes_shipped);
+}
+
+void replication_reset_stats(Replication *replication) {
+  replication->batches_shipped = 0;
+  replication->bytes_shipped = 0;
+}
+
+static int replica_connect(const char *primary) {
+  const char *colon = strrchr(primary, ':');
+  if (colon == NULL || colon == primary || colon[1] == '\0') {
+    printf("The primary must be given as <host>:<port>.\n");
+    exit(EXIT_FAILURE);
+  }
+  char *host = strndup(primary, colon - primary);
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *addresses;
+  if (getaddrinfo(host, colon + 1, &hints, &addresses) != 0) {
+    printf("Unable to resolve primary '%s'.\n", primary);
+    exit(EXIT_FAILURE);
+  }
+  free(host);
+
+  int fd = -1;
+  for (struct addrinfo *address = addresses; address != NULL && fd == -1;
+       address = address->ai_next) {
+    fd = socket(address->ai_family, address->ai_socktype,
+                address->ai_protocol);
+    if (fd != -1 && connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (fd == -1) {
+    printf("Unable to connect to primary '%s'.\n", primary);
+    exit(EXIT_FAILURE);
+  }
+  return fd;
+}
+
+/*
+ * Connects to the primary and writes its copy of the database over
+ * filename, dropping any log left beside it. Called before the database is
+ * opened. Returns the connection, which the commits that follow arrive on.
+ */
+int replica_copy(const char *filename, const char *primary) {
+  int fd = replica_connect(primary);
+  ReplicationHeader header;
+  if (!recv_all(fd, &header, sizeof(header)) ||
+      header.magic != REPLICATION_MAGIC) {
+    printf("Primary '%s' did not send a database.\n", primary);
+    exit(EXIT_FAILURE);
+  }
+
+  int file = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+  if (file == -1) {
+    printf("Unable to open file\n");
+    exit(EXIT_FAILURE);
+  }
+  uint32_t chunk_pages = BACKUP_CHUNK_BYTES / header.page_size;
+  uint8_t *chunk = malloc((size_t)chunk_pages * header.page_size);
+  for (uint32_t first = 0; first < header.num_pages; first += chunk_pages) {
+    uint32_t count = header.num_pages - first < chunk_pages
+                         ? header.num_pages - first
+                         : chunk_pages;
+    size_t size = (size_t)count * header.page_size;
+    if (!recv_all(fd, chunk, size)) {
+      printf("Lost the connection to the primary during the copy.\n");
+      exit(EXIT_FAILURE);
+    }
+    if (pwrite(file, chunk, size, (off_t)first * header.page_size) !=
+        (ssize_t)size) {
+      printf("Error writing: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+  }
+  free(chunk);
+  if (fdatasync(file) == -1) {
+    printf("Error syncing db file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  close(file);
+
+  // The copy already holds whatever an old log had
+  char *wal_path = malloc(strlen(filename) + sizeof(WAL_SUFFIX));
+  sprintf(wal_path, "%s%s", filename, WAL_SUFFIX);
+  unlink(wal_path);
+  free(wal_path);
+
+  printf("Copied %u pages from primary %s\n", header.num_pages, primary);
+  return fd;
+}
+
+/*
+ * Replaces a commit's pages in one statement, so snapshot readers see all
+ * of it or none. The catalog is read again if the commit changed it.
+ */
+static void replica_apply(Table *table, const uint32_t *page_nums,
+                          const uint8_t *pages, uint32_t count) {
+  Pager *pager = table->pager;
+  db_begin_statement(table);
+  bool catalog = false;
+  for (uint32_t i = 0; i < count; i++) {
+    void *page = get_page(pager, page_nums[i]);
+    pager_mark_dirty(pager, page_nums[i]);
+    memcpy(page, pages + (size_t)i * pager->page_size, pager->page_size);
+    if (page_nums[i] == 0 ||
+        page_nums[i] == table->directory_root_page_num) {
+      catalog = true;
+    }
+  }
+  if (catalog) {
+    db_reload_catalog(table);
+  }
+  db_statement_done(table, false);
+  db_end_statement(table);
+}
+
+// Applies the primary's commits as they arrive
+static void *replica_receiver(void *arg) {
+  ReplicaStream *stream = arg;
+  Table *table = stream->table;
+  uint32_t page_size = table->pager->page_size;
+  uint32_t capacity = 64;
+  uint32_t count = 0;
+  uint32_t *page_nums = malloc(sizeof(uint32_t) * capacity);
+  uint8_t *pages = malloc((size_t)capacity * page_size);
+
+  uint32_t page_num;
+  while (recv_all(stream->fd, &page_num, sizeof(page_num))) {
+    if (page_num == REPLICATION_COMMIT) {
+      replica_apply(table, page_nums, pages, count);
+      count = 0;
+      continue;
+    }
+    if (count == capacity) {
+      capacity *= 2;
+      page_nums = realloc(page_nums, sizeof(uint32_t) * capacity);
+      pages = realloc(pages, (size_t)capacity * page_size);
+    }
+    if (!recv_all(stream->fd, pages + (size_t)count * page_size, page_size)) {
+      break;
+    }
+    page_nums[count++] = page_num;
+  }
+
+  // A commit cut short is dropped; readers keep the last whole one
+  printf("Lost the connection to the primary\n");
+  close(stream->fd);
+  free(page_nums);
+  free(pages);
+  free(stream);
+  return NULL;
+}
+
+/*
+ * Makes the opened copy a replica: it refuses changes from clients and
+ * applies the primary's commits on a thread of its own.
+ */
+void replica_start(Table *table, int fd) {
+  table->read_only = true;
+  // Applied commits reach the replica's file too, so it can stand in
+  if (table->sync_mode == SYNC_OFF) {
+    db_set_sync_mode(table, SYNC_NORMAL);
+  }
+
+  ReplicaStream *stream = malloc(sizeof(ReplicaStream));
+  stream->table = table;
+  stream->fd = fd;
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, replica_receiver, stream) != 0) {
+    perror("pthread_create");
+    exit(EXIT_FAILURE);
+  }
+  pthread_detach(thread);
+}
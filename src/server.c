@@ -1,5 +1,6 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,18 +10,136 @@
 
 #include "compiler.h"
 #include "input_buffer.h"
+#include "replication.h"
 #include "table.h"
 #include "vm.h"
 
-#define PORT 8088
 #define BUFFER_SIZE 1024
 
-void run_server(const char *filename) {
+// Serves one connected client on a thread of its own
+static void *serve_client(void *arg) {
+  Session *session = arg;
+  Table *table = session->table;
+  int client_socket = session->out_fd;
+  char buffer[BUFFER_SIZE] = {0};
+  InputBuffer *input_buffer = new_input_buffer();
+
+  while (1) {
+    // Clear buffer
+    memset(buffer, 0, BUFFER_SIZE);
+
+    // Read from client
+    int valread = read(client_socket, buffer, BUFFER_SIZE);
+    printf("Debug: Read %d bytes: '%s'\n", valread, buffer);
+    if (valread <= 0) {
+      // Client disconnected
+      printf("Client disconnected\n");
+      break;
+    }
+
+    // Remove newline at end if present
+    // Remove newline at end if present
+    if (valread > 0 && buffer[valread - 1] == '\n') {
+      buffer[valread - 1] = '\0';
+      valread--;
+    }
+    if (valread > 0 && buffer[valread - 1] == '\r') {
+      buffer[valread - 1] = '\0';
+      valread--;
+    }
+
+    // Copy to input buffer
+    // Note: input_buffer->buffer is usually managed by getline, but here we
+    // manually set it We need to ensure input_buffer->buffer is large enough
+    // or realloc For simplicity, let's just use strncpy if it fits, or
+    // realloc Our InputBuffer struct has buffer and buffer_length. Let's just
+    // use the buffer directly or update InputBuffer. Actually,
+    // prepare_statement uses input_buffer->buffer.
+
+    // Let's resize input_buffer if needed
+    if (input_buffer->buffer_length < (size_t)valread + 1) {
+      input_buffer->buffer = realloc(input_buffer->buffer, valread + 1);
+      input_buffer->buffer_length = valread + 1;
+    }
+    strcpy(input_buffer->buffer, buffer);
+    input_buffer->input_length = strlen(buffer);
+
+    // Handle Meta Commands
+    if (input_buffer->buffer[0] == '.') {
+      // .exit means disconnect client, not shutdown server
+      if (strcmp(input_buffer->buffer, ".exit") == 0) {
+        break;
+      }
+      switch (do_meta_command(input_buffer, table, client_socket)) {
+      case META_COMMAND_SUCCESS:
+        continue;
+      case META_COMMAND_UNRECOGNIZED_COMMAND:
+        dprintf(client_socket, "Unrecognized command '%s'\n",
+                input_buffer->buffer);
+        continue;
+      }
+    }
+
+    Statement statement;
+    switch (prepare_statement(input_buffer, &statement)) {
+    case PREPARE_SUCCESS:
+      break;
+    case PREPARE_NEGATIVE_ID:
+      dprintf(client_socket, "ID must be positive.\n");
+      continue;
+    case PREPARE_STRING_TOO_LONG:
+      dprintf(client_socket, "String is too long.\n");
+      continue;
+    case PREPARE_SYNTAX_ERROR:
+      dprintf(client_socket, "Syntax error. Could not parse statement.\n");
+      continue;
+    case PREPARE_UNRECOGNIZED_STATEMENT:
+      dprintf(client_socket, "Unrecognized keyword at start of '%s'.\n",
+              input_buffer->buffer);
+      continue;
+    }
+    printf("Debug: Calling execute_statement\n");
+    fflush(stdout);
+
+    switch (execute_statement(&statement, session)) {
+    case EXECUTE_SUCCESS:
+      dprintf(client_socket, "Executed.\n");
+      break;
+    case EXECUTE_DUPLICATE_KEY:
+      dprintf(client_socket, "Error: Duplicate key.\n");
+      break;
+    case EXECUTE_TABLE_FULL:
+      dprintf(client_socket, "Error: Table full.\n");
+      break;
+    case EXECUTE_DEADLOCK:
+      dprintf(client_socket,
+              "Error: Deadlock detected. Transaction rolled back.\n");
+      break;
+    case EXECUTE_READ_ONLY:
+      dprintf(client_socket, "Error: Read-only replica.\n");
+      break;
+    }
+  }
+
+  // A transaction left open is rolled back, releasing its locks
+  db_close_session(session);
+  close(client_socket);
+  free(session);
+  close_input_buffer(input_buffer);
+  return NULL;
+}
+
+/*
+ * Serves clients on port. With replication_port set, replicas may connect
+ * there; with primary set ("<host>:<port>"), the database is first copied
+ * from that primary and then kept up to date with it, read-only.
+ */
+void run_server(const char *filename, PagerOptions *options, int port,
+                int replication_port, const char *primary) {
   int server_fd, new_socket;
   struct sockaddr_in address;
   int opt = 1;
   int addrlen = sizeof(address);
-  char buffer[BUFFER_SIZE] = {0};
 
   // Creating socket file descriptor
   if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
@@ -28,14 +147,14 @@ void run_server(const char *filename) {
     exit(EXIT_FAILURE);
   }
 
-  // Forcefully attaching socket to the port 8080
+  // Forcefully attaching socket to the port
   if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
     perror("setsockopt");
     exit(EXIT_FAILURE);
   }
   address.sin_family = AF_INET;
   address.sin_addr.s_addr = INADDR_ANY;
-  address.sin_port = htons(PORT);
+  address.sin_port = htons(port);
 
   if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
     perror("bind failed");
@@ -46,10 +165,21 @@ void run_server(const char *filename) {
     exit(EXIT_FAILURE);
   }
 
-  printf("Server listening on port %d\n", PORT);
+  printf("Server listening on port %d\n", port);
 
-  Table *table = db_open(filename);
-  InputBuffer *input_buffer = new_input_buffer();
+  int primary_fd = -1;
+  if (primary != NULL) {
+    primary_fd = replica_copy(filename, primary);
+  }
+  Table *table = db_open(filename, options);
+  // Clients run side by side; statements still take turns on the gate
+  table->snapshot_reads = true;
+  if (primary != NULL) {
+    replica_start(table, primary_fd);
+  }
+  if (replication_port != 0) {
+    replication_start(table, replication_port);
+  }
 
   while (1) {
     if ((new_socket = accept(server_fd, (struct sockaddr *)&address,
@@ -60,97 +190,15 @@ void run_server(const char *filename) {
 
     printf("New connection accepted\n");
 
-    while (1) {
-      // Clear buffer
-      memset(buffer, 0, BUFFER_SIZE);
-
-      // Read from client
-      int valread = read(new_socket, buffer, BUFFER_SIZE);
-      printf("Debug: Read %d bytes: '%s'\n", valread, buffer);
-      if (valread <= 0) {
-        // Client disconnected
-        close(new_socket);
-        printf("Client disconnected\n");
-        break;
-      }
-
-      // Remove newline at end if present
-      // Remove newline at end if present
-      if (valread > 0 && buffer[valread - 1] == '\n') {
-        buffer[valread - 1] = '\0';
-        valread--;
-      }
-      if (valread > 0 && buffer[valread - 1] == '\r') {
-        buffer[valread - 1] = '\0';
-        valread--;
-      }
-
-      // Copy to input buffer
-      // Note: input_buffer->buffer is usually managed by getline, but here we
-      // manually set it We need to ensure input_buffer->buffer is large enough
-      // or realloc For simplicity, let's just use strncpy if it fits, or
-      // realloc Our InputBuffer struct has buffer and buffer_length. Let's just
-      // use the buffer directly or update InputBuffer. Actually,
-      // prepare_statement uses input_buffer->buffer.
-
-      // Let's resize input_buffer if needed
-      if (input_buffer->buffer_length < (size_t)valread + 1) {
-        input_buffer->buffer = realloc(input_buffer->buffer, valread + 1);
-        input_buffer->buffer_length = valread + 1;
-      }
-      strcpy(input_buffer->buffer, buffer);
-      input_buffer->input_length = strlen(buffer);
-
-      // Handle Meta Commands
-      if (input_buffer->buffer[0] == '.') {
-        switch (do_meta_command(input_buffer, table, new_socket)) {
-        case META_COMMAND_SUCCESS:
-          // .exit means disconnect client, not shutdown server
-          if (strcmp(input_buffer->buffer, ".exit") == 0) {
-            close(new_socket);
-            goto client_disconnected;
-          }
-          continue;
-        case META_COMMAND_UNRECOGNIZED_COMMAND:
-          dprintf(new_socket, "Unrecognized command '%s'\n",
-                  input_buffer->buffer);
-          continue;
-        }
-      }
-
-      Statement statement;
-      switch (prepare_statement(input_buffer, &statement)) {
-      case PREPARE_SUCCESS:
-        break;
-      case PREPARE_NEGATIVE_ID:
-        dprintf(new_socket, "ID must be positive.\n");
-        continue;
-      case PREPARE_STRING_TOO_LONG:
-        dprintf(new_socket, "String is too long.\n");
-        continue;
-      case PREPARE_SYNTAX_ERROR:
-        dprintf(new_socket, "Syntax error. Could not parse statement.\n");
-        continue;
-      case PREPARE_UNRECOGNIZED_STATEMENT:
-        dprintf(new_socket, "Unrecognized keyword at start of '%s'.\n",
-                input_buffer->buffer);
-        continue;
-      }
-      printf("Debug: Calling execute_statement\n");
-      fflush(stdout);
-
-      switch (execute_statement(&statement, table, new_socket)) {
-      case EXECUTE_SUCCESS:
-        dprintf(new_socket, "Executed.\n");
-        break;
-      case EXECUTE_DUPLICATE_KEY:
-        dprintf(new_socket, "Error: Duplicate key.\n");
-        break;
-      case EXECUTE_TABLE_FULL:
-        dprintf(new_socket, "Error: Table full.\n");
-        break;
-      }
+    Session *session = malloc(sizeof(Session));
+    db_open_session(session, table, new_socket);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, serve_client, session) != 0) {
+      perror("pthread_create");
+      close(new_socket);
+      free(session);
+      continue;
     }
-  client_disconnected:;
+    pthread_detach(thread);
   }
 }
@@ -3,21 +3,101 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #define size_of_attribute(Struct, Attribute) sizeof(((Struct *)0)->Attribute)
 
-const uint32_t ROWS_PER_PAGE = PAGE_SIZE / ROW_SIZE;
-const uint32_t TABLE_MAX_ROWS = ROWS_PER_PAGE * TABLE_MAX_PAGES;
+// Opens filename as a Table with no tables of its own; db_open() fills in
+// the catalog
+static Table *table_file_open(const char *filename, PagerOptions *options) {
+  Pager *pager = pager_open(filename, options);
 
-Table *db_open(const char *filename) {
-  Pager *pager = pager_open(filename);
-
-  Table *table = malloc(sizeof(Table));
+  Table *table = calloc(1, sizeof(Table));
   table->pager = pager;
   table->num_rows = 0; // Unused mostly
-  table->in_transaction = false;
+  table->filename = strdup(filename);
+  table->options = *options;
+
+  table->warm_path = NULL;
+  if (options->warm_up) {
+    table->warm_path = malloc(strlen(filename) + sizeof(WARM_LIST_SUFFIX));
+    strcpy(table->warm_path, filename);
+    strcat(table->warm_path, WARM_LIST_SUFFIX);
+    pager_warm_up(pager, table->warm_path);
+  }
+  return table;
+}
+
+static void table_file_close(Table *table) {
+  if (table->warm_path != NULL) {
+    pager_save_warm_list(table->pager, table->warm_path);
+    free(table->warm_path);
+  }
+  pager_close(table->pager);
+  free(table->filename);
+  free(table);
+}
+
+static char *table_file_path(Table *table, const char *name) {
+  size_t length = strlen(table->filename) + 1 + strlen(name) +
+                  sizeof(TABLE_FILE_SUFFIX);
+  char *path = malloc(length);
+  sprintf(path, "%s.%s%s", table->filename, name, TABLE_FILE_SUFFIX);
+  return path;
+}
+
+// Opens the file of a table in file-per-table mode, creating it if needed
+static Table *table_space_open(Table *table, TableInfo *info) {
+  char *path = table_file_path(table, info->name);
+  // Table files share the catalog's page size
+  PagerOptions options = table->options;
+  options.page_size = table->pager->page_size;
+  Table *space = table_file_open(path, &options);
+  free(path);
+
+  Pager *pager = space->pager;
+  if (pager->num_pages == 0) {
+    pager_begin_statement(pager);
+    void *meta_page = get_page(pager, 0);
+    *(uint32_t *)((char *)meta_page + META_PAGE_SIZE_OFFSET) =
+        pager->page_size;
+    pager_mark_dirty(pager, 0);
+
+    void *root = get_page(pager, TABLE_FILE_ROOT_PAGE);
+    initialize_leaf_node(root);
+    set_node_root(root, true);
+    pager_mark_dirty(pager, TABLE_FILE_ROOT_PAGE);
+
+    if (strcmp(info->name, "users") == 0) {
+      void *index_root = get_page(pager, 2);
+      initialize_leaf_node(index_root);
+      set_node_root(index_root, true);
+      pager_mark_dirty(pager, 2);
+    }
+    pager_flush_all(pager);
+    pager_end_statement(pager);
+  } else if (pager->page_size != table->pager->page_size) {
+    printf("Table file for '%s' has a different page size.\n", info->name);
+    exit(EXIT_FAILURE);
+  }
+  return space;
+}
+
+// Reads the catalog from the Directory Page
+static void db_load_directory(Table *table) {
+  Pager *pager = table->pager;
+  void *dir_page = get_page(pager, table->directory_root_page_num);
+  table->num_tables = *(uint32_t *)((char *)dir_page + pager->page_size - 4);
+  memcpy(table->tables, (char *)dir_page,
+         sizeof(TableInfo) * table->num_tables);
+}
+
+Table *db_open(const char *filename, PagerOptions *options) {
+  Table *table = table_file_open(filename, options);
+  Pager *pager = table->pager;
 
+  pager_begin_statement(pager);
   if (pager->num_pages == 0) {
     // New database file. Initialize page 0 as Meta Page.
     // Page 1: Main Table (users) Root
@@ -48,6 +128,11 @@ Table *db_open(const char *filename) {
     *(uint32_t *)((char *)meta_page + 4) = 2;  // Index Root
     *(uint32_t *)((char *)meta_page + 8) = 3;  // Orders Root
     *(uint32_t *)((char *)meta_page + 12) = 4; // Directory Root
+    *(uint32_t *)((char *)meta_page + META_PAGE_SIZE_OFFSET) =
+        pager->page_size;
+    *(uint32_t *)((char *)meta_page + META_FILE_PER_TABLE_OFFSET) =
+        options->file_per_table;
+    table->file_per_table = options->file_per_table;
 
     table->directory_root_page_num = 4;
 
@@ -109,14 +194,14 @@ Table *db_open(const char *filename) {
     // Write defaults to Page 4
     memcpy((char *)directory_root_node, table->tables,
            sizeof(TableInfo) * table->num_tables);
-    *(uint32_t *)((char *)directory_root_node + PAGE_SIZE - 4) =
+    *(uint32_t *)((char *)directory_root_node + pager->page_size - 4) =
         table->num_tables; // Store count at end
 
-    pager_flush(pager, 0, PAGE_SIZE);
-    pager_flush(pager, 1, PAGE_SIZE);
-    pager_flush(pager, 2, PAGE_SIZE);
-    pager_flush(pager, 3, PAGE_SIZE);
-    pager_flush(pager, 4, PAGE_SIZE);
+    pager_flush(pager, 0, pager->page_size);
+    pager_flush(pager, 1, pager->page_size);
+    pager_flush(pager, 2, pager->page_size);
+    pager_flush(pager, 3, pager->page_size);
+    pager_flush(pager, 4, pager->page_size);
 
   } else {
     // Existing database
@@ -126,6 +211,8 @@ Table *db_open(const char *filename) {
 
     // Load Directory Root
     table->directory_root_page_num = *(uint32_t *)((char *)meta_page + 12);
+    table->file_per_table =
+        *(uint32_t *)((char *)meta_page + META_FILE_PER_TABLE_OFFSET) != 0;
     if (table->directory_root_page_num == 0) {
       // Migration for existing DBs that didn't have directory
       table->directory_root_page_num = 4;
@@ -168,20 +255,38 @@ Table *db_open(const char *filename) {
       void *dir_page = get_page(pager, 4);
       memcpy((char *)dir_page, table->tables,
              sizeof(TableInfo) * table->num_tables);
-      *(uint32_t *)((char *)dir_page + PAGE_SIZE - 4) = table->num_tables;
+      *(uint32_t *)((char *)dir_page + pager->page_size - 4) =
+          table->num_tables;
 
       *(uint32_t *)((char *)meta_page + 12) = 4; // Update meta
-      pager_flush(pager, 0, PAGE_SIZE);
-      pager_flush(pager, 4, PAGE_SIZE);
+      pager_flush(pager, 0, pager->page_size);
+      pager_flush(pager, 4, pager->page_size);
     } else {
-      // Load from Directory Page
-      void *dir_page = get_page(pager, table->directory_root_page_num);
-      table->num_tables = *(uint32_t *)((char *)dir_page + PAGE_SIZE - 4);
-      memcpy(table->tables, (char *)dir_page,
-             sizeof(TableInfo) * table->num_tables);
+      db_load_directory(table);
+    }
+  }
+  pager_end_statement(pager);
+
+  if (table->file_per_table) {
+    for (uint32_t i = 0; i < table->num_tables; i++) {
+      table->spaces[i] = table_space_open(table, &table->tables[i]);
     }
   }
 
+  table->locks = malloc(sizeof(LockTable));
+  lock_table_init(table->locks);
+
+  table->sync_mode = SYNC_OFF;
+  table->syncer_running = false;
+  table->syncer_stop = false;
+  pthread_mutex_init(&table->syncer_control, NULL);
+  pthread_mutex_init(&table->syncer_lock, NULL);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&table->syncer_wake, &attr);
+  pthread_condattr_destroy(&attr);
+
   return table;
 }
 
@@ -194,29 +299,24 @@ TableInfo *find_table(Table *table, const char *name) {
   return NULL;
 }
 
-void db_close(Table *table) {
-  Pager *pager = table->pager;
-
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-    if (pager->pages[i]) {
-      pager_flush(pager, i, PAGE_SIZE);
-      free(pager->pages[i]);
-      pager->pages[i] = NULL;
-    }
-  }
-
-  // Explicitly flush page 0 if it wasn't in the cache (though it should be if
-  // we opened it) Actually, the loop above covers it if it's in pager->pages.
-  // But let's make sure we update the root page numbers in the meta page before
-  // flushing. We need to write table->main_root_page_num and
-  // table->index_root_page_num to page 0.
+/*
+ * Reads the catalog again after its pages were replaced underneath it, as
+ * a replica does with the primary's commits. Called inside a statement.
+ */
+void db_reload_catalog(Table *table) {
+  void *meta_page = get_page(table->pager, 0);
+  table->directory_root_page_num = *(uint32_t *)((char *)meta_page + 12);
+  db_load_directory(table);
+}
 
-  // Flush Directory Page
+// Copies the in-memory directory to the Directory Page and Meta Page
+static void db_save_catalog(Table *table) {
+  Pager *pager = table->pager;
   void *dir_page = get_page(pager, table->directory_root_page_num);
+  pager_mark_dirty(pager, table->directory_root_page_num);
   memcpy((char *)dir_page, table->tables,
          sizeof(TableInfo) * table->num_tables);
-  *(uint32_t *)((char *)dir_page + PAGE_SIZE - 4) = table->num_tables;
-  pager_flush(pager, table->directory_root_page_num, PAGE_SIZE);
+  *(uint32_t *)((char *)dir_page + pager->page_size - 4) = table->num_tables;
 
   void *meta_page = get_page(pager, 0);
   // We don't strictly need to update these legacy fields if we use directory,
@@ -224,30 +324,412 @@ void db_close(Table *table) {
   // table->main_root_page_num is gone from struct, so we can't.
   // Just update directory root.
   *(uint32_t *)((char *)meta_page + 12) = table->directory_root_page_num;
+  *(uint32_t *)((char *)meta_page + META_PAGE_SIZE_OFFSET) = pager->page_size;
+  pager_mark_dirty(pager, 0);
+}
 
-  // Now flush page 0 again to be sure
-  pager_flush(pager, 0, PAGE_SIZE);
+void db_close(Table *table) {
+  db_set_sync_mode(table, SYNC_OFF);
+  pthread_mutex_destroy(&table->syncer_control);
+  pthread_mutex_destroy(&table->syncer_lock);
+  pthread_cond_destroy(&table->syncer_wake);
 
-  int result = close(pager->file_descriptor);
-  if (result == -1) {
-    printf("Error closing db file.\n");
-    exit(EXIT_FAILURE);
+  // Update the catalog, then write back the whole cache
+  pager_begin_statement(table->pager);
+  db_save_catalog(table);
+  pager_end_statement(table->pager);
+
+  for (uint32_t i = 0; i < table->num_tables; i++) {
+    if (table->spaces[i] != NULL) {
+      table_file_close(table->spaces[i]);
+    }
   }
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-    void *page = pager->pages[i];
-    if (page) {
-      free(page);
-      pager->pages[i] = NULL;
+  lock_table_destroy(table->locks);
+  free(table->locks);
+  table_file_close(table);
+}
+
+// The Table whose pager holds info's tree: its own file, or the database
+Table *table_space(Table *table, TableInfo *info) {
+  Table *space = table->spaces[info - table->tables];
+  return space != NULL ? space : table;
+}
+
+/*
+ * Gives a table that was just added to the directory its file. Called from
+ * inside a statement, so the new pager joins the statement. The file is set
+ * up outside the open transaction, if any, which only covers what is put
+ * into it afterwards.
+ */
+void table_space_create(Table *table, TableInfo *info) {
+  Transaction *transaction = lock_current();
+  lock_set_current(NULL);
+  Table *space = table_space_open(table, info);
+  lock_set_current(transaction);
+  pager_begin_statement(space->pager);
+  table->spaces[info - table->tables] = space;
+  info->root_page_num = TABLE_FILE_ROOT_PAGE;
+}
+
+// Closes and deletes a table's file. The caller removes it from the
+// directory.
+void table_space_drop(Table *table, TableInfo *info) {
+  Table *space = table->spaces[info - table->tables];
+  table->spaces[info - table->tables] = NULL;
+
+  char *path = strdup(space->filename);
+  char *warm_path = space->warm_path != NULL ? strdup(space->warm_path) : NULL;
+  pager_end_statement(space->pager);
+  table_file_close(space);
+  unlink(path);
+  if (warm_path != NULL) {
+    unlink(warm_path);
+  }
+  free(path);
+  free(warm_path);
+}
+
+/*
+ * Statement gate, flushing and transactions cover the catalog and every
+ * table file, always in that order so two callers cannot deadlock. A
+ * statement waiting for a page lock leaves the gate and enters it again, see
+ * lock_page().
+ */
+void db_begin_statement(Table *table) {
+  pager_begin_statement(table->pager);
+  for (uint32_t i = 0; i < table->num_tables; i++) {
+    if (table->spaces[i] != NULL) {
+      pager_begin_statement(table->spaces[i]->pager);
     }
   }
-  free(pager);
-  free(table);
+}
+
+void db_end_statement(Table *table) {
+  for (uint32_t i = 0; i < table->num_tables; i++) {
+    if (table->spaces[i] != NULL) {
+      pager_end_statement(table->spaces[i]->pager);
+    }
+  }
+  pager_end_statement(table->pager);
+}
+
+/*
+ * Writes every change back, called inside a statement. The catalog goes with
+ * the pages, so a commit never lacks a new table. Table files are made
+ * durable here; the catalog file's log is left to db_wait_for_commit() with
+ * the LSN returned, which may be called once the statement is over.
+ */
+uint64_t db_flush_commit(Table *table) {
+  db_save_catalog(table);
+  uint64_t lsn = pager_commit(table->pager);
+  for (uint32_t i = 0; i < table->num_tables; i++) {
+    if (table->spaces[i] != NULL) {
+      pager_flush_all(table->spaces[i]->pager);
+    }
+  }
+  return lsn;
+}
+
+void db_wait_for_commit(Table *table, uint64_t lsn) {
+  pager_wait_for_commit(table->pager, lsn);
+}
+
+void db_flush_all(Table *table) {
+  db_wait_for_commit(table, db_flush_commit(table));
+}
+
+static void db_end_transaction(Table *table, Transaction *transaction,
+                               bool commit) {
+  // What the pagers do from here on is not part of the transaction
+  lock_set_current(NULL);
+  pager_end_transaction(table->pager, transaction->id, commit);
+  for (uint32_t i = 0; i < table->num_tables; i++) {
+    if (table->spaces[i] != NULL) {
+      pager_end_transaction(table->spaces[i]->pager, transaction->id, commit);
+    }
+  }
+  lock_release_all(transaction);
+}
+
+/*
+ * Ends a transaction, inside its last statement. A durable commit also
+ * writes every change back, as COMMIT does (a log commit in WAL mode), and
+ * returns the LSN to pass to db_wait_for_commit(); an autocommitted
+ * statement leaves that to the synchronous mode.
+ */
+uint64_t db_commit(Table *table, Transaction *transaction, bool durable) {
+  db_end_transaction(table, transaction, true);
+  return durable ? db_flush_commit(table) : 0;
+}
+
+void db_rollback(Table *table, Transaction *transaction) {
+  db_end_transaction(table, transaction, false);
+}
+
+// Called inside a statement that moves pages or closes table files
+void db_wait_for_transactions(Table *table) {
+  lock_wait_until_idle(table->locks, table);
+}
+
+void db_open_session(Session *session, Table *table, int out_fd) {
+  session->table = table;
+  session->out_fd = out_fd;
+  session->in_transaction = false;
+  session->commit_lsn = 0;
+}
+
+// A transaction the session leaves open is rolled back
+void db_close_session(Session *session) {
+  if (!session->in_transaction) {
+    return;
+  }
+  db_begin_statement(session->table);
+  db_rollback(session->table, &session->transaction);
+  db_end_statement(session->table);
+  session->in_transaction = false;
+}
+
+// Called inside a statement, see db_begin_snapshot()
+Table *db_snapshot(Table *table) {
+  Table *snapshot = malloc(sizeof(Table));
+  *snapshot = *table;
+  pager_begin_snapshot(table->pager);
+  for (uint32_t i = 0; i < table->num_tables; i++) {
+    if (table->spaces[i] != NULL) {
+      pager_begin_snapshot(table->spaces[i]->pager);
+    }
+  }
+  return snapshot;
+}
+
+/*
+ * Starts a snapshot read: returns a copy of the Table with the catalog as it
+ * is now, whose pagers serve the calling thread pages as of the last commit
+ * until db_end_snapshot(). Waits only for a statement that is running, never
+ * for an open transaction.
+ */
+Table *db_begin_snapshot(Table *table) {
+  db_begin_statement(table);
+  Table *snapshot = db_snapshot(table);
+  db_end_statement(table);
+  return snapshot;
+}
+
+void db_end_snapshot(Table *snapshot) {
+  for (uint32_t i = 0; i < snapshot->num_tables; i++) {
+    if (snapshot->spaces[i] != NULL) {
+      pager_end_snapshot(snapshot->spaces[i]->pager);
+    }
+  }
+  pager_end_snapshot(snapshot->pager);
+  free(snapshot);
+}
+
+/*
+ * .backup: copies the database to path while other sessions go on working,
+ * see pager_backup(). The copy is the database as of the last commit before
+ * the command. Table files are copied beside it, named as they would be for
+ * a database at path.
+ */
+void db_backup(Table *table, const char *path, int out_fd) {
+  if (table->pager->page_map != NULL) {
+    dprintf(out_fd, "Error: Compressed databases cannot be backed up.\n");
+    return;
+  }
+  db_begin_statement(table);
+  db_flush_all(table);
+  pager_begin_backup(table->pager);
+  for (uint32_t i = 0; i < table->num_tables; i++) {
+    if (table->spaces[i] != NULL) {
+      pager_begin_backup(table->spaces[i]->pager);
+    }
+  }
+  Table *snapshot = db_snapshot(table);
+  db_end_statement(table);
+
+  uint32_t pages, recopied;
+  bool written = pager_backup(snapshot->pager, path, &pages, &recopied);
+  for (uint32_t i = 0; i < snapshot->num_tables; i++) {
+    if (snapshot->spaces[i] == NULL) {
+      continue;
+    }
+    const char *name = snapshot->tables[i].name;
+    char *space_path =
+        malloc(strlen(path) + 1 + strlen(name) + sizeof(TABLE_FILE_SUFFIX));
+    sprintf(space_path, "%s.%s%s", path, name, TABLE_FILE_SUFFIX);
+    uint32_t space_pages, space_recopied;
+    // Every file is copied, so that none is left tracking writes
+    if (!pager_backup(snapshot->spaces[i]->pager, space_path, &space_pages,
+                      &space_recopied)) {
+      written = false;
+    }
+    pages += space_pages;
+    recopied += space_recopied;
+    free(space_path);
+  }
+  db_end_snapshot(snapshot);
+
+  if (written) {
+    dprintf(out_fd, "Backup written: %u pages, %u copied again.\n", pages,
+            recopied);
+  } else {
+    dprintf(out_fd, "Error: Unable to write backup '%s'.\n", path);
+  }
+}
+
+/*
+ * Called inside a statement that moves pages or closes table files. Every
+ * snapshot includes the catalog, and no new one can start meanwhile.
+ */
+void db_wait_for_snapshots(Table *table) {
+  pager_wait_for_snapshots(table->pager);
+}
+
+static uint64_t monotonic_us(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// True if any file has changes that were not synced yet
+static bool db_unsynced(Table *table) {
+  if (table->pager->unsynced) {
+    return true;
+  }
+  for (uint32_t i = 0; i < table->num_tables; i++) {
+    if (table->spaces[i] != NULL && table->spaces[i]->pager->unsynced) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Makes every file durable. Called inside a statement.
+static void db_sync(Table *table) {
+  db_save_catalog(table);
+  pager_sync(table->pager);
+  for (uint32_t i = 0; i < table->num_tables; i++) {
+    if (table->spaces[i] != NULL) {
+      pager_sync(table->spaces[i]->pager);
+    }
+  }
+  table->unsynced_statements = 0;
+}
+
+/*
+ * Called at the end of every statement, still inside it, to apply the
+ * synchronous mode. A session's open transaction is left to COMMIT; those of
+ * other sessions are never written early anyway.
+ */
+void db_statement_done(Table *table, bool in_transaction) {
+  if (table->sync_mode == SYNC_OFF || in_transaction || !db_unsynced(table)) {
+    return;
+  }
+  if (table->sync_mode == SYNC_FULL) {
+    db_sync(table);
+    return;
+  }
+
+  uint64_t now = monotonic_us();
+  if (table->unsynced_statements++ == 0) {
+    table->first_unsynced_us = now;
+  }
+  if (table->unsynced_statements >= SYNC_NORMAL_STATEMENTS ||
+      now - table->first_unsynced_us >= SYNC_NORMAL_INTERVAL_MS * 1000ull) {
+    db_sync(table);
+  }
+}
+
+/*
+ * NORMAL mode: a session that goes quiet still gets its last statements
+ * synced once they are SYNC_NORMAL_INTERVAL_MS old. Checks ten times per
+ * interval.
+ */
+static void *db_syncer_thread(void *arg) {
+  Table *table = arg;
+
+  pthread_mutex_lock(&table->syncer_lock);
+  while (!table->syncer_stop) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += SYNC_NORMAL_INTERVAL_MS / 10 * 1000000l;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000l;
+    deadline.tv_nsec %= 1000000000l;
+    pthread_cond_timedwait(&table->syncer_wake, &table->syncer_lock,
+                           &deadline);
+    if (table->syncer_stop) {
+      break;
+    }
+
+    pthread_mutex_unlock(&table->syncer_lock);
+    db_begin_statement(table);
+    if (table->unsynced_statements > 0 &&
+        monotonic_us() - table->first_unsynced_us >=
+            SYNC_NORMAL_INTERVAL_MS * 1000ull) {
+      db_sync(table);
+    }
+    db_end_statement(table);
+    pthread_mutex_lock(&table->syncer_lock);
+  }
+  pthread_mutex_unlock(&table->syncer_lock);
+  return NULL;
+}
+
+// Called between statements, by any session. Changes made so far get the
+// new mode's guarantee right away.
+void db_set_sync_mode(Table *table, SyncMode mode) {
+  // The syncer takes the gate, so it is joined with only syncer_control held
+  pthread_mutex_lock(&table->syncer_control);
+  pthread_mutex_lock(&table->syncer_lock);
+  bool running = table->syncer_running;
+  if (running) {
+    table->syncer_stop = true;
+    pthread_cond_signal(&table->syncer_wake);
+  }
+  pthread_mutex_unlock(&table->syncer_lock);
+  if (running) {
+    pthread_join(table->syncer_thread, NULL);
+    pthread_mutex_lock(&table->syncer_lock);
+    table->syncer_running = false;
+    pthread_mutex_unlock(&table->syncer_lock);
+  }
+
+  db_begin_statement(table);
+  table->sync_mode = mode;
+  if (mode != SYNC_OFF && db_unsynced(table)) {
+    db_sync(table);
+  }
+  table->unsynced_statements = 0;
+  db_end_statement(table);
+
+  if (mode == SYNC_NORMAL) {
+    pthread_mutex_lock(&table->syncer_lock);
+    table->syncer_stop = false;
+    if (pthread_create(&table->syncer_thread, NULL, db_syncer_thread,
+                       table) == 0) {
+      table->syncer_running = true;
+    }
+    pthread_mutex_unlock(&table->syncer_lock);
+  }
+  pthread_mutex_unlock(&table->syncer_control);
+}
+
+const char *sync_mode_name(SyncMode mode) {
+  switch (mode) {
+  case SYNC_NORMAL:
+    return "normal";
+  case SYNC_FULL:
+    return "full";
+  default:
+    return "off";
+  }
 }
 
 void *row_slot(Table *table, uint32_t row_num) {
-  uint32_t page_num = row_num / ROWS_PER_PAGE;
+  uint32_t rows_per_page = table->pager->page_size / ROW_SIZE;
+  uint32_t page_num = row_num / rows_per_page;
   void *page = get_page(table->pager, page_num);
-  uint32_t row_offset = row_num % ROWS_PER_PAGE;
+  uint32_t row_offset = row_num % rows_per_page;
   uint32_t byte_offset = row_offset * ROW_SIZE;
   return (char *)page + byte_offset;
 }
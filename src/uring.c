@@ -0,0 +1,244 @@
+#include "uring.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+struct IoRing {
+  int ring_fd;
+  uint32_t sq_entries;
+
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ptr;
+  size_t sq_size;
+  void *cq_ptr;
+  size_t cq_size;
+  size_t sqes_size;
+};
+
+IoRing *io_ring_open(uint32_t entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  int ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (ring_fd < 0) {
+    return NULL;
+  }
+
+  IoRing *ring = calloc(1, sizeof(IoRing));
+  ring->ring_fd = ring_fd;
+  ring->sq_entries = params.sq_entries;
+
+  ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_size > ring->sq_size) {
+      ring->sq_size = ring->cq_size;
+    }
+    ring->cq_size = ring->sq_size;
+  }
+
+  ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ptr == MAP_FAILED) {
+    close(ring_fd);
+    free(ring);
+    return NULL;
+  }
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_ptr = ring->sq_ptr;
+  } else {
+    ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ptr == MAP_FAILED) {
+      munmap(ring->sq_ptr, ring->sq_size);
+      close(ring_fd);
+      free(ring);
+      return NULL;
+    }
+  }
+
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    if (ring->cq_ptr != ring->sq_ptr) {
+      munmap(ring->cq_ptr, ring->cq_size);
+    }
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring_fd);
+    free(ring);
+    return NULL;
+  }
+
+  char *sq = ring->sq_ptr;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+
+  char *cq = ring->cq_ptr;
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  return ring;
+}
+
+void io_ring_close(IoRing *ring) {
+  if (ring == NULL) {
+    return;
+  }
+  munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ptr != ring->sq_ptr) {
+    munmap(ring->cq_ptr, ring->cq_size);
+  }
+  munmap(ring->sq_ptr, ring->sq_size);
+  close(ring->ring_fd);
+  free(ring);
+}
+
+static void io_ring_push(IoRing *ring, IoRequest *request, uint64_t index) {
+  unsigned tail = *ring->sq_tail;
+  unsigned slot = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[slot];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = request->write ? IORING_OP_WRITEV : IORING_OP_READV;
+  sqe->fd = request->fd;
+  sqe->addr = (uint64_t)(uintptr_t)request->iov;
+  sqe->len = request->iovcnt;
+  sqe->off = request->offset;
+  sqe->user_data = index;
+
+  ring->sq_array[slot] = slot;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static uint32_t io_ring_reap(IoRing *ring, IoRequest *requests) {
+  uint32_t reaped = 0;
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    requests[cqe->user_data].result = cqe->res;
+    requests[cqe->user_data].done = true;
+    head++;
+    reaped++;
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  return reaped;
+}
+
+/*
+ * Gives up on the ring after io_uring_enter() failed. Entries the kernel has
+ * not taken yet are withdrawn, and those it has are waited for, since they
+ * still read or write the callers' buffers. Completions come back in any
+ * order, so the requests still without a result are then redone one by one.
+ */
+static void io_ring_abandon(IoRing *ring, IoRequest *requests,
+                            uint32_t count, unsigned batch_start,
+                            uint32_t completed) {
+  unsigned taken = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  __atomic_store_n(ring->sq_tail, taken, __ATOMIC_RELEASE);
+  uint32_t in_flight = taken - batch_start;
+
+  while (completed < in_flight) {
+    uint32_t reaped = io_ring_reap(ring, requests);
+    completed += reaped;
+    if (reaped == 0 && completed < in_flight &&
+        syscall(__NR_io_uring_enter, ring->ring_fd, 0, in_flight - completed,
+                IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+        errno != EINTR) {
+      // Completions still land in the queue; poll for them instead
+      struct timespec pause = {0, 1000000};
+      nanosleep(&pause, NULL);
+    }
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    IoRequest *request = &requests[i];
+    if (request->done) {
+      continue;
+    }
+    ssize_t result =
+        request->write ? pwritev(request->fd, request->iov, request->iovcnt,
+                                 request->offset)
+                       : preadv(request->fd, request->iov, request->iovcnt,
+                                request->offset);
+    request->result = result == -1 ? -errno : result;
+    request->done = true;
+  }
+}
+
+void io_ring_run(IoRing *ring, IoRequest *requests, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    requests[i].done = false;
+  }
+
+  uint32_t submitted = 0;
+  while (submitted < count) {
+    uint32_t batch = count - submitted;
+    if (batch > ring->sq_entries) {
+      batch = ring->sq_entries;
+    }
+    unsigned batch_start = *ring->sq_tail;
+    for (uint32_t i = 0; i < batch; i++) {
+      io_ring_push(ring, &requests[submitted + i], submitted + i);
+    }
+
+    uint32_t to_submit = batch;
+    uint32_t completed = 0;
+    while (completed < batch) {
+      int ret = syscall(__NR_io_uring_enter, ring->ring_fd, to_submit,
+                        batch - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+      if (ret < 0 && errno != EINTR) {
+        io_ring_abandon(ring, requests, count, batch_start, completed);
+        return;
+      }
+      if (ret > 0) {
+        to_submit -= (uint32_t)ret < to_submit ? (uint32_t)ret : to_submit;
+      }
+      completed += io_ring_reap(ring, requests);
+    }
+    submitted += batch;
+  }
+}
+
+#else
+
+IoRing *io_ring_open(uint32_t entries) {
+  (void)entries;
+  return NULL;
+}
+
+void io_ring_close(IoRing *ring) { (void)ring; }
+
+void io_ring_run(IoRing *ring, IoRequest *requests, uint32_t count) {
+  (void)ring;
+  (void)requests;
+  (void)count;
+}
+
+#endif
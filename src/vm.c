@@ -2,6 +2,7 @@
 #include "cursor.h"
 #include "node.h"
 #include "table.h"
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,6 +27,39 @@ void deserialize_order_row(void *source, OrderRow *destination) {
 // Helper to print to fd
 void print_msg(int fd, const char *msg) { write(fd, msg, strlen(msg)); }
 
+/*
+ * Memory the running statement owns. A deadlock unwinds the statement with
+ * longjmp() past its free() calls, so execute_statement() frees what is left.
+ */
+#define STATEMENT_ALLOCS 16
+static __thread void *statement_allocs[STATEMENT_ALLOCS];
+static __thread uint32_t statement_alloc_count;
+
+static void *statement_own(void *ptr) {
+  if (statement_alloc_count == STATEMENT_ALLOCS) {
+    printf("Too many allocations in one statement (%d)\n", STATEMENT_ALLOCS);
+    exit(EXIT_FAILURE);
+  }
+  statement_allocs[statement_alloc_count++] = ptr;
+  return ptr;
+}
+
+static void statement_free(void *ptr) {
+  for (uint32_t i = statement_alloc_count; i > 0; i--) {
+    if (statement_allocs[i - 1] == ptr) {
+      statement_allocs[i - 1] = statement_allocs[--statement_alloc_count];
+      break;
+    }
+  }
+  free(ptr);
+}
+
+static void statement_free_all(void) {
+  while (statement_alloc_count > 0) {
+    free(statement_allocs[--statement_alloc_count]);
+  }
+}
+
 void print_row(Row *row, int out_fd) {
   dprintf(out_fd, "(%d, %s, %s)\n", row->id, row->username, row->email);
 }
@@ -36,6 +70,8 @@ ExecuteResult execute_insert(Statement *statement, Table *table, int out_fd) {
     dprintf(out_fd, "Error: Table '%s' not found.\n", statement->table_name);
     return EXECUTE_TABLE_FULL; // Reuse error code or add new one
   }
+  // From here on the table's own file, if it has one
+  table = table_space(table, table_info);
 
   void *node = get_page(table->pager, table_info->root_page_num);
   uint32_t num_cells = *leaf_node_num_cells(node);
@@ -48,7 +84,7 @@ ExecuteResult execute_insert(Statement *statement, Table *table, int out_fd) {
   }
 
   // Allocate buffer for row
-  char *row_data = malloc(row_size);
+  char *row_data = statement_own(malloc(row_size));
   memset(row_data, 0, row_size);
 
   uint32_t key_to_insert = 0; // Default key is first column if INT
@@ -65,7 +101,8 @@ ExecuteResult execute_insert(Statement *statement, Table *table, int out_fd) {
       table_info->columns[0].type == COLUMN_INT) {
 
     // Find max ID
-    Cursor *end_cursor = table_end(table, table_info->root_page_num);
+    Cursor *end_cursor =
+        statement_own(table_end(table, table_info->root_page_num));
     uint32_t max_id = 0;
 
     if (end_cursor->cell_num > 0) {
@@ -79,7 +116,7 @@ ExecuteResult execute_insert(Statement *statement, Table *table, int out_fd) {
       void *key_ptr = leaf_node_key(node, last_cell_index, cell_size);
       memcpy(&max_id, key_ptr, sizeof(uint32_t));
     }
-    free(end_cursor);
+    statement_free(end_cursor);
 
     key_to_insert = max_id + 1;
 
@@ -105,7 +142,7 @@ ExecuteResult execute_insert(Statement *statement, Table *table, int out_fd) {
   } else if (num_values != table_info->num_columns) {
     dprintf(out_fd, "Error: Column count mismatch. Expected %d, got %d.\n",
             table_info->num_columns, num_values);
-    free(row_data);
+    statement_free(row_data);
     return EXECUTE_TABLE_FULL; // Reuse error code for now
   } else {
     // Normal Insert
@@ -125,23 +162,25 @@ ExecuteResult execute_insert(Statement *statement, Table *table, int out_fd) {
     }
   }
 
-  Cursor *cursor = table_find(table, table_info->root_page_num, &key_to_insert,
-                              sizeof(uint32_t), KEY_INT);
+  Cursor *cursor =
+      statement_own(table_find(table, table_info->root_page_num,
+                               &key_to_insert, sizeof(uint32_t), row_size,
+                               KEY_INT));
 
   if (cursor->cell_num < num_cells) {
     uint32_t key_at_index = *(uint32_t *)leaf_node_key(
         cursor_value(cursor), cursor->cell_num, KEY_INT);
     if (key_at_index == key_to_insert) {
-      free(row_data);
-      free(cursor);
+      statement_free(row_data);
+      statement_free(cursor);
       return EXECUTE_DUPLICATE_KEY;
     }
   }
 
   leaf_node_insert(cursor, &key_to_insert, sizeof(uint32_t), row_data, row_size,
                    KEY_INT);
-  free(row_data);
-  free(cursor);
+  statement_free(row_data);
+  statement_free(cursor);
 
   // Insert into Secondary Index (Username) - ONLY FOR DEFAULT USERS TABLE FOR
   // NOW Or if we had a way to know if table has index. For now, let's keep
@@ -155,18 +194,56 @@ ExecuteResult execute_insert(Statement *statement, Table *table, int out_fd) {
       memset(username_buf, 0, 33);
       strncpy(username_buf, username, 32);
 
-      Cursor *index_cursor = table_find(table, 2, username_buf, 32,
-                                        KEY_STRING); // 32 is USERNAME_SIZE
+      Cursor *index_cursor = statement_own(
+          table_find(table, 2, username_buf, 32, USERNAME_INDEX_VALUE_SIZE,
+                     KEY_STRING)); // 32 is USERNAME_SIZE
 
       leaf_node_insert(index_cursor, username_buf, 32, &key_to_insert,
                        sizeof(uint32_t), KEY_STRING);
-      free(index_cursor);
+      statement_free(index_cursor);
     }
   }
 
   return EXECUTE_SUCCESS;
 }
 
+uint32_t table_row_size(TableInfo *table_info) {
+  uint32_t row_size = 0;
+  for (uint32_t i = 0; i < table_info->num_columns; i++)
+    row_size += table_info->columns[i].size;
+  return row_size;
+}
+
+// Evaluates the statement's WHERE clause against a serialized row
+int row_matches_where(TableInfo *table_info, void *row_data,
+                      Statement *statement) {
+  for (uint32_t i = 0; i < table_info->num_columns; i++) {
+    Column *col = &table_info->columns[i];
+    if (strcmp(col->name, statement->where_column) == 0) {
+      void *val_ptr = (char *)row_data + col->offset;
+      if (col->type == COLUMN_INT) {
+        uint32_t val;
+        memcpy(&val, val_ptr, sizeof(uint32_t));
+        int where_val = atoi(statement->where_value);
+        // Only support = for now
+        return val == (uint32_t)where_val;
+      } else {
+        char *val = (char *)val_ptr;
+        // Remove quotes from where_value if present
+        char clean_where_val[255];
+        strcpy(clean_where_val, statement->where_value);
+        if (clean_where_val[0] == '\'') {
+          memmove(clean_where_val, clean_where_val + 1,
+                  strlen(clean_where_val));
+          clean_where_val[strlen(clean_where_val) - 1] = '\0';
+        }
+        return strcmp(val, clean_where_val) == 0;
+      }
+    }
+  }
+  return 0;
+}
+
 ExecuteResult execute_select(Statement *statement, Table *table, int out_fd) {
   if (statement->has_join) {
     // JOIN Logic (Keep hardcoded for users/orders for now as per plan)
@@ -180,13 +257,15 @@ ExecuteResult execute_select(Statement *statement, Table *table, int out_fd) {
     if (!users_info || !orders_info)
       return EXECUTE_SUCCESS;
 
-    Cursor *user_cursor = table_start(table, users_info->root_page_num);
+    Cursor *user_cursor = statement_own(table_start(
+        table_space(table, users_info), users_info->root_page_num));
 
     while (!user_cursor->end_of_table) {
       Row user_row;
       deserialize_row(cursor_value(user_cursor), &user_row);
 
-      Cursor *order_cursor = table_start(table, orders_info->root_page_num);
+      Cursor *order_cursor = statement_own(table_start(
+          table_space(table, orders_info), orders_info->root_page_num));
       while (!order_cursor->end_of_table) {
         OrderRow order_row;
         deserialize_order_row(cursor_value(order_cursor), &order_row);
@@ -199,11 +278,11 @@ ExecuteResult execute_select(Statement *statement, Table *table, int out_fd) {
 
         cursor_advance(order_cursor);
       }
-      free(order_cursor);
+      statement_free(order_cursor);
 
       cursor_advance(user_cursor);
     }
-    free(user_cursor);
+    statement_free(user_cursor);
     return EXECUTE_SUCCESS;
   }
 
@@ -212,9 +291,11 @@ ExecuteResult execute_select(Statement *statement, Table *table, int out_fd) {
     dprintf(out_fd, "Error: Table '%s' not found.\n", statement->table_name);
     return EXECUTE_TABLE_FULL;
   }
+  table = table_space(table, table_info);
 
   // Normal SELECT (Dynamic)
-  Cursor *cursor = table_start(table, table_info->root_page_num);
+  Cursor *cursor =
+      statement_own(table_start(table, table_info->root_page_num));
   int rows_printed = 0;
 
   while (!cursor->end_of_table) {
@@ -234,34 +315,7 @@ ExecuteResult execute_select(Statement *statement, Table *table, int out_fd) {
     // Check WHERE condition
     int match = 1;
     if (statement->has_where) {
-      match = 0;
-      for (uint32_t i = 0; i < table_info->num_columns; i++) {
-        Column *col = &table_info->columns[i];
-        if (strcmp(col->name, statement->where_column) == 0) {
-          void *val_ptr = row_data + col->offset;
-          if (col->type == COLUMN_INT) {
-            uint32_t val;
-            memcpy(&val, val_ptr, sizeof(uint32_t));
-            int where_val = atoi(statement->where_value);
-            // Only support = for now
-            if (val == (uint32_t)where_val)
-              match = 1;
-          } else {
-            char *val = (char *)val_ptr;
-            // Remove quotes from where_value if present
-            char clean_where_val[255];
-            strcpy(clean_where_val, statement->where_value);
-            if (clean_where_val[0] == '\'') {
-              memmove(clean_where_val, clean_where_val + 1,
-                      strlen(clean_where_val));
-              clean_where_val[strlen(clean_where_val) - 1] = '\0';
-            }
-            if (strcmp(val, clean_where_val) == 0)
-              match = 1;
-          }
-          break;
-        }
-      }
+      match = row_matches_where(table_info, row_data, statement);
     }
 
     if (match) {
@@ -308,7 +362,7 @@ ExecuteResult execute_select(Statement *statement, Table *table, int out_fd) {
 
     cursor_advance(cursor);
   }
-  free(cursor);
+  statement_free(cursor);
   return EXECUTE_SUCCESS;
 }
 
@@ -317,68 +371,61 @@ ExecuteResult execute_delete(Statement *statement, Table *table, int out_fd) {
   TableInfo *table_info = find_table(table, statement->table_name);
   if (!table_info)
     return EXECUTE_SUCCESS;
+  table = table_space(table, table_info);
 
-  Cursor *cursor = table_start(table, table_info->root_page_num);
+  uint32_t row_size = table_row_size(table_info);
+  uint32_t cell_size = sizeof(uint32_t) + row_size;
 
-  // Optimization for ID lookup removed to handle duplicates and ensure
-  // correctness if (statement->has_where && strcmp(statement->where_column,
-  // "id") == 0 &&
-  //     strcmp(statement->where_operator, "=") == 0) {
-  //   uint32_t id_to_find = atoi(statement->where_value);
-  //   free(cursor);
-  //   cursor = table_find(table, table_info->root_page_num, &id_to_find,
-  //                       sizeof(uint32_t), KEY_INT);
-  // }
+  // Secondary index is kept only for the users table
+  Column *username_col = NULL;
+  if (strcmp(statement->table_name, "users") == 0) {
+    for (uint32_t i = 0; i < table_info->num_columns; i++) {
+      if (strcmp(table_info->columns[i].name, "username") == 0)
+        username_col = &table_info->columns[i];
+    }
+  }
+
+  Cursor *cursor =
+      statement_own(table_start(table, table_info->root_page_num));
 
   while (!cursor->end_of_table) {
-    Row row;
-    deserialize_row(cursor_value(cursor), &row);
+    void *node = get_page(table->pager, cursor->page_num);
+    void *row_data = leaf_node_value(node, cursor->cell_num, cell_size,
+                                     sizeof(uint32_t));
 
     int pass = 1;
     if (statement->has_where) {
-      if (strcmp(statement->where_column, "id") == 0) {
-        int val = atoi(statement->where_value);
-        if (strcmp(statement->where_operator, "=") == 0) {
-          if (row.id != (uint32_t)val)
-            pass = 0;
-        }
-      } else if (strcmp(statement->where_column, "username") == 0) {
-        if (strcmp(statement->where_operator, "=") == 0) {
-          if (strcmp(row.username, statement->where_value) != 0)
-            pass = 0;
-        }
-      }
+      pass = row_matches_where(table_info, row_data, statement);
     }
 
     if (pass) {
-      // Calculate row size for dynamic tables
-      uint32_t row_size = 0;
-      for (uint32_t i = 0; i < table_info->num_columns; i++)
-        row_size += table_info->columns[i].size;
+      uint32_t key_to_delete;
+      memcpy(&key_to_delete, leaf_node_key(node, cursor->cell_num, cell_size),
+             sizeof(uint32_t));
+
+      char username[USERNAME_INDEX_KEY_SIZE + 1];
+      memset(username, 0, sizeof(username));
+      if (username_col) {
+        strncpy(username, (char *)row_data + username_col->offset,
+                USERNAME_INDEX_KEY_SIZE);
+      }
 
-      uint32_t key_to_delete = row.id; // Assuming 'id' is the key for deletion
       leaf_node_delete(cursor, &key_to_delete, sizeof(uint32_t), row_size,
                        KEY_INT);
 
-      // Delete from index only if users table
-      if (strcmp(statement->table_name, "users") == 0) {
-        Cursor *index_cursor =
-            table_find(table, 2, row.username, USERNAME_SIZE, KEY_STRING);
-        leaf_node_delete(index_cursor, row.username, USERNAME_SIZE,
-                         sizeof(uint32_t), KEY_STRING);
-        free(index_cursor);
+      if (username_col) {
+        Cursor *index_cursor = statement_own(
+            table_find(table, 2, username, USERNAME_INDEX_KEY_SIZE,
+                       USERNAME_INDEX_VALUE_SIZE, KEY_STRING));
+        leaf_node_delete(index_cursor, username, USERNAME_INDEX_KEY_SIZE,
+                         USERNAME_INDEX_VALUE_SIZE, KEY_STRING);
+        statement_free(index_cursor);
       }
 
-      // if (statement->has_where && strcmp(statement->where_column, "id") == 0
-      // &&
-      //     strcmp(statement->where_operator, "=") == 0) {
-      //   break;
-      // }
-
       // If we deleted a row, the next row shifts into the current position.
       // So we don't need to advance the cursor unless we are at the end of the
       // node.
-      void *node = get_page(table->pager, cursor->page_num);
+      node = get_page(table->pager, cursor->page_num);
       uint32_t num_cells = *leaf_node_num_cells(node);
       if (cursor->cell_num >= num_cells) {
         cursor_advance(cursor);
@@ -387,7 +434,7 @@ ExecuteResult execute_delete(Statement *statement, Table *table, int out_fd) {
       cursor_advance(cursor);
     }
   }
-  free(cursor);
+  statement_free(cursor);
   return EXECUTE_SUCCESS;
 }
 
@@ -401,7 +448,9 @@ ExecuteResult execute_insert_select(Statement *statement, Table *table,
     return EXECUTE_TABLE_FULL;
   }
 
-  Cursor *cursor = table_start(table, source_info->root_page_num);
+  Table *dest = table_space(table, dest_info);
+  Cursor *cursor = statement_own(table_start(table_space(table, source_info),
+                                             source_info->root_page_num));
   while (!cursor->end_of_table) {
     Row row;
     deserialize_row(cursor_value(cursor), &row);
@@ -422,11 +471,12 @@ ExecuteResult execute_insert_select(Statement *statement, Table *table,
       order.user_id = row.id;
       strcpy(order.product_name, "AutoImport");
 
-      Cursor *order_cursor = table_find(table, dest_info->root_page_num,
-                                        &order.id, sizeof(uint32_t), KEY_INT);
+      Cursor *order_cursor = statement_own(
+          table_find(dest, dest_info->root_page_num, &order.id,
+                     sizeof(uint32_t), sizeof(OrderRow), KEY_INT));
       leaf_node_insert(order_cursor, &order.id, sizeof(uint32_t), &order,
                        sizeof(OrderRow), KEY_INT);
-      free(order_cursor);
+      statement_free(order_cursor);
 
       dprintf(out_fd, "Inserted Order %d for User %d\n", order.id,
               order.user_id);
@@ -434,35 +484,40 @@ ExecuteResult execute_insert_select(Statement *statement, Table *table,
 
     cursor_advance(cursor);
   }
-  free(cursor);
+  statement_free(cursor);
   return EXECUTE_SUCCESS;
 }
 
-ExecuteResult execute_begin(Statement *statement, Table *table, int out_fd) {
+ExecuteResult execute_begin(Statement *statement, Session *session) {
   (void)statement;
-  if (table->in_transaction) {
+  Table *table = session->table;
+  int out_fd = session->out_fd;
+  if (session->in_transaction) {
     print_msg(out_fd, "Error: Already in a transaction\n");
     return EXECUTE_SUCCESS;
   }
-  table->in_transaction = true;
+  // Write back earlier autocommit changes, as COMMIT would have. The
+  // transaction takes its locks from the next statement on.
+  session->commit_lsn = db_flush_commit(table);
+  lock_begin(table->locks, &session->transaction, table);
+
+  session->in_transaction = true;
   print_msg(out_fd, "Transaction started.\n");
   return EXECUTE_SUCCESS;
 }
 
-ExecuteResult execute_commit(Statement *statement, Table *table, int out_fd) {
+ExecuteResult execute_commit(Statement *statement, Session *session) {
   (void)statement;
-  if (!table->in_transaction) {
+  int out_fd = session->out_fd;
+  if (!session->in_transaction) {
     print_msg(out_fd, "Error: Not in a transaction\n");
     return EXECUTE_SUCCESS;
   }
 
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-    if (table->pager->pages[i] != NULL) {
-      pager_flush(table->pager, i, PAGE_SIZE);
-    }
-  }
+  session->commit_lsn =
+      db_commit(session->table, &session->transaction, true);
 
-  table->in_transaction = false;
+  session->in_transaction = false;
   print_msg(out_fd, "Transaction committed.\n");
   return EXECUTE_SUCCESS;
 }
@@ -478,21 +533,33 @@ ExecuteResult execute_create_table(Statement *statement, Table *table,
     dprintf(out_fd, "Error: Table already exists.\n");
     return EXECUTE_DUPLICATE_KEY;
   }
+  if (table->file_per_table && strchr(statement->create_table_name, '/')) {
+    dprintf(out_fd, "Error: Table name cannot contain '/'.\n");
+    return EXECUTE_TABLE_FULL;
+  }
 
-  // Allocate new page
-  printf("Debug: Allocating new page for table %s\n",
-         statement->create_table_name);
-  uint32_t root_page_num = get_unused_page_num(table->pager);
-  printf("Debug: New root page num: %d\n", root_page_num);
-  void *root_node = get_page(table->pager, root_page_num);
-  initialize_leaf_node(root_node);
-  set_node_root(root_node, true);
-  pager_flush(table->pager, root_page_num, PAGE_SIZE);
-
-  // Add to table list
   TableInfo *new_table = &table->tables[table->num_tables];
   strcpy(new_table->name, statement->create_table_name);
-  new_table->root_page_num = root_page_num;
+  if (table->file_per_table) {
+    table_space_create(table, new_table);
+  } else {
+    // Allocate new page. Like a table file, the root is set up outside the
+    // open transaction, if any.
+    printf("Debug: Allocating new page for table %s\n",
+           statement->create_table_name);
+    Transaction *transaction = lock_current();
+    lock_set_current(NULL);
+    uint32_t root_page_num = get_unused_page_num(table->pager);
+    printf("Debug: New root page num: %d\n", root_page_num);
+    void *root_node = get_page(table->pager, root_page_num);
+    initialize_leaf_node(root_node);
+    set_node_root(root_node, true);
+    pager_flush(table->pager, root_page_num, table->pager->page_size);
+    lock_set_current(transaction);
+    new_table->root_page_num = root_page_num;
+  }
+
+  // Add to table list
   new_table->num_columns = statement->create_num_columns;
 
   uint32_t offset = 0;
@@ -517,16 +584,17 @@ ExecuteResult execute_create_table(Statement *statement, Table *table,
   return EXECUTE_SUCCESS;
 }
 
-ExecuteResult execute_rollback(Statement *statement, Table *table, int out_fd) {
+ExecuteResult execute_rollback(Statement *statement, Session *session) {
   (void)statement;
-  if (!table->in_transaction) {
+  int out_fd = session->out_fd;
+  if (!session->in_transaction) {
     print_msg(out_fd, "Error: Not in a transaction\n");
     return EXECUTE_SUCCESS;
   }
 
-  pager_rollback(table->pager);
+  db_rollback(session->table, &session->transaction);
 
-  table->in_transaction = false;
+  session->in_transaction = false;
   print_msg(out_fd, "Transaction rolled back.\n");
   return EXECUTE_SUCCESS;
 }
@@ -584,8 +652,98 @@ ExecuteResult execute_show_index(Statement *statement, Table *table,
   return EXECUTE_SUCCESS;
 }
 
-ExecuteResult execute_statement(Statement *statement, Table *table,
-                                int out_fd) {
+/*
+ * Rebuilds a table, and its index for users, into full nodes on pages in key
+ * order, then gives the pages this frees at the end of the file back.
+ *
+ * Every page of the table may move, so this waits for open transactions and
+ * snapshots to finish and then holds the statement gate for the whole
+ * rewrite. Until it returns, every other session's statements wait, SELECTs
+ * included, since a snapshot can only begin inside the gate.
+ */
+ExecuteResult execute_reorganize(Statement *statement, Session *session) {
+  Table *table = session->table;
+  int out_fd = session->out_fd;
+  TableInfo *table_info = find_table(table, statement->table_name);
+  if (table_info == NULL) {
+    dprintf(out_fd, "Error: Table '%s' not found.\n", statement->table_name);
+    return EXECUTE_TABLE_FULL;
+  }
+  if (session->in_transaction) {
+    // Freed pages past the end of the file could not be rolled back
+    print_msg(out_fd, "Error: Cannot reorganize inside a transaction\n");
+    return EXECUTE_SUCCESS;
+  }
+  // Pages move, so no other transaction may hold any
+  db_wait_for_transactions(table);
+  db_wait_for_snapshots(table);
+
+  table = table_space(table, table_info);
+  Pager *pager = table->pager;
+  pager_compact(pager);
+  uint32_t pages_before = pager->num_pages;
+
+  rebuild_tree(table, table_info->root_page_num, sizeof(uint32_t),
+               table_row_size(table_info));
+  if (strcmp(table_info->name, "users") == 0) {
+    rebuild_tree(table, 2, USERNAME_INDEX_KEY_SIZE, USERNAME_INDEX_VALUE_SIZE);
+  }
+  pager_compact(pager);
+  // The file has already shrunk; write the new trees and freelist with it
+  pager_flush_all(pager);
+
+  dprintf(out_fd, "Table reorganized: %u pages before, %u after.\n",
+          pages_before, pager->num_pages);
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * A table with a file of its own goes with the file; otherwise its pages
+ * go back to the freelist.
+ */
+ExecuteResult execute_drop_table(Statement *statement, Session *session) {
+  Table *table = session->table;
+  int out_fd = session->out_fd;
+  TableInfo *table_info = find_table(table, statement->table_name);
+  if (table_info == NULL) {
+    dprintf(out_fd, "Error: Table '%s' not found.\n", statement->table_name);
+    return EXECUTE_TABLE_FULL;
+  }
+  if (session->in_transaction) {
+    // Neither an unlinked file nor the directory entry could be rolled back
+    print_msg(out_fd, "Error: Cannot drop a table inside a transaction\n");
+    return EXECUTE_SUCCESS;
+  }
+  db_wait_for_transactions(table);
+  db_wait_for_snapshots(table);
+
+  if (table_space(table, table_info) != table) {
+    table_space_drop(table, table_info);
+  } else {
+    clear_tree(table, table_info->root_page_num, sizeof(uint32_t));
+    pager_free_page(table->pager, table_info->root_page_num);
+    if (strcmp(table_info->name, "users") == 0) {
+      clear_tree(table, 2, USERNAME_INDEX_KEY_SIZE);
+    }
+  }
+
+  uint32_t index = table_info - table->tables;
+  uint32_t following = table->num_tables - index - 1;
+  memmove(&table->tables[index], &table->tables[index + 1],
+          sizeof(TableInfo) * following);
+  memmove(&table->spaces[index], &table->spaces[index + 1],
+          sizeof(Table *) * following);
+  table->num_tables--;
+  table->spaces[table->num_tables] = NULL;
+
+  dprintf(out_fd, "Table dropped.\n");
+  return EXECUTE_SUCCESS;
+}
+
+static ExecuteResult execute_dispatch(Statement *statement,
+                                      Session *session) {
+  Table *table = session->table;
+  int out_fd = session->out_fd;
   switch (statement->type) {
   case STATEMENT_INSERT:
     // Check table type to decide how to insert
@@ -599,11 +757,11 @@ ExecuteResult execute_statement(Statement *statement, Table *table,
   case STATEMENT_INSERT_SELECT:
     return execute_insert_select(statement, table, out_fd);
   case STATEMENT_BEGIN:
-    return execute_begin(statement, table, out_fd);
+    return execute_begin(statement, session);
   case STATEMENT_COMMIT:
-    return execute_commit(statement, table, out_fd);
+    return execute_commit(statement, session);
   case STATEMENT_ROLLBACK:
-    return execute_rollback(statement, table, out_fd);
+    return execute_rollback(statement, session);
   case STATEMENT_CREATE_TABLE:
     return execute_create_table(statement, table, out_fd);
   case STATEMENT_SHOW_TABLES:
@@ -612,7 +770,85 @@ ExecuteResult execute_statement(Statement *statement, Table *table,
     return execute_desc_table(statement, table, out_fd);
   case STATEMENT_SHOW_INDEX:
     return execute_show_index(statement, table, out_fd);
+  case STATEMENT_REORGANIZE:
+    return execute_reorganize(statement, session);
+  case STATEMENT_DROP_TABLE:
+    return execute_drop_table(statement, session);
   default:
     return EXECUTE_SUCCESS;
   }
 }
+
+// Statements that read or change table rows, and so lock pages
+static bool statement_uses_rows(StatementType type) {
+  return type == STATEMENT_INSERT || type == STATEMENT_SELECT ||
+         type == STATEMENT_DELETE || type == STATEMENT_INSERT_SELECT;
+}
+
+static bool statement_changes_data(StatementType type) {
+  return type == STATEMENT_INSERT || type == STATEMENT_DELETE ||
+         type == STATEMENT_INSERT_SELECT || type == STATEMENT_CREATE_TABLE ||
+         type == STATEMENT_DROP_TABLE || type == STATEMENT_REORGANIZE;
+}
+
+/*
+ * Runs a statement for a session. Inside BEGIN ... COMMIT it is part of the
+ * session's transaction. Outside, it runs as a transaction of its own while
+ * other sessions hold page locks, and otherwise, with nothing to wait for,
+ * takes none. A statement that would deadlock rolls its transaction back.
+ */
+ExecuteResult execute_statement(Statement *statement, Session *session) {
+  Table *table = session->table;
+  if (table->read_only && statement_changes_data(statement->type)) {
+    return EXECUTE_READ_ONLY;
+  }
+  // Readers do not hold the gate while they scan, so writers go on
+  if (statement->type == STATEMENT_SELECT && table->snapshot_reads &&
+      !session->in_transaction) {
+    Table *snapshot = db_begin_snapshot(table);
+    ExecuteResult result = execute_select(statement, snapshot, session->out_fd);
+    db_end_snapshot(snapshot);
+    return result;
+  }
+
+  db_begin_statement(table);
+  Transaction *transaction = NULL;
+  bool autocommit = false;
+  if (session->in_transaction) {
+    transaction = &session->transaction;
+  } else if (statement_uses_rows(statement->type) && lock_busy(table->locks)) {
+    transaction = &session->transaction;
+    lock_begin(table->locks, transaction, table);
+    autocommit = true;
+  }
+
+  jmp_buf abort;
+  volatile ExecuteResult result = EXECUTE_SUCCESS;
+  if (transaction != NULL) {
+    transaction->abort = &abort;
+    lock_set_current(transaction);
+  }
+  if (setjmp(abort) == 0) {
+    result = execute_dispatch(statement, session);
+    if (autocommit) {
+      db_commit(table, transaction, false);
+    }
+  } else {
+    // Chosen as a deadlock victim, halfway through the statement
+    pager_unpin_thread();
+    statement_free_all();
+    db_rollback(table, transaction);
+    session->in_transaction = false;
+    result = EXECUTE_DEADLOCK;
+  }
+  lock_set_current(NULL);
+  db_statement_done(table, session->in_transaction);
+  db_end_statement(table);
+  // Waiting for the log outside the gate lets sessions that commit
+  // meanwhile share the fdatasync()
+  if (session->commit_lsn != 0) {
+    db_wait_for_commit(table, session->commit_lsn);
+    session->commit_lsn = 0;
+  }
+  return result;
+}
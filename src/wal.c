@@ -0,0 +1,475 @@
+#include "wal.h"
+#include "uring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WAL_INITIAL_INDEX 1024
+
+static char *wal_path(const char *db_path) {
+  size_t length = strlen(db_path) + sizeof(WAL_SUFFIX);
+  char *path = malloc(length);
+  snprintf(path, length, "%s%s", db_path, WAL_SUFFIX);
+  return path;
+}
+
+static bool wal_valid_page_size(uint32_t page_size) {
+  return page_size >= 512 && page_size <= 65536 &&
+         (page_size & (page_size - 1)) == 0;
+}
+
+// Fletcher-style sum over the frame header and the page, 32 bits at a time
+static uint32_t wal_checksum(const WalFrameHeader *frame, const void *page,
+                             uint32_t page_size) {
+  uint32_t low = frame->page_num ^ frame->salt;
+  uint32_t high = low + frame->db_pages;
+  const uint32_t *words = page;
+  uint32_t count = page != NULL ? page_size / sizeof(uint32_t) : 0;
+  for (uint32_t i = 0; i < count; i++) {
+    low += words[i];
+    high += low;
+  }
+  return (high << 16 | high >> 16) ^ low;
+}
+
+static uint64_t wal_frame_size(Wal *wal, uint32_t page_num) {
+  return sizeof(WalFrameHeader) +
+         (page_num == WAL_COMMIT_RECORD ? 0 : wal->page_size);
+}
+
+// Reads the frame at offset; false at the end of the log or a bad frame
+static bool wal_read_frame(int fd, const WalHeader *header, uint64_t offset,
+                           WalFrameHeader *frame, void *page) {
+  if (pread(fd, frame, sizeof(*frame), offset) != sizeof(*frame) ||
+      frame->salt != header->salt) {
+    return false;
+  }
+  if (frame->page_num == WAL_COMMIT_RECORD) {
+    return frame->checksum == wal_checksum(frame, NULL, header->page_size);
+  }
+  return pread(fd, page, header->page_size, offset + sizeof(*frame)) ==
+             header->page_size &&
+         frame->checksum == wal_checksum(frame, page, header->page_size);
+}
+
+/*
+ * Two passes: the first finds the last commit record, the second copies
+ * every page image before it into the database, oldest first, so the newest
+ * image of each page ends up in place. Returns the pages copied.
+ */
+static uint32_t wal_replay(int fd, int db_fd, const WalHeader *header) {
+  void *page = malloc(header->page_size);
+  WalFrameHeader frame;
+  uint64_t committed = sizeof(WalHeader);
+  uint32_t db_pages = 0;
+  uint64_t offset = sizeof(WalHeader);
+  while (wal_read_frame(fd, header, offset, &frame, page)) {
+    offset += sizeof(frame);
+    if (frame.page_num == WAL_COMMIT_RECORD) {
+      committed = offset;
+      db_pages = frame.db_pages;
+    } else {
+      offset += header->page_size;
+    }
+  }
+
+  uint32_t copied = 0;
+  for (offset = sizeof(WalHeader); offset < committed;) {
+    wal_read_frame(fd, header, offset, &frame, page);
+    offset += sizeof(frame);
+    if (frame.page_num == WAL_COMMIT_RECORD) {
+      continue;
+    }
+    if (pwrite(db_fd, page, header->page_size,
+               (off_t)frame.page_num * header->page_size) == -1) {
+      printf("Error writing: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    offset += header->page_size;
+    copied++;
+  }
+  free(page);
+
+  if (committed > sizeof(WalHeader)) {
+    // Pages cut off by the last commit may still be in the file
+    off_t db_end = (off_t)db_pages * header->page_size;
+    if (lseek(db_fd, 0, SEEK_END) > db_end && ftruncate(db_fd, db_end) == -1) {
+      printf("Error truncating db file: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    if (fdatasync(db_fd) == -1) {
+      printf("Error syncing db file: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+  }
+  return copied;
+}
+
+/*
+ * A log left behind means the last run did not close the database. Frames
+ * after the last commit record belonged to unfinished work and are dropped
+ * along with the log.
+ */
+void wal_recover(const char *db_path, int db_fd) {
+  char *path = wal_path(db_path);
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    free(path);
+    return;
+  }
+
+  WalHeader header;
+  if (pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+      header.magic == WAL_MAGIC && header.version == WAL_VERSION &&
+      wal_valid_page_size(header.page_size)) {
+    uint32_t copied = wal_replay(fd, db_fd, &header);
+    if (copied > 0) {
+      printf("Recovered %u pages from %s\n", copied, path);
+    }
+  }
+  close(fd);
+  unlink(path);
+  free(path);
+}
+
+// Starts the file over with a new salt, so no old frame can pass for a new
+// one. Called with the lock held, or before the log is shared.
+static void wal_reset(Wal *wal) {
+  wal->salt = wal->salt * 1103515245u + 12345u;
+  WalHeader header = {WAL_MAGIC, WAL_VERSION, wal->page_size, wal->salt};
+  if (ftruncate(wal->file_descriptor, 0) == -1 ||
+      pwrite(wal->file_descriptor, &header, sizeof(header), 0) !=
+          sizeof(header)) {
+    printf("Error writing WAL: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+
+  wal->base = wal->end - sizeof(header);
+  wal->committed = wal->end;
+  wal->synced = wal->end;
+  wal->uncommitted = 0;
+  wal->num_frames = 0;
+  for (uint32_t i = 0; i < wal->index_capacity; i++) {
+    wal->index[i].page_num = WAL_COMMIT_RECORD;
+  }
+  wal->index_count = 0;
+}
+
+Wal *wal_open(const char *db_path, uint32_t page_size, uint32_t db_pages) {
+  Wal *wal = malloc(sizeof(Wal));
+  wal->path = wal_path(db_path);
+  wal->file_descriptor =
+      open(wal->path, O_RDWR | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+  if (wal->file_descriptor == -1) {
+    printf("Unable to open WAL file %s\n", wal->path);
+    exit(EXIT_FAILURE);
+  }
+  wal->page_size = page_size;
+  if (posix_memalign(&wal->scratch, page_size, page_size) != 0) {
+    printf("Unable to allocate WAL buffer\n");
+    exit(EXIT_FAILURE);
+  }
+
+  pthread_mutex_init(&wal->lock, NULL);
+  pthread_cond_init(&wal->synced_cond, NULL);
+  wal->salt = (uint32_t)time(NULL) ^ (uint32_t)getpid();
+  wal->end = sizeof(WalHeader);
+  wal->syncing = false;
+  wal->db_pages = db_pages;
+  wal->index_capacity = WAL_INITIAL_INDEX;
+  wal->index = malloc(sizeof(WalEntry) * wal->index_capacity);
+  wal_reset(wal);
+  return wal;
+}
+
+void wal_close(Wal *wal) {
+  close(wal->file_descriptor);
+  unlink(wal->path);
+  pthread_mutex_destroy(&wal->lock);
+  pthread_cond_destroy(&wal->synced_cond);
+  free(wal->scratch);
+  free(wal->index);
+  free(wal->path);
+  free(wal);
+}
+
+static uint32_t wal_index_slot(Wal *wal, uint32_t page_num) {
+  uint32_t mask = wal->index_capacity - 1;
+  uint32_t slot = (page_num * 2654435761u) & mask;
+  while (wal->index[slot].page_num != WAL_COMMIT_RECORD &&
+         wal->index[slot].page_num != page_num) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+static void wal_index_put(Wal *wal, uint32_t page_num, uint64_t offset) {
+  if ((wal->index_count + 1) * 2 > wal->index_capacity) {
+    WalEntry *old = wal->index;
+    uint32_t old_capacity = wal->index_capacity;
+    wal->index_capacity *= 2;
+    wal->index = malloc(sizeof(WalEntry) * wal->index_capacity);
+    for (uint32_t i = 0; i < wal->index_capacity; i++) {
+      wal->index[i].page_num = WAL_COMMIT_RECORD;
+    }
+    for (uint32_t i = 0; i < old_capacity; i++) {
+      if (old[i].page_num != WAL_COMMIT_RECORD) {
+        wal->index[wal_index_slot(wal, old[i].page_num)] = old[i];
+      }
+    }
+    free(old);
+  }
+
+  WalEntry *entry = &wal->index[wal_index_slot(wal, page_num)];
+  if (entry->page_num == WAL_COMMIT_RECORD) {
+    entry->page_num = page_num;
+    entry->committed_offset = WAL_NO_FRAME;
+    wal->index_count++;
+  } else if (entry->offset < wal->committed - wal->base) {
+    // The frame being replaced is the newest committed one
+    entry->committed_offset = entry->offset;
+  }
+  entry->offset = offset;
+}
+
+static void wal_write(Wal *wal, struct iovec *iov, uint32_t iovcnt,
+                      uint64_t offset) {
+  for (uint32_t i = 0; i < iovcnt;) {
+    uint32_t count = iovcnt - i < IO_REQUEST_MAX_IOVECS
+                         ? iovcnt - i
+                         : IO_REQUEST_MAX_IOVECS;
+    ssize_t expected = 0;
+    for (uint32_t j = i; j < i + count; j++) {
+      expected += iov[j].iov_len;
+    }
+    if (pwritev(wal->file_descriptor, &iov[i], count, offset) != expected) {
+      printf("Error writing WAL: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    offset += expected;
+    i += count;
+  }
+}
+
+// Appends the frames of wal_append(). Called with the lock held.
+static void wal_append_locked(Wal *wal, const uint32_t *page_nums,
+                              void *const *pages, uint32_t count) {
+  WalFrameHeader *frames = malloc(sizeof(WalFrameHeader) * count);
+  struct iovec *iov = malloc(sizeof(struct iovec) * 2 * count);
+
+  for (uint32_t i = 0; i < count; i++) {
+    frames[i].page_num = page_nums[i];
+    frames[i].db_pages = 0;
+    frames[i].salt = wal->salt;
+    frames[i].checksum = wal_checksum(&frames[i], pages[i], wal->page_size);
+    iov[2 * i].iov_base = &frames[i];
+    iov[2 * i].iov_len = sizeof(WalFrameHeader);
+    iov[2 * i + 1].iov_base = pages[i];
+    iov[2 * i + 1].iov_len = wal->page_size;
+  }
+
+  uint64_t offset = wal->end - wal->base;
+  wal_write(wal, iov, 2 * count, offset);
+  for (uint32_t i = 0; i < count; i++) {
+    wal_index_put(wal, page_nums[i], offset);
+    offset += wal_frame_size(wal, page_nums[i]);
+  }
+  wal->end = wal->base + offset;
+  wal->uncommitted += count;
+  wal->num_frames += count;
+
+  free(iov);
+  free(frames);
+}
+
+/*
+ * Appends one frame per page with a single vectored write. Pages logged more
+ * than once are read back from their newest frame.
+ */
+void wal_append(Wal *wal, const uint32_t *page_nums, void *const *pages,
+                uint32_t count) {
+  if (count == 0) {
+    return;
+  }
+  pthread_mutex_lock(&wal->lock);
+  wal_append_locked(wal, page_nums, pages, count);
+  pthread_mutex_unlock(&wal->lock);
+}
+
+uint64_t wal_commit(Wal *wal, uint32_t db_pages) {
+  pthread_mutex_lock(&wal->lock);
+  if (wal->uncommitted > 0) {
+    WalFrameHeader record = {WAL_COMMIT_RECORD, db_pages, wal->salt, 0};
+    record.checksum = wal_checksum(&record, NULL, wal->page_size);
+    struct iovec iov = {&record, sizeof(record)};
+    wal_write(wal, &iov, 1, wal->end - wal->base);
+    wal->end += sizeof(record);
+    wal->committed = wal->end;
+    wal->uncommitted = 0;
+    wal->db_pages = db_pages;
+  }
+  uint64_t lsn = wal->synced < wal->committed ? wal->committed : 0;
+  pthread_mutex_unlock(&wal->lock);
+  return lsn;
+}
+
+/*
+ * Group commit: the first committer to arrive syncs everything appended so
+ * far, and committers that arrive meanwhile wait for that sync and, if it
+ * did not cover them, elect the next leader among themselves. Any number of
+ * concurrent commits therefore cost one fdatasync() each round.
+ */
+bool wal_sync(Wal *wal, uint64_t lsn) {
+  bool leader = false;
+  pthread_mutex_lock(&wal->lock);
+  while (wal->synced < lsn) {
+    if (wal->syncing) {
+      pthread_cond_wait(&wal->synced_cond, &wal->lock);
+      continue;
+    }
+    wal->syncing = true;
+    uint64_t end = wal->end;
+    pthread_mutex_unlock(&wal->lock);
+    if (fdatasync(wal->file_descriptor) == -1) {
+      printf("Error syncing WAL: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    pthread_mutex_lock(&wal->lock);
+    // A checkpoint may have moved synced past us in the meantime
+    if (wal->synced < end) {
+      wal->synced = end;
+    }
+    wal->syncing = false;
+    pthread_cond_broadcast(&wal->synced_cond);
+    leader = true;
+  }
+  pthread_mutex_unlock(&wal->lock);
+  return leader;
+}
+
+bool wal_contains(Wal *wal, uint32_t page_num) {
+  pthread_mutex_lock(&wal->lock);
+  bool found =
+      wal->index[wal_index_slot(wal, page_num)].page_num != WAL_COMMIT_RECORD;
+  pthread_mutex_unlock(&wal->lock);
+  return found;
+}
+
+bool wal_read_page(Wal *wal, uint32_t page_num, void *destination) {
+  pthread_mutex_lock(&wal->lock);
+  WalEntry *entry = &wal->index[wal_index_slot(wal, page_num)];
+  bool found = entry->page_num != WAL_COMMIT_RECORD;
+  if (found && pread(wal->file_descriptor, destination, wal->page_size,
+                     entry->offset + sizeof(WalFrameHeader)) !=
+                   wal->page_size) {
+    printf("Error reading WAL: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_unlock(&wal->lock);
+  return found;
+}
+
+void wal_forget(Wal *wal, uint32_t end) {
+  pthread_mutex_lock(&wal->lock);
+  WalEntry *old = wal->index;
+  wal->index = malloc(sizeof(WalEntry) * wal->index_capacity);
+  for (uint32_t i = 0; i < wal->index_capacity; i++) {
+    wal->index[i].page_num = WAL_COMMIT_RECORD;
+  }
+  wal->index_count = 0;
+  for (uint32_t i = 0; i < wal->index_capacity; i++) {
+    if (old[i].page_num != WAL_COMMIT_RECORD && old[i].page_num < end) {
+      wal->index[wal_index_slot(wal, old[i].page_num)] = old[i];
+      wal->index_count++;
+    }
+  }
+  free(old);
+  pthread_mutex_unlock(&wal->lock);
+}
+
+static int compare_entry_page_num(const void *a, const void *b) {
+  uint32_t page_a = ((const WalEntry *)a)->page_num;
+  uint32_t page_b = ((const WalEntry *)b)->page_num;
+  return (page_a > page_b) - (page_a < page_b);
+}
+
+void wal_checkpoint(Wal *wal, int db_fd, _Atomic uint64_t *db_length) {
+  pthread_mutex_lock(&wal->lock);
+  WalEntry *entries = malloc(sizeof(WalEntry) * (wal->index_count + 1));
+  WalEntry *uncommitted = malloc(sizeof(WalEntry) * (wal->index_count + 1));
+  uint32_t count = 0;
+  uint32_t num_uncommitted = 0;
+  uint64_t commit_offset = wal->committed - wal->base;
+  for (uint32_t i = 0; i < wal->index_capacity; i++) {
+    WalEntry entry = wal->index[i];
+    if (entry.page_num == WAL_COMMIT_RECORD) {
+      continue;
+    }
+    // Frames after the last commit record stay out of the database file,
+    // which gets the page's newest committed frame, if any, instead
+    if (entry.offset >= commit_offset) {
+      uncommitted[num_uncommitted++] = entry;
+      if (entry.committed_offset == WAL_NO_FRAME) {
+        continue;
+      }
+      entry.offset = entry.committed_offset;
+    }
+    entries[count++] = entry;
+  }
+  // In page order, so the database file is written front to back
+  qsort(entries, count, sizeof(WalEntry), compare_entry_page_num);
+
+  off_t db_end = (off_t)wal->db_pages * wal->page_size;
+  if (lseek(db_fd, 0, SEEK_END) > db_end && ftruncate(db_fd, db_end) == -1) {
+    printf("Error truncating db file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    if (pread(wal->file_descriptor, wal->scratch, wal->page_size,
+              entries[i].offset + sizeof(WalFrameHeader)) != wal->page_size ||
+        pwrite(db_fd, wal->scratch, wal->page_size,
+               (off_t)entries[i].page_num * wal->page_size) !=
+            wal->page_size) {
+      printf("Error checkpointing WAL: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+  }
+  free(entries);
+
+  // The log may only be emptied once its pages are safely in the file
+  if (fdatasync(db_fd) == -1) {
+    printf("Error syncing db file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  *db_length = lseek(db_fd, 0, SEEK_END);
+
+  // Read the uncommitted frames back before the log is emptied, and log
+  // them again after it, still uncommitted
+  uint32_t *page_nums = malloc(sizeof(uint32_t) * (num_uncommitted + 1));
+  void **pages = malloc(sizeof(void *) * (num_uncommitted + 1));
+  uint8_t *images = malloc((size_t)wal->page_size * (num_uncommitted + 1));
+  for (uint32_t i = 0; i < num_uncommitted; i++) {
+    page_nums[i] = uncommitted[i].page_num;
+    pages[i] = images + (size_t)i * wal->page_size;
+    if (pread(wal->file_descriptor, pages[i], wal->page_size,
+              uncommitted[i].offset + sizeof(WalFrameHeader)) !=
+        wal->page_size) {
+      printf("Error reading WAL: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+  }
+  wal_reset(wal);
+  if (num_uncommitted > 0) {
+    wal_append_locked(wal, page_nums, pages, num_uncommitted);
+  }
+  pthread_mutex_unlock(&wal->lock);
+  free(images);
+  free(pages);
+  free(page_nums);
+  free(uncommitted);
+}
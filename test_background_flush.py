@@ -0,0 +1,65 @@
+import subprocess
+import sys
+import time
+import os
+from db_helpers import insert_users, parse_stats, rows_of, run_db
+
+DB_FILE = "test_background_flush.db"
+
+def run_steps(steps):
+    """steps: command lists, each followed by a pause of the given length"""
+    process = subprocess.Popen(
+        ["./db", DB_FILE, "--background-flush"],
+        stdin=subprocess.PIPE,
+        stdout=subprocess.PIPE,
+        text=True,
+    )
+    for commands, pause in steps:
+        process.stdin.write("\n".join(commands) + "\n")
+        process.stdin.flush()
+        time.sleep(pause)
+    stdout, _ = process.communicate(".exit\n")
+    return stdout
+
+def run_test():
+    if os.path.exists(DB_FILE):
+        os.remove(DB_FILE)
+
+    try:
+        print("Autocommit inserts, then idle...")
+        out = run_steps([
+            (["create table users (id int, username varchar(32), email varchar(255))"]
+             + insert_users(range(1, 301)), 2.0),
+            ([".stats"], 0),
+        ])
+        stats = parse_stats(out)
+        if stats.get("background_pages", 0) == 0 or stats.get("dirty_pages", 1) != 0:
+            print(f"FAIL: idle dirty pages were not written back: {stats}")
+            return False
+
+        print("Open transaction, then idle...")
+        out = run_steps([
+            ([".stats reset", "begin"] + insert_users(range(301, 401)), 2.0),
+            ([".stats", "rollback"], 0),
+        ])
+        stats = parse_stats(out)
+        if stats.get("background_pages", 1) != 0:
+            print(f"FAIL: flusher wrote uncommitted pages: {stats}")
+            return False
+
+        rows = rows_of(run_db(DB_FILE, ["select * from users"]))
+        if len(rows) != 300:
+            print(f"FAIL: expected 300 rows after rollback, got {len(rows)}")
+            return False
+
+        print("Background Flush Test Passed!")
+        return True
+    finally:
+        if os.path.exists(DB_FILE):
+            os.remove(DB_FILE)
+
+if __name__ == "__main__":
+    if run_test():
+        sys.exit(0)
+    else:
+        sys.exit(1)
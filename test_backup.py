@@ -0,0 +1,122 @@
+import glob
+import os
+import sys
+import threading
+import time
+from db_helpers import Client, rows_of, run_db, start_server
+
+DB_FILE = "test_backup.db"
+BACKUP_FILE = "test_backup.db.bak"
+PORT = 8088
+NUM_ROWS = 20000  # Even ids 2 .. 2 * NUM_ROWS
+LAST_ID = 2 * NUM_ROWS
+
+class Session(Client):
+    """A client that can also start a .backup"""
+    def __init__(self):
+        super().__init__(PORT)
+
+    def backup(self, path):
+        """.backup prints a single line and no 'Executed.'"""
+        self.send(f".backup {path}")
+        return self.reply(b"\n")[0]
+
+def insert(i):
+    return f"insert into items values ({i}, 'item{i}')"
+
+def cleanup():
+    for path in glob.glob(DB_FILE + "*"):
+        os.remove(path)
+
+def start(extra_args):
+    run_db(DB_FILE,
+           ["create table items (id int, name varchar(32))"]
+           + [insert(i) for i in range(2, LAST_ID + 1, 2)], extra_args)
+    return start_server(DB_FILE, PORT, extra_args)
+
+def backup_ids(extra_args):
+    """The ids in the backup, read by opening it as a database"""
+    rows = rows_of(run_db(BACKUP_FILE, ["select * from items"], extra_args))
+    return [int(line[1:line.index(",")]) for line in rows if ", item" in line]
+
+def test_backup_while_writing(extra_args):
+    print("Backing up while another session writes...")
+    a, b, writer = Session(), Session(), Session()
+    # An autocommitted insert the transaction's undo image has to carry
+    a.execute("begin")
+    b.execute(insert(3))
+    a.execute(insert(5))
+
+    inserted = []
+    stop = threading.Event()
+    def write():
+        writer.send(".sync full")
+        writer.reply(b"sync full\n")
+        i = LAST_ID + 1
+        while not stop.is_set():
+            writer.execute(insert(i))
+            inserted.append(i)
+            i += 2
+    thread = threading.Thread(target=write)
+    thread.start()
+    while len(inserted) < 20:
+        time.sleep(0.01)
+    start = time.time()
+    reply = b.backup(BACKUP_FILE)
+    elapsed = time.time() - start
+    time.sleep(0.2)
+    stop.set()
+    thread.join()
+    a.execute("rollback")
+    print(f"  {reply} ({elapsed:.3f}s, {len(inserted)} concurrent inserts)")
+
+    if not reply.startswith("Backup written: "):
+        print(f"FAIL: unexpected reply: {reply}")
+        return False
+    if reply.endswith(" 0 copied again."):
+        print("FAIL: the open transaction's page was not copied again")
+        return False
+
+    ids = backup_ids(extra_args)
+    base = [i for i in ids if i <= LAST_ID]
+    if base != sorted([3] + list(range(2, LAST_ID + 1, 2))):
+        print(f"FAIL: the backup has {len(base)} of the committed rows")
+        return False
+    late = [i for i in ids if i > LAST_ID]
+    if late != inserted[:len(late)]:
+        print("FAIL: the backup holds concurrent inserts out of order")
+        return False
+    if 5 in ids:
+        print("FAIL: the backup holds an uncommitted insert")
+        return False
+    for client in (a, b, writer):
+        client.close()
+    return True
+
+def test_unwritable_target():
+    print("Backing up to a path that cannot be written...")
+    client = Session()
+    reply = client.backup("no_such_directory/backup.db")
+    if not reply.startswith("Error: Unable to write backup"):
+        print(f"FAIL: unexpected reply: {reply}")
+        return False
+    if "(3, item3)" not in client.execute("select * from items where id = 3"):
+        print("FAIL: the database is unusable after a failed backup")
+        return False
+    client.close()
+    return True
+
+if __name__ == "__main__":
+    for mode in ([], ["--wal"], ["--file-per-table"], ["--direct-io"]):
+        cleanup()
+        server = start(mode)
+        try:
+            if not test_backup_while_writing(mode) or \
+                    not test_unwritable_target():
+                sys.exit(1)
+            print("Backup Test Passed!", mode)
+        finally:
+            server.kill()
+            server.wait()
+            cleanup()
+    sys.exit(0)
@@ -0,0 +1,52 @@
+import sys
+import os
+from db_helpers import insert_users, rows_of, run_db, user_rows
+
+DB_FILE = "test_buffer_pool.db"
+NUM_ROWS = 3000
+CACHE_PAGES = "16"
+
+def run_test(extra_args):
+    if os.path.exists(DB_FILE):
+        os.remove(DB_FILE)
+
+    args = ["--cache-pages", CACHE_PAGES] + extra_args
+    try:
+        # Far more pages than the 16-frame pool can hold
+        print(f"Inserting {NUM_ROWS} rows with a {CACHE_PAGES}-page cache...")
+        run_db(DB_FILE,
+               ["create table users (id int, username varchar(32), email varchar(255))"]
+               + insert_users(range(1, NUM_ROWS + 1)), args)
+
+        print("Reopening and scanning...")
+        rows = rows_of(run_db(DB_FILE, ["select * from users"], args))
+        if rows != user_rows(range(1, NUM_ROWS + 1)):
+            print(f"FAIL: expected {NUM_ROWS} rows in order, got {len(rows)}")
+            return False
+
+        print("Checking rollback under eviction...")
+        commands = (["begin"] + insert_users(range(NUM_ROWS + 1, NUM_ROWS + 101))
+                    + ["rollback", f"select * from users where id = {NUM_ROWS + 1}"])
+        if rows_of(run_db(DB_FILE, commands, args)) != []:
+            print("FAIL: rolled back row is visible")
+            return False
+
+        rows = rows_of(run_db(DB_FILE, ["select * from users"], args))
+        if len(rows) != NUM_ROWS:
+            print(f"FAIL: expected {NUM_ROWS} rows after rollback, got {len(rows)}")
+            return False
+
+        print(f"Buffer Pool Test Passed! {' '.join(extra_args)}")
+        return True
+    finally:
+        if os.path.exists(DB_FILE):
+            os.remove(DB_FILE)
+
+if __name__ == "__main__":
+    # Default read() backend, the mmap backend, batched io_uring I/O, O_DIRECT
+    # and compressed pages
+    for extra_args in ([], ["--mmap"], ["--io-uring"], ["--direct-io"],
+                       ["--compress"]):
+        if not run_test(extra_args):
+            sys.exit(1)
+    sys.exit(0)
@@ -0,0 +1,59 @@
+import sys
+import os
+from db_helpers import insert_users, rows_of, run_db, user_rows
+
+DB_FILE = "test_compression.db"
+PLAIN_DB_FILE = "test_compression_plain.db"
+NUM_ROWS = 2000
+
+def run_test():
+    for path in (DB_FILE, PLAIN_DB_FILE):
+        if os.path.exists(path):
+            os.remove(path)
+
+    try:
+        create = ["create table users (id int, username varchar(32), email varchar(255))"]
+        inserts = insert_users(range(1, NUM_ROWS + 1))
+        print(f"Inserting {NUM_ROWS} rows into compressed and plain databases...")
+        run_db(DB_FILE, create + inserts, ["--compress"])
+        run_db(PLAIN_DB_FILE, create + inserts)
+
+        compressed_size = os.path.getsize(DB_FILE)
+        plain_size = os.path.getsize(PLAIN_DB_FILE)
+        print(f"Compressed {compressed_size} bytes, plain {plain_size} bytes")
+        if compressed_size * 3 > plain_size:
+            print("FAIL: compressed file is not at least 3x smaller")
+            return False
+
+        # Reopen without the option: the format must come from the file itself
+        expected = user_rows(range(1, NUM_ROWS + 1))
+        rows = rows_of(run_db(DB_FILE, ["select * from users"], ["--cache-pages", "16"]))
+        if rows != expected:
+            print("FAIL: compressed rows differ after reopening")
+            return False
+
+        print("Deleting and reinserting...")
+        run_db(DB_FILE, ["delete from users"])
+        if rows_of(run_db(DB_FILE, ["select * from users"])) != []:
+            print("FAIL: rows left after delete")
+            return False
+        run_db(DB_FILE, inserts, ["--cache-pages", "16"])
+        if rows_of(run_db(DB_FILE, ["select * from users"])) != expected:
+            print("FAIL: rows differ after reinserting")
+            return False
+        if os.path.getsize(DB_FILE) > compressed_size * 2:
+            print("FAIL: freed slots were not reused")
+            return False
+
+        print("Compression Test Passed!")
+        return True
+    finally:
+        for path in (DB_FILE, PLAIN_DB_FILE):
+            if os.path.exists(path):
+                os.remove(path)
+
+if __name__ == "__main__":
+    if run_test():
+        sys.exit(0)
+    else:
+        sys.exit(1)
@@ -0,0 +1,155 @@
+import glob
+import os
+import random
+import struct
+import subprocess
+import sys
+import time
+from db_helpers import rows_of, run_db
+
+DB_FILE = "test_dump_load.db"
+COPY_FILE = "test_dump_load_copy.db"
+DUMP_FILE = "test_dump_load.dump"
+NUM_ROWS = 20000
+
+DUMP_MAGIC = 0x504d5544
+TABLE_NAME_SIZE = 32
+MAX_COLUMNS = 10
+
+def cleanup():
+    for path in glob.glob(DB_FILE + "*") + glob.glob(COPY_FILE + "*") + \
+            glob.glob(DUMP_FILE + "*"):
+        os.remove(path)
+
+def user_insert(i):
+    return f"insert into users values ({i}, 'user{i % 500}', 'user{i}@example.com')"
+
+def create_database(extra_args):
+    ids = list(range(1, NUM_ROWS + 1))
+    random.seed(7)
+    random.shuffle(ids)
+    run_db(DB_FILE,
+           ["create table users (id int, username varchar(32), email varchar(255))",
+            "create table items (id int, name varchar(32))"]
+           + [user_insert(i) for i in ids]
+           + [f"insert into items values ({i}, 'item{i}')" for i in ids[:5000]],
+           extra_args)
+
+def contents(db_file, extra_args):
+    return rows_of(run_db(db_file,
+                          ["select * from users", "select * from items",
+                           "select * from users where username = 'user42'"],
+                          extra_args))
+
+def tool(db_file, option, path, extra_args):
+    start = time.time()
+    result = subprocess.run(["./db", db_file, option, path] + extra_args,
+                            capture_output=True, text=True)
+    return result, time.time() - start
+
+def test_round_trip(extra_args):
+    print("Dumping and loading into a new database...")
+    result, elapsed = tool(DB_FILE, "--dump", DUMP_FILE, extra_args)
+    if result.returncode != 0 or "Dumped 25000 rows from 2 tables." \
+            not in result.stdout:
+        print(f"FAIL: dump failed: {result.stdout}")
+        return False
+    print(f"  dump took {elapsed:.3f}s")
+    result, elapsed = tool(COPY_FILE, "--load", DUMP_FILE, extra_args)
+    if result.returncode != 0 or "Loaded 25000 rows into 2 tables." \
+            not in result.stdout:
+        print(f"FAIL: load failed: {result.stdout}")
+        return False
+    print(f"  load took {elapsed:.3f}s")
+
+    expected = contents(DB_FILE, extra_args)
+    if contents(COPY_FILE, extra_args) != expected or len(expected) < 25000:
+        print("FAIL: the loaded database differs from the dumped one")
+        return False
+    # The loaded trees and index take new rows like any other
+    lines = rows_of(run_db(COPY_FILE,
+                           [user_insert(NUM_ROWS + 42),
+                            "delete from users where id = 42",
+                            "select * from users where username = 'user42'"],
+                           extra_args))
+    if "(42, user42, user42@example.com)" in lines or \
+            f"({NUM_ROWS + 42}, user42, user{NUM_ROWS + 42}@example.com)" \
+            not in lines:
+        print(f"FAIL: the loaded index is off: {lines}")
+        return False
+    return True
+
+def test_duplicate_keys(extra_args):
+    print("Loading a dump into a database that already has its rows...")
+    before = contents(COPY_FILE, extra_args)
+    result, _ = tool(COPY_FILE, "--load", DUMP_FILE, extra_args)
+    if result.returncode == 0 or "Duplicate key" not in result.stdout:
+        print(f"FAIL: duplicate keys were not reported: {result.stdout}")
+        return False
+    if contents(COPY_FILE, extra_args) != before:
+        print("FAIL: a failed load changed the database")
+        return False
+    return True
+
+def write_dump(path, table, columns, cells):
+    """Writes a dump by hand, rows in the order given"""
+    row_size = sum(size for _, _, size in columns)
+    with open(path, "wb") as f:
+        f.write(struct.pack("<II", DUMP_MAGIC, 1))
+        entry = table.encode().ljust(TABLE_NAME_SIZE, b"\0")
+        entry += struct.pack("<II", len(columns), row_size)
+        offset = 0
+        for name, kind, size in columns:
+            entry += name.encode().ljust(32, b"\0")
+            entry += struct.pack("<III", kind, size, offset)
+            offset += size
+        entry += b"\0" * (44 * (MAX_COLUMNS - len(columns)))
+        f.write(entry)
+        for start in range(0, len(cells), 1024):
+            batch = cells[start:start + 1024]
+            f.write(struct.pack("<I", len(batch)) + b"".join(batch))
+        f.write(struct.pack("<I", 0))
+        f.write(b"\0" * len(entry))
+
+def test_unsorted_merge(extra_args):
+    print("Loading unsorted rows into a table that has rows...")
+    # items is varchar(32) in name only: created columns take 255 bytes
+    columns = [("id", 0, 4), ("name", 1, 255)]
+    ids = list(range(NUM_ROWS + 1, NUM_ROWS + 3001))
+    random.shuffle(ids)
+    cells = [struct.pack("<II", i, i) + f"item{i}".encode().ljust(255, b"\0")
+             for i in ids]
+    write_dump(DUMP_FILE + ".unsorted", "items", columns, cells)
+    result, _ = tool(COPY_FILE, "--load", DUMP_FILE + ".unsorted", extra_args)
+    if result.returncode != 0:
+        print(f"FAIL: load failed: {result.stdout}")
+        return False
+    rows = rows_of(run_db(COPY_FILE, ["select * from items"], extra_args))
+    expected = sorted(int(line[1:line.index(",")]) for line in rows)
+    if [int(line[1:line.index(",")]) for line in rows] != expected or \
+            len(rows) != 5000 + 3000:
+        print(f"FAIL: the merged table has {len(rows)} rows or is out of order")
+        return False
+
+    print("Loading rows of another shape...")
+    write_dump(DUMP_FILE + ".other", "items", [("id", 0, 4)],
+               [struct.pack("<II", 1, 1)])
+    result, _ = tool(COPY_FILE, "--load", DUMP_FILE + ".other", extra_args)
+    if result.returncode == 0 or "does not match" not in result.stdout:
+        print(f"FAIL: a schema mismatch was not reported: {result.stdout}")
+        return False
+    return True
+
+if __name__ == "__main__":
+    for mode in ([], ["--wal"], ["--file-per-table"]):
+        cleanup()
+        try:
+            create_database(mode)
+            for test in (test_round_trip, test_duplicate_keys,
+                         test_unsorted_merge):
+                if not test(mode):
+                    sys.exit(1)
+            print("Dump/Load Test Passed!", mode)
+        finally:
+            cleanup()
+    sys.exit(0)
@@ -0,0 +1,92 @@
+import glob
+import sys
+import os
+from db_helpers import insert_users, rows_of, run_db, user_rows
+
+DB_FILE = "test_file_per_table.db"
+NUM_ROWS = 500
+
+def cleanup():
+    for path in glob.glob(DB_FILE + "*"):
+        os.remove(path)
+
+def test_file_per_table():
+    users_file = DB_FILE + ".users.tbl"
+    items_file = DB_FILE + ".items.tbl"
+
+    print(f"Creating two tables in their own files, {NUM_ROWS} rows each...")
+    run_db(DB_FILE, ["create table users (id int, username varchar(32), email varchar(255))",
+                     "create table items (id int, name varchar(32))"]
+                    + insert_users(range(1, NUM_ROWS + 1))
+                    + [f"insert into items values ({i}, 'item{i}')"
+                       for i in range(1, NUM_ROWS + 1)],
+                    ["--file-per-table"])
+    if not os.path.exists(users_file) or not os.path.exists(items_file):
+        print("FAIL: table files were not created")
+        return False
+    # The catalog only holds the meta and directory pages
+    if os.path.getsize(DB_FILE) >= os.path.getsize(items_file):
+        print("FAIL: rows went to the catalog file")
+        return False
+
+    # The mode comes from the catalog, not the command line
+    output = run_db(DB_FILE, ["select * from users", "select * from items"])
+    if rows_of(output) != (user_rows(range(1, NUM_ROWS + 1))
+                           + [f"({i}, item{i})" for i in range(1, NUM_ROWS + 1)]):
+        print("FAIL: rows differ after reopening")
+        return False
+
+    print("Rolling back a transaction that touched both files...")
+    output = run_db(DB_FILE, ["begin",
+                              "insert into users values (9001, 'user9001', 'user9001@example.com')",
+                              "insert into items values (9001, 'item9001')",
+                              "delete from users where username = 'user1'",
+                              "rollback",
+                              "select * from users where id = 9001",
+                              "select * from items where id = 9001",
+                              "select * from users where id = 1"])
+    if rows_of(output) != user_rows([1]):
+        print(f"FAIL: rollback left {rows_of(output)}")
+        return False
+
+    print("Dropping a table removes its file...")
+    output = run_db(DB_FILE, ["drop table items", "select * from users where id = 7"])
+    if os.path.exists(items_file) or rows_of(output) != user_rows([7]):
+        print("FAIL: drop table")
+        return False
+    output = run_db(DB_FILE, ["select * from items",
+                              "create table items (id int, name varchar(32))",
+                              "insert into items values (1, 'again')",
+                              "select * from items"])
+    if "not found" not in output or rows_of(output) != ["(1, again)"]:
+        print("FAIL: dropped table still visible, or cannot be recreated")
+        return False
+    return True
+
+def test_single_file_drop():
+    print("Dropping a table in a single-file database frees its pages...")
+    commands = (["create table items (id int, name varchar(32))"]
+                + [f"insert into items values ({i}, 'item{i}')"
+                   for i in range(1, NUM_ROWS + 1)])
+    run_db(DB_FILE, commands)
+    size = os.path.getsize(DB_FILE)
+    run_db(DB_FILE, ["drop table items"])
+    run_db(DB_FILE, commands)
+    if os.path.getsize(DB_FILE) > size:
+        print("FAIL: dropped table's pages were not reused")
+        return False
+    if len(rows_of(run_db(DB_FILE, ["select * from items"]))) != NUM_ROWS:
+        print("FAIL: recreated table is wrong")
+        return False
+    return True
+
+if __name__ == "__main__":
+    try:
+        for test in (test_file_per_table, test_single_file_drop):
+            cleanup()
+            if not test():
+                sys.exit(1)
+        print("File Per Table Test Passed!")
+    finally:
+        cleanup()
+    sys.exit(0)
@@ -0,0 +1,46 @@
+import sys
+import os
+from db_helpers import insert_users, rows_of, run_db
+
+DB_FILE = "test_freelist.db"
+NUM_ROWS = 1000
+
+def run_test():
+    if os.path.exists(DB_FILE):
+        os.remove(DB_FILE)
+
+    try:
+        run_db(DB_FILE,
+               ["create table users (id int, username varchar(32), email varchar(255))"]
+               + insert_users(range(1, NUM_ROWS + 1)))
+        size_after_insert = os.path.getsize(DB_FILE)
+
+        # Each round empties every leaf and refills the table
+        for round_num in range(3):
+            print(f"Round {round_num + 1}: delete all, insert {NUM_ROWS} rows...")
+            if rows_of(run_db(DB_FILE, ["delete from users", "select * from users"])) != []:
+                print("FAIL: rows left after delete")
+                return False
+            run_db(DB_FILE, insert_users(range(1, NUM_ROWS + 1)))
+
+            rows = rows_of(run_db(DB_FILE, ["select * from users"]))
+            if len(rows) != NUM_ROWS:
+                print(f"FAIL: expected {NUM_ROWS} rows, got {len(rows)}")
+                return False
+
+            size = os.path.getsize(DB_FILE)
+            if size != size_after_insert:
+                print(f"FAIL: file grew from {size_after_insert} to {size} bytes")
+                return False
+
+        print("Freelist Test Passed!")
+        return True
+    finally:
+        if os.path.exists(DB_FILE):
+            os.remove(DB_FILE)
+
+if __name__ == "__main__":
+    if run_test():
+        sys.exit(0)
+    else:
+        sys.exit(1)
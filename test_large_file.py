@@ -0,0 +1,44 @@
+import sys
+import os
+from db_helpers import insert_users, rows_of, run_db, user_rows
+
+DB_FILE = "test_large_file.db"
+SPARSE_SIZE = 5 << 30  # Past 4GB, so new pages need 64-bit offsets
+NUM_ROWS = 400
+
+def run_test(extra_args):
+    if os.path.exists(DB_FILE):
+        os.remove(DB_FILE)
+
+    try:
+        half = NUM_ROWS // 2
+        run_db(DB_FILE,
+               ["create table users (id int, username varchar(32), email varchar(255))"]
+               + insert_users(range(1, half + 1)), extra_args)
+
+        # Grow the file without writing anything: the unused pages in between
+        # stay holes, and every page allocated from here on lies past 4GB
+        with open(DB_FILE, "r+b") as f:
+            f.truncate(SPARSE_SIZE)
+
+        run_db(DB_FILE, insert_users(range(half + 1, NUM_ROWS + 1)), extra_args)
+        if os.path.getsize(DB_FILE) <= SPARSE_SIZE:
+            print("FAIL: no pages were written past the 4GB mark")
+            return False
+
+        rows = rows_of(run_db(DB_FILE, ["select * from users"], extra_args))
+        if rows != user_rows(range(1, NUM_ROWS + 1)):
+            print(f"FAIL: expected {NUM_ROWS} rows, got {len(rows)}")
+            return False
+
+        print(f"Large File Test Passed! {extra_args}")
+        return True
+    finally:
+        if os.path.exists(DB_FILE):
+            os.remove(DB_FILE)
+
+if __name__ == "__main__":
+    for extra_args in ([], ["--mmap"], ["--io-uring"]):
+        if not run_test(extra_args):
+            sys.exit(1)
+    sys.exit(0)
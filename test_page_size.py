@@ -0,0 +1,42 @@
+import random
+import sys
+import os
+from db_helpers import insert_users, rows_of, run_db, user_rows
+
+DB_FILE = "test_page_size.db"
+NUM_ROWS = 2000
+
+def run_test(page_size):
+    if os.path.exists(DB_FILE):
+        os.remove(DB_FILE)
+
+    try:
+        ids = list(range(1, NUM_ROWS + 1))
+        random.shuffle(ids)
+        print(f"Page size {page_size}: inserting {NUM_ROWS} rows in random order...")
+        run_db(DB_FILE,
+               ["create table users (id int, username varchar(32), email varchar(255))"]
+               + insert_users(ids),
+               ["--page-size", str(page_size), "--cache-pages", "16"])
+
+        if os.path.getsize(DB_FILE) % page_size != 0:
+            print("FAIL: file is not a whole number of pages")
+            return False
+
+        # Reopen without the option: the size must come from the file itself
+        rows = rows_of(run_db(DB_FILE, ["select * from users"]))
+        if rows != user_rows(range(1, NUM_ROWS + 1)):
+            print(f"FAIL: expected {NUM_ROWS} ordered rows, got {len(rows)}")
+            return False
+
+        print(f"Page Size Test Passed! {page_size}")
+        return True
+    finally:
+        if os.path.exists(DB_FILE):
+            os.remove(DB_FILE)
+
+if __name__ == "__main__":
+    for page_size in (4096, 16384, 65536):
+        if not run_test(page_size):
+            sys.exit(1)
+    sys.exit(0)
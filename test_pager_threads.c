@@ -0,0 +1,130 @@
+/*
+ * Buffer pool stress test, built with ThreadSanitizer by
+ * "make test_pager_threads" and run by test_pager_threads.py.
+ *
+ * THREADS threads latch random pages of a file many times larger than the
+ * pool, so nearly every access evicts a frame another thread may want. Each
+ * page holds its own number and a counter: readers check the number, writers
+ * bump the counter. At the end every counter must match the bumps made to
+ * it, both in the pool and after the file is reopened.
+ */
+#include "pager.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define THREADS 8
+#define NUM_PAGES 256
+#define ROUNDS 20000
+
+static Pager *pager;
+static _Atomic uint32_t bumps[NUM_PAGES];
+static _Atomic bool failed;
+
+static uint32_t *page_words(void *page) { return (uint32_t *)page; }
+
+static void *worker(void *arg) {
+  uint32_t seed = (uint32_t)(uintptr_t)arg;
+  for (uint32_t round = 0; round < ROUNDS && !failed; round++) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t page_num = 1 + (seed >> 8) % (NUM_PAGES - 1);
+    bool exclusive = (seed >> 4) % 4 == 0;
+
+    if ((seed >> 2) % 64 == 0) {
+      uint32_t ahead[4];
+      for (uint32_t i = 0; i < 4; i++) {
+        ahead[i] = 1 + (page_num + i) % (NUM_PAGES - 1);
+      }
+      pager_prefetch(pager, ahead, 4);
+    }
+
+    uint32_t *words = page_words(pager_acquire(pager, page_num, exclusive));
+    if (words[0] != page_num) {
+      printf("FAIL: page %u holds page %u\n", page_num, words[0]);
+      failed = true;
+    } else if (exclusive) {
+      pager_mark_dirty(pager, page_num);
+      words[1]++;
+      bumps[page_num]++;
+    }
+    pager_release(pager, page_num);
+  }
+  return NULL;
+}
+
+// Every page's counter matches the bumps made to it
+static bool check_counters(void) {
+  bool ok = true;
+  for (uint32_t page_num = 1; page_num < NUM_PAGES; page_num++) {
+    uint32_t *words = page_words(pager_acquire(pager, page_num, false));
+    if (words[0] != page_num || words[1] != bumps[page_num]) {
+      printf("FAIL: page %u holds (%u, %u), expected (%u, %u)\n", page_num,
+             words[0], words[1], page_num, bumps[page_num]);
+      ok = false;
+    }
+    pager_release(pager, page_num);
+  }
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s <filename> [--mmap] [--io-uring] [--compress]\n",
+           argv[0]);
+    return EXIT_FAILURE;
+  }
+  PagerOptions options;
+  pager_options_init(&options);
+  options.cache_frames = MIN_CACHE_FRAMES;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--mmap") == 0) {
+      options.use_mmap = true;
+    } else if (strcmp(argv[i], "--io-uring") == 0) {
+      options.use_io_uring = true;
+    } else if (strcmp(argv[i], "--compress") == 0) {
+      options.compress = true;
+    }
+  }
+  unlink(argv[1]);
+  pager = pager_open(argv[1], &options);
+
+  pager_begin_statement(pager);
+  for (uint32_t page_num = 0; page_num < NUM_PAGES; page_num++) {
+    uint32_t *words = page_words(pin_page(pager, page_num));
+    pager_mark_dirty(pager, page_num);
+    memset(words, 0, pager->page_size);
+    words[0] = page_num;
+    unpin_page(pager, page_num);
+  }
+  pager_flush_all(pager);
+  pager_end_statement(pager);
+
+  pthread_t threads[THREADS];
+  for (uintptr_t i = 0; i < THREADS; i++) {
+    pthread_create(&threads[i], NULL, worker, (void *)(i + 1));
+  }
+  for (uint32_t i = 0; i < THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  if (failed || !check_counters()) {
+    return EXIT_FAILURE;
+  }
+
+  pager_begin_statement(pager);
+  pager_flush_all(pager);
+  pager_end_statement(pager);
+  pager_close(pager);
+  pager = pager_open(argv[1], &options);
+  bool ok = check_counters();
+  pager_close(pager);
+  unlink(argv[1]);
+  if (!ok) {
+    return EXIT_FAILURE;
+  }
+  printf("%d threads, %d pages, %d frames: counters match\n", THREADS,
+         NUM_PAGES, MIN_CACHE_FRAMES);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,43 @@
+import os
+import subprocess
+import sys
+
+DB_FILE = "test_pager_threads.db"
+BINARY = "./test_pager_threads"
+
+def build():
+    """Builds the stress test with the same compiler as ./db, if given"""
+    command = ["make", "test_pager_threads"]
+    if "CC" in os.environ:
+        command.append(f"CC={os.environ['CC']}")
+    result = subprocess.run(command, capture_output=True, text=True)
+    if result.returncode != 0:
+        print(f"FAIL: could not build {BINARY}:\n{result.stdout}{result.stderr}")
+        return False
+    return True
+
+def run_test(extra_args):
+    print(f"Latching pages from many threads... {' '.join(extra_args)}")
+    try:
+        result = subprocess.run([BINARY, DB_FILE] + extra_args,
+                                capture_output=True, text=True, timeout=600)
+    finally:
+        if os.path.exists(DB_FILE):
+            os.remove(DB_FILE)
+    # ThreadSanitizer reports races on stderr and exits with 66
+    if result.returncode != 0 or "ThreadSanitizer" in result.stderr:
+        print(f"FAIL: exit code {result.returncode}\n{result.stdout}"
+              f"{result.stderr[:4000]}")
+        return False
+    print(result.stdout.strip())
+    return True
+
+if __name__ == "__main__":
+    if not build():
+        sys.exit(1)
+    # Each backend takes io_latch differently on a miss
+    for extra_args in ([], ["--mmap"], ["--io-uring"], ["--compress"]):
+        if not run_test(extra_args):
+            sys.exit(1)
+    print("Pager Threads Test Passed!")
+    sys.exit(0)
@@ -0,0 +1,99 @@
+import random
+import struct
+import sys
+import os
+from db_helpers import insert_users, rows_of, run_db, user_rows
+
+DB_FILE = "test_reorganize.db"
+PAGE_SIZE = 4096
+NUM_ROWS = 3000
+
+# Node layout, see include/node.h
+NODE_LEAF = 1
+LEAF_NEXT_OFFSET = 10
+INTERNAL_FIRST_CHILD_OFFSET = 14
+
+def leaf_chain(root):
+    with open(DB_FILE, "rb") as f:
+        data = f.read()
+    page_num = root
+    page = data[page_num * PAGE_SIZE:(page_num + 1) * PAGE_SIZE]
+    while page[0] != NODE_LEAF:
+        page_num = struct.unpack_from("<I", page, INTERNAL_FIRST_CHILD_OFFSET)[0]
+        page = data[page_num * PAGE_SIZE:(page_num + 1) * PAGE_SIZE]
+
+    chain = []
+    while page_num != 0:
+        chain.append(page_num)
+        page = data[page_num * PAGE_SIZE:(page_num + 1) * PAGE_SIZE]
+        page_num = struct.unpack_from("<I", page, LEAF_NEXT_OFFSET)[0]
+    return chain
+
+def run_test(extra_args):
+    if os.path.exists(DB_FILE):
+        os.remove(DB_FILE)
+
+    try:
+        output = run_db(DB_FILE, ["create table users (id int, username varchar(32), email varchar(255))"])
+        root = int(output.split("New root page num: ")[1].split()[0])
+
+        ids = list(range(1, NUM_ROWS + 1))
+        random.shuffle(ids)
+        print(f"{extra_args}: inserting {NUM_ROWS} rows in random order, "
+              "deleting most of them...")
+        run_db(DB_FILE, insert_users(ids), extra_args)
+        kept = sorted(random.sample(ids, NUM_ROWS // 5))
+        kept_set = set(kept)
+        run_db(DB_FILE, [f"delete from users where id = {i}"
+                         for i in ids if i not in kept_set], extra_args)
+        size_before = os.path.getsize(DB_FILE)
+
+        output = run_db(DB_FILE, ["reorganize table users"], extra_args)
+        if "Table reorganized" not in output:
+            print("FAIL: REORGANIZE did not run")
+            return False
+        size_after = os.path.getsize(DB_FILE)
+        print(f"File shrank from {size_before} to {size_after} bytes")
+        if size_after >= size_before * 0.6:
+            print("FAIL: file did not shrink")
+            return False
+
+        expected = user_rows(kept)
+        if rows_of(run_db(DB_FILE, ["select * from users"], extra_args)) != expected:
+            print("FAIL: rows changed")
+            return False
+
+        if not extra_args:
+            # Ascending, with gaps only where the index tree still sat while
+            # the table was rebuilt
+            chain = leaf_chain(root)
+            adjacent = sum(1 for x, y in zip(chain, chain[1:]) if y == x + 1)
+            if chain != sorted(chain) or adjacent < (len(chain) - 1) * 0.9:
+                print(f"FAIL: leaves are not in page order: {chain}")
+                return False
+
+        # The packed tree must still take inserts (full leaves split) and
+        # index deletes
+        added = [i for i in range(NUM_ROWS + 1, NUM_ROWS + 301)]
+        gone = kept[::3]
+        run_db(DB_FILE,
+               insert_users(added)
+               + [f"delete from users where username = 'user{i}'" for i in gone],
+               extra_args)
+        remaining = sorted(set(kept + added) - set(gone))
+        expected = user_rows(remaining)
+        if rows_of(run_db(DB_FILE, ["select * from users"], extra_args)) != expected:
+            print("FAIL: rows wrong after inserting into the rebuilt tree")
+            return False
+
+        print(f"Reorganize Test Passed! {extra_args}")
+        return True
+    finally:
+        if os.path.exists(DB_FILE):
+            os.remove(DB_FILE)
+
+if __name__ == "__main__":
+    for extra_args in ([], ["--mmap"], ["--compress"], ["--wal"]):
+        if not run_test(extra_args):
+            sys.exit(1)
+    sys.exit(0)
@@ -0,0 +1,177 @@
+import glob
+import os
+import subprocess
+import sys
+import time
+from db_helpers import Client, run_db, start_server
+
+DB_FILE = "test_replication.db"
+REPLICA_FILES = ["test_replication_a.db", "test_replication_b.db"]
+PRIMARY_PORT = 8088
+REPLICATION_PORT = 9090
+REPLICA_PORTS = [8089, 8090]
+NUM_ROWS = 5000
+
+class Session(Client):
+    """A client for servers whose failed commands print no 'Executed.'"""
+    def execute(self, command):
+        """Reads up to "Executed." or the error line that replaces it"""
+        self.send(command)
+        lines = []
+        while True:
+            line = self.reply(b"\n")[0]
+            lines.append(line)
+            # A missing table's error is followed by a second one
+            if line == "Executed." or line.startswith("Error") and \
+                    not line.endswith("not found."):
+                return lines
+
+def insert(i):
+    return f"insert into items values ({i}, 'item{i}')"
+
+def cleanup():
+    for name in [DB_FILE] + REPLICA_FILES:
+        for path in glob.glob(name + "*"):
+            os.remove(path)
+
+def start_primary(extra_args):
+    run_db(DB_FILE,
+           ["create table items (id int, name varchar(32))"]
+           + [insert(i) for i in range(1, NUM_ROWS + 1)], extra_args)
+    return start_server(DB_FILE, PRIMARY_PORT,
+                        ["--replicate", str(REPLICATION_PORT)] + extra_args)
+
+def start_replica(n):
+    return start_server(REPLICA_FILES[n], REPLICA_PORTS[n],
+                        ["--port", str(REPLICA_PORTS[n]), "--replica-of",
+                         f"localhost:{REPLICATION_PORT}"])
+
+def ids(client, table="items"):
+    return [int(line[1:line.index(",")])
+            for line in client.execute(f"select * from {table}")
+            if line.startswith("(")]
+
+def wait_for(client, expected, table="items"):
+    """Polls a replica until the table holds the expected ids"""
+    for _ in range(100):
+        if ids(client, table) == expected:
+            return True
+        time.sleep(0.05)
+    return False
+
+def test_streaming(primary, replica):
+    print("Reading the primary's commits on a replica...")
+    expected = list(range(1, NUM_ROWS + 1))
+    if ids(replica) != expected:
+        print("FAIL: the replica's copy is missing rows")
+        return False
+
+    # Autocommitted inserts go out with the next sync
+    for i in range(NUM_ROWS + 1, NUM_ROWS + 101):
+        primary.execute(insert(i))
+    expected += list(range(NUM_ROWS + 1, NUM_ROWS + 101))
+    if not wait_for(replica, expected):
+        print("FAIL: autocommitted inserts did not reach the replica")
+        return False
+
+    # A transaction is shipped when it commits, not before
+    primary.execute("begin")
+    primary.execute(insert(NUM_ROWS + 500))
+    time.sleep(1.5)
+    if NUM_ROWS + 500 in ids(replica):
+        print("FAIL: the replica shows an uncommitted insert")
+        return False
+    primary.execute("commit")
+    if not wait_for(replica, expected + [NUM_ROWS + 500]):
+        print("FAIL: a committed transaction did not reach the replica")
+        return False
+
+    print("Creating a table on the primary...")
+    primary.execute("create table notes (id int, body varchar(32))")
+    primary.execute("insert into notes values (7, 'seven')")
+    if not wait_for(replica, [7], "notes"):
+        print("FAIL: the new table did not reach the replica")
+        return False
+    return True
+
+def test_read_only(replica):
+    print("Writing to a replica...")
+    for command in (insert(NUM_ROWS + 900), "delete from items where id = 1",
+                    "create table other (id int)"):
+        reply = replica.execute(command)
+        if reply[-1] != "Error: Read-only replica.":
+            print(f"FAIL: unexpected reply to '{command}': {reply}")
+            return False
+    if NUM_ROWS + 900 in ids(replica) or 1 not in ids(replica):
+        print("FAIL: the replica was changed")
+        return False
+    return True
+
+def test_second_replica(primary, replica):
+    print("Adding a second replica...")
+    server = start_replica(1)
+    second = Session(REPLICA_PORTS[1])
+    try:
+        primary.execute(insert(NUM_ROWS + 1000))
+        expected = ids(primary)
+        if not wait_for(second, expected) or not wait_for(replica, expected):
+            print("FAIL: the replicas do not match the primary")
+            return False
+    finally:
+        second.close()
+        server.kill()
+        server.wait()
+    return True
+
+def test_standby(primary_server, replica):
+    print("Reading a replica after the primary stops...")
+    expected = ids(replica)
+    primary_server.kill()
+    primary_server.wait()
+    time.sleep(0.2)
+    if ids(replica) != expected:
+        print("FAIL: the replica lost rows with its primary")
+        return False
+    return True
+
+def test_unsupported():
+    print("Replicating a file-per-table database...")
+    result = subprocess.run(
+        ["./db", DB_FILE, "--server", "--file-per-table", "--port", "8091",
+         "--replicate", str(REPLICATION_PORT)],
+        capture_output=True, text=True, timeout=10)
+    if result.returncode == 0 or "can be replicated" not in result.stdout:
+        print(f"FAIL: unexpected result: {result.stdout}")
+        return False
+    return True
+
+if __name__ == "__main__":
+    for mode in ([], ["--wal"]):
+        cleanup()
+        primary_server = start_primary(mode)
+        replica_server = None
+        try:
+            replica_server = start_replica(0)
+            primary = Session(PRIMARY_PORT)
+            replica = Session(REPLICA_PORTS[0])
+            if not test_streaming(primary, replica) or \
+                    not test_read_only(replica) or \
+                    not test_second_replica(primary, replica) or \
+                    not test_standby(primary_server, replica):
+                sys.exit(1)
+            primary.close()
+            replica.close()
+            print("Replication Test Passed!", mode)
+        finally:
+            for server in (primary_server, replica_server):
+                if server is not None:
+                    server.kill()
+                    server.wait()
+            cleanup()
+    cleanup()
+    try:
+        if not test_unsupported():
+            sys.exit(1)
+    finally:
+        cleanup()
+    sys.exit(0)
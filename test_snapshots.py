@@ -0,0 +1,115 @@
+import glob
+import os
+import socket
+import sys
+import time
+from db_helpers import Client, insert_users, rows_of, run_db, server_stats, \
+    start_server, user_rows
+
+DB_FILE = "test_snapshots.db"
+PORT = 8088
+NUM_ROWS = 20000
+
+def insert(i):
+    return f"insert into users values ({i}, 'user{i}', 'user{i}@example.com')"
+
+def cleanup():
+    for path in glob.glob(DB_FILE + "*"):
+        os.remove(path)
+
+def start(extra_args):
+    run_db(DB_FILE,
+           ["create table users (id int, username varchar(32), email varchar(255))"]
+           + insert_users(range(1, NUM_ROWS + 1)), extra_args)
+    return start_server(DB_FILE, PORT, extra_args)
+
+def test_isolation():
+    print("Reading around another session's open transaction...")
+    writer, reader = Client(PORT), Client(PORT)
+    writer.execute("begin")
+    writer.execute(insert(NUM_ROWS + 1))
+    writer.execute("delete from users where id = 1")
+
+    if rows_of(reader.execute(f"select * from users where id = {NUM_ROWS + 1}")):
+        print("FAIL: another session saw an uncommitted insert")
+        return False
+    if rows_of(reader.execute("select * from users where id = 1")) != user_rows([1]):
+        print("FAIL: another session saw an uncommitted delete")
+        return False
+    if rows_of(writer.execute(f"select * from users where id = {NUM_ROWS + 1}")) \
+            != user_rows([NUM_ROWS + 1]):
+        print("FAIL: the transaction does not see its own insert")
+        return False
+
+    writer.execute("commit")
+    if rows_of(reader.execute("select * from users where id = 1")):
+        print("FAIL: the committed delete is not visible")
+        return False
+    writer.execute("delete from users where id = 2")
+    reader.execute("begin")
+    if rows_of(reader.execute("select * from users where id = 2")):
+        print("FAIL: an autocommitted delete is not visible")
+        return False
+    reader.execute("rollback")
+    writer.close()
+    reader.close()
+    return True
+
+def test_long_select():
+    print(f"Writing while a {NUM_ROWS}-row SELECT is stalled mid-scan...")
+    before = rows_of(Client(PORT).execute("select * from users"))
+
+    # The reader stops consuming, so the server blocks writing its rows
+    reader = Client(PORT, receive_buffer=4096)
+    reader.send("select * from users")
+    time.sleep(0.5)
+
+    writer = Client(PORT)
+    start = time.time()
+    try:
+        for i in range(30001, 30011):
+            writer.execute(insert(i))
+        writer.execute("delete from users where id = 3")
+        writer.execute("begin")
+        writer.execute(insert(30011))
+        writer.execute("commit")
+    except socket.timeout:
+        print("FAIL: writes waited for the SELECT")
+        return False
+    print(f"  11 writes took {time.time() - start:.3f}s")
+
+    during = server_stats(PORT)
+    rows = rows_of(reader.reply())
+    if rows != before:
+        print(f"FAIL: the SELECT saw {len(rows)} rows, {len(before)} were committed")
+        return False
+    if during.get("version_reads", 0) == 0:
+        print(f"FAIL: the SELECT never read a replaced page: {during}")
+        return False
+
+    after = server_stats(PORT)
+    if after.get("versions", -1) != 0:
+        print(f"FAIL: versions were not freed: {after}")
+        return False
+    rows = rows_of(reader.execute("select * from users"))
+    if rows[-11:] != user_rows(range(30001, 30012)) or user_rows([3])[0] in rows:
+        print(f"FAIL: writes missing after the SELECT: {rows[-11:]}")
+        return False
+    reader.close()
+    writer.close()
+    return True
+
+if __name__ == "__main__":
+    for mode in ([], ["--wal"], ["--file-per-table"]):
+        cleanup()
+        server = start(mode)
+        try:
+            for test in (test_isolation, test_long_select):
+                if not test():
+                    sys.exit(1)
+            print("Snapshots Test Passed!", mode)
+        finally:
+            server.kill()
+            server.wait()
+            cleanup()
+    sys.exit(0)
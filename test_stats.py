@@ -0,0 +1,49 @@
+import sys
+import os
+from db_helpers import insert_users, parse_stats, run_db
+
+DB_FILE = "test_stats.db"
+CACHE_ARGS = ["--cache-pages", "16"]
+
+def run_test():
+    if os.path.exists(DB_FILE):
+        os.remove(DB_FILE)
+
+    try:
+        run_db(DB_FILE,
+               ["create table users (id int, username varchar(32), email varchar(255))"]
+               + insert_users(range(1, 501)), CACHE_ARGS)
+
+        print("Scanning with a 16-page cache...")
+        stats = parse_stats(run_db(DB_FILE,
+                                   [".stats reset", "select * from users", "begin",
+                                    "insert into users values (501, 'x', 'y')",
+                                    "rollback", ".stats"], CACHE_ARGS))
+
+        checks = [
+            ("misses", stats.get("misses", 0) > 0),
+            ("hits", stats.get("hits", 0) > 0),
+            ("bytes_read", stats.get("bytes_read", 0) ==
+                stats.get("pages_read", -1) * stats.get("page_size", 0)),
+            ("evictions", stats.get("evictions", 0) > 0),
+            ("rollbacks", stats.get("rollbacks", 0) == 1),
+            ("rollback_restores", stats.get("rollback_restores", 0) > 0),
+            ("undo_images", stats.get("undo_images", 0) > 0),
+            ("read_latency", any(k.startswith("read_latency_us") for k in stats)),
+        ]
+        for name, ok in checks:
+            if not ok:
+                print(f"FAIL: unexpected {name} in {stats}")
+                return False
+
+        print("Stats Test Passed!")
+        return True
+    finally:
+        if os.path.exists(DB_FILE):
+            os.remove(DB_FILE)
+
+if __name__ == "__main__":
+    if run_test():
+        sys.exit(0)
+    else:
+        sys.exit(1)
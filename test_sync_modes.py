@@ -0,0 +1,84 @@
+import glob
+import os
+import sys
+from db_helpers import crash_db, insert_users, parse_stats, rows_of, run_db, \
+    user_rows
+
+DB_FILE = "test_sync_modes.db"
+
+def cleanup():
+    for path in glob.glob(DB_FILE + "*"):
+        os.remove(path)
+
+def crash_test(mode, extra_args=[], wait=1.0):
+    print(f"Killing a session in sync {mode} mode{' '.join([''] + extra_args)}...")
+    run_db(DB_FILE,
+           ["create table users (id int, username varchar(32), email varchar(255))"],
+           extra_args)
+    stats = parse_stats(crash_db(DB_FILE, [f".sync {mode}"]
+                                 + insert_users(range(1, 151)) + [".stats"],
+                                 extra_args, wait))
+    rows = rows_of(run_db(DB_FILE, ["select * from users"]))
+    if rows != user_rows(range(1, 151)):
+        print(f"FAIL: expected 150 rows after the crash, got {len(rows)}")
+        return None
+    return stats
+
+def test_full():
+    stats = crash_test("full")
+    if stats is None:
+        return False
+    if stats.get("syncs", 0) < 150:
+        print(f"FAIL: expected a sync per statement: {stats}")
+        return False
+    return True
+
+def test_full_wal():
+    stats = crash_test("full", ["--wal"])
+    if stats is None:
+        return False
+    if stats.get("wal_commits", 0) < 150:
+        print(f"FAIL: expected a log commit per statement: {stats}")
+        return False
+    return True
+
+def test_normal():
+    # The last 50 statements are only synced by the interval
+    stats = crash_test("normal", wait=2.5)
+    if stats is None:
+        return False
+    if not 0 < stats.get("syncs", 0) < 10:
+        print(f"FAIL: expected a few batched syncs: {stats}")
+        return False
+    return True
+
+def test_off_and_command():
+    print("Checking the default mode and the meta-command...")
+    output = run_db(DB_FILE,
+                    [".sync",
+                     "create table users (id int, username varchar(32), email varchar(255))"]
+                    + insert_users(range(1, 11))
+                    + [".stats", ".sync fast", ".sync full", ".sync off", ".sync"])
+    lines = output.split("\n")
+    if "sync off" not in lines[1]:
+        print(f"FAIL: default mode is not off: {lines[:2]}")
+        return False
+    if parse_stats(lines).get("syncs", -1) != 0:
+        print("FAIL: off mode synced")
+        return False
+    if ("Unknown sync mode 'fast'" not in output or "sync full" not in output
+            or "sync off" not in lines[-3]):
+        print(f"FAIL: unexpected meta-command output: {lines[-8:]}")
+        return False
+    return True
+
+if __name__ == "__main__":
+    try:
+        for test in (test_full, test_full_wal, test_normal, test_off_and_command):
+            cleanup()
+            if not test():
+                sys.exit(1)
+        print("Sync Modes Test Passed!")
+    finally:
+        cleanup()
+    sys.exit(0)
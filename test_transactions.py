@@ -0,0 +1,169 @@
+import glob
+import os
+import socket
+import sys
+from db_helpers import Client, run_db, server_stats, start_server
+
+DB_FILE = "test_transactions.db"
+PORT = 8088
+NUM_ROWS = 10000  # Even ids 2 .. 2 * NUM_ROWS
+LAST_ID = 2 * NUM_ROWS
+DEADLOCK = b"Error: Deadlock detected. Transaction rolled back.\n"
+
+class Session(Client):
+    """A client whose replies may end in a deadlock error"""
+    def __init__(self):
+        super().__init__(PORT, timeout=10)
+
+    def reply(self):
+        """Reads the lines up to the next 'Executed.' or deadlock error"""
+        while True:
+            ends = [(self.pending.find(end), end)
+                    for end in (b"Executed.\n", DEADLOCK)]
+            ends = [(index, end) for index, end in ends if index >= 0]
+            if ends:
+                index, end = min(ends)
+                reply = self.pending[:index + len(end)]
+                self.pending = self.pending[index + len(end):]
+                return reply.decode().split("\n")[:-1]
+            data = self.sock.recv(65536)
+            if not data:
+                raise ConnectionError("server closed the connection")
+            self.pending += data
+
+    def blocked(self, wait=0.5):
+        """True if no reply arrives within wait seconds"""
+        self.sock.settimeout(wait)
+        try:
+            data = self.sock.recv(65536)
+            self.pending += data
+            return False
+        except socket.timeout:
+            return True
+        finally:
+            self.sock.settimeout(self.timeout)
+
+def insert(i):
+    return f"insert into items values ({i}, 'item{i}')"
+
+def present(client, i):
+    reply = client.execute(f"select * from items where id = {i}")
+    return f"({i}, item{i})" in reply
+
+def cleanup():
+    for path in glob.glob(DB_FILE + "*"):
+        os.remove(path)
+
+def start(extra_args):
+    run_db(DB_FILE,
+           ["create table items (id int, name varchar(32))"]
+           + [insert(i) for i in range(2, LAST_ID + 1, 2)], extra_args)
+    return start_server(DB_FILE, PORT, extra_args)
+
+def test_independent_pages():
+    print("Writing at both ends of a table from two sessions...")
+    a, b = Session(), Session()
+    a.execute("begin")
+    a.execute(insert(3))
+    b.send(insert(LAST_ID - 1))
+    if b.blocked():
+        print("FAIL: a write to another leaf waited for the transaction")
+        return False
+    b.reply()
+    a.execute("commit")
+    if not present(b, 3) or not present(a, LAST_ID - 1):
+        print("FAIL: a committed insert is missing")
+        return False
+    a.close()
+    b.close()
+    return True
+
+def test_same_page():
+    print("Writing to a leaf another session's transaction changed...")
+    a, b = Session(), Session()
+    waits = server_stats(PORT).get("lock_waits", 0)
+    a.execute("begin")
+    a.execute(insert(5))
+    b.send(insert(7))
+    if not b.blocked():
+        print("FAIL: the write did not wait for the transaction")
+        return False
+    a.execute("commit")
+    b.reply()
+    if not present(a, 5) or not present(a, 7):
+        print("FAIL: an insert is missing")
+        return False
+    if server_stats(PORT).get("lock_waits", 0) <= waits:
+        print("FAIL: the wait was not counted")
+        return False
+    a.close()
+    b.close()
+    return True
+
+def test_deadlock():
+    print("Two transactions waiting for each other...")
+    a, b = Session(), Session()
+    deadlocks = server_stats(PORT).get("deadlocks", 0)
+    a.execute("begin")
+    b.execute("begin")
+    a.execute(insert(9))
+    b.execute(insert(LAST_ID - 3))
+    a.send(insert(LAST_ID - 5))
+    if not a.blocked():
+        print("FAIL: the write did not wait for the transaction")
+        return False
+    reply = b.execute(insert(11))
+    if DEADLOCK.decode().strip() not in reply:
+        print(f"FAIL: expected a deadlock error: {reply}")
+        return False
+    a.reply()
+    a.execute("commit")
+    if "Error: Not in a transaction" not in b.execute("commit"):
+        print("FAIL: the rolled back transaction is still open")
+        return False
+
+    if not present(b, 9) or not present(b, LAST_ID - 5):
+        print("FAIL: the surviving transaction lost an insert")
+        return False
+    if present(b, 11) or present(b, LAST_ID - 3):
+        print("FAIL: the rolled back transaction left an insert behind")
+        return False
+    if server_stats(PORT).get("deadlocks", 0) != deadlocks + 1:
+        print("FAIL: the deadlock was not counted")
+        return False
+    a.close()
+    b.close()
+    return True
+
+def test_disconnect():
+    print("Disconnecting with a transaction open...")
+    a, b = Session(), Session()
+    a.execute("begin")
+    a.execute(insert(13))
+    a.close()
+    try:
+        b.execute(insert(15))
+    except socket.timeout:
+        print("FAIL: the disconnected session's locks were kept")
+        return False
+    if present(b, 13) or not present(b, 15):
+        print("FAIL: the open transaction was not rolled back")
+        return False
+    b.close()
+    return True
+
+if __name__ == "__main__":
+    for mode in ([], ["--wal"], ["--file-per-table"]):
+        cleanup()
+        server = start(mode)
+        try:
+            for test in (test_independent_pages, test_same_page,
+                         test_deadlock, test_disconnect):
+                if not test():
+                    sys.exit(1)
+            print("Transactions Test Passed!", mode)
+        finally:
+            server.kill()
+            server.wait()
+            cleanup()
+    sys.exit(0)
@@ -0,0 +1,59 @@
+import sys
+import os
+from db_helpers import insert_users, parse_stats, rows_of, run_db, user_rows
+
+DB_FILE = "test_undo.db"
+NUM_ROWS = 1000
+
+def run_test(extra_args):
+    if os.path.exists(DB_FILE):
+        os.remove(DB_FILE)
+
+    try:
+        run_db(DB_FILE, ["create table users (id int, username varchar(32), email varchar(255))"]
+                        + insert_users(range(1, NUM_ROWS + 1)), extra_args)
+
+        # Splits, new pages and deletes, all undone in one session
+        print(f"{extra_args}: rolling back inserts and deletes...")
+        output = run_db(
+            DB_FILE,
+            ["select * from users", "begin"]
+            + insert_users(range(NUM_ROWS + 1, NUM_ROWS + 301))
+            + [f"delete from users where id = {i}" for i in range(1, 301)]
+            + ["delete from users where username = 'user500'",
+               "rollback", ".stats", ".stats reset", "select * from users",
+               "select * from users where username = 'user500'", ".stats"],
+            extra_args)
+        # Both .stats dumps start with page_size
+        _, before, after = output.split("page_size ")
+        undo = parse_stats("page_size " + before)
+        scan = parse_stats("page_size " + after)
+        if undo.get("rollback_restores", 0) == 0:
+            print(f"FAIL: nothing was restored from undo images: {undo}")
+            return False
+        # Everything the scan touched was cached before the transaction
+        if scan.get("misses", 1) != 0:
+            print(f"FAIL: rollback left the cache cold: {scan}")
+            return False
+        rows = rows_of(before)
+        if rows != user_rows(range(1, NUM_ROWS + 1)) + user_rows([500]):
+            print(f"FAIL: rolled back rows differ ({len(rows)} rows)")
+            return False
+
+        # The restored pages must also be what is in the file
+        output = run_db(DB_FILE, ["select * from users"], extra_args)
+        if rows_of(output) != user_rows(range(1, NUM_ROWS + 1)):
+            print("FAIL: rows differ after reopening")
+            return False
+
+        print(f"Undo Test Passed! {extra_args}")
+        return True
+    finally:
+        if os.path.exists(DB_FILE):
+            os.remove(DB_FILE)
+
+if __name__ == "__main__":
+    for extra_args in ([], ["--mmap"], ["--compress"], ["--wal"]):
+        if not run_test(extra_args):
+            sys.exit(1)
+    sys.exit(0)
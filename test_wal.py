@@ -0,0 +1,117 @@
+import glob
+import os
+import sys
+import threading
+from db_helpers import Client, crash_db, insert_users, parse_stats, rows_of, \
+    run_db, start_server, user_rows
+
+DB_FILE = "test_wal.db"
+WAL_FILE = DB_FILE + "-wal"
+PORT = 8088
+
+def cleanup():
+    for path in glob.glob(DB_FILE + "*"):
+        os.remove(path)
+
+def test_crash_recovery():
+    print("Killing a session after a commit and inside a transaction...")
+    crash_db(DB_FILE,
+             ["create table users (id int, username varchar(32), email varchar(255))",
+              "begin"] + insert_users(range(1, 301)) + ["commit", "begin"]
+             + insert_users(range(301, 401)), ["--wal"])
+    if not os.path.exists(WAL_FILE):
+        print("FAIL: no log was left behind")
+        return False
+    if os.path.getsize(DB_FILE) != 0:
+        print("FAIL: pages reached the database file before a checkpoint")
+        return False
+
+    # A torn append after the last commit must be ignored
+    with open(WAL_FILE, "ab") as f:
+        f.write(os.urandom(1000))
+
+    output = run_db(DB_FILE, ["select * from users"])
+    if "Recovered" not in output:
+        print("FAIL: recovery did not run")
+        return False
+    if rows_of(output) != user_rows(range(1, 301)):
+        print(f"FAIL: expected the 300 committed rows, got {len(rows_of(output))}")
+        return False
+    if os.path.exists(WAL_FILE):
+        print("FAIL: log was not removed after recovery")
+        return False
+    return True
+
+def test_checkpoints():
+    print("Committing enough transactions to trigger checkpoints...")
+    commands = ["create table users (id int, username varchar(32), email varchar(255))"]
+    for batch in range(20):
+        ids = range(batch * 100 + 1, batch * 100 + 101)
+        commands += ["begin"] + insert_users(ids) + ["commit"]
+    commands += ["begin"] + insert_users(range(5001, 5011)) + ["rollback", ".stats"]
+    stats = parse_stats(run_db(DB_FILE, commands, ["--wal"]))
+    if stats.get("checkpoints", 0) < 1:
+        print(f"FAIL: the log was never checkpointed: {stats}")
+        return False
+    if os.path.exists(WAL_FILE):
+        print("FAIL: log was not removed on close")
+        return False
+
+    if rows_of(run_db(DB_FILE, ["select * from users"])) != user_rows(range(1, 2001)):
+        print("FAIL: rows differ after checkpointing")
+        return False
+    return True
+
+def test_group_commit():
+    print("Committing from several sessions at once...")
+    num_clients, num_commits = 8, 50
+    # A table per client, so the transactions never wait for each other
+    run_db(DB_FILE, [f"create table t{c} (id int, name varchar(32))"
+                     for c in range(num_clients)], ["--wal"])
+    server = start_server(DB_FILE, PORT, ["--wal"])
+    try:
+        clients = [Client(PORT) for _ in range(num_clients)]
+        def commit(c):
+            for i in range(num_commits):
+                clients[c].execute("begin")
+                clients[c].execute(f"insert into t{c} values ({i + 1}, 'x')")
+                clients[c].execute("commit")
+        threads = [threading.Thread(target=commit, args=(c,))
+                   for c in range(num_clients)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+        clients[0].send(".stats")
+        stats = parse_stats(clients[0].reply(b"deadlocks"))
+        rows = clients[0].execute(f"select * from t{num_clients - 1}")
+        for client in clients:
+            client.close()
+    finally:
+        server.kill()
+        server.wait()
+
+    commits, syncs = stats.get("wal_commits", 0), stats.get("wal_syncs", 0)
+    print(f"  {commits:.0f} commits, {syncs:.0f} syncs")
+    if commits < num_clients * num_commits:
+        print(f"FAIL: expected a log commit per COMMIT: {stats}")
+        return False
+    if not 0 < syncs < commits:
+        print(f"FAIL: concurrent commits did not share syncs: {stats}")
+        return False
+    if len(rows_of(rows)) != num_commits:
+        print("FAIL: committed rows are missing")
+        return False
+    return True
+
+if __name__ == "__main__":
+    try:
+        for test in (test_crash_recovery, test_checkpoints, test_group_commit):
+            cleanup()
+            if not test():
+                sys.exit(1)
+        print("WAL Test Passed!")
+    finally:
+        cleanup()
+    sys.exit(0)
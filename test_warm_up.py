@@ -0,0 +1,67 @@
+import struct
+import sys
+import os
+from db_helpers import insert_users, parse_stats, rows_of, run_db
+
+DB_FILE = "test_warm_up.db"
+WARM_FILE = DB_FILE + ".warm"
+NUM_ROWS = 2000
+HOT_IDS = range(1, NUM_ROWS + 1, 40)
+
+def lookups():
+    return [f"select * from users where id = {i}" for i in HOT_IDS] + [".stats"]
+
+def cleanup():
+    for path in (DB_FILE, WARM_FILE):
+        if os.path.exists(path):
+            os.remove(path)
+
+def run_test(extra_args):
+    cleanup()
+    try:
+        args = ["--cache-pages", "1024", "--warm-up"] + extra_args
+        run_db(DB_FILE,
+               ["create table users (id int, username varchar(32), email varchar(255))"]
+               + insert_users(range(1, NUM_ROWS + 1)), ["--cache-pages", "1024"])
+
+        print("Cold run...")
+        output = run_db(DB_FILE, lookups(), args)
+        rows, cold = rows_of(output), parse_stats(output)
+        if len(rows) != len(HOT_IDS):
+            print(f"FAIL: expected {len(HOT_IDS)} rows, got {len(rows)}")
+            return False
+        if not os.path.exists(WARM_FILE):
+            print("FAIL: no warm-up list written on close")
+            return False
+        with open(WARM_FILE, "rb") as f:
+            magic, page_size, count = struct.unpack("<III", f.read(12))
+        if magic != 0x4d524157 or count == 0:
+            print(f"FAIL: bad warm-up list header {magic:x} {count}")
+            return False
+
+        print("Warm run...")
+        output = run_db(DB_FILE, lookups(), args, settle=0.5)
+        rows, warm = rows_of(output), parse_stats(output)
+        if len(rows) != len(HOT_IDS):
+            print(f"FAIL: expected {len(HOT_IDS)} rows, got {len(rows)}")
+            return False
+        if warm.get("warmed_pages", 0) == 0:
+            print(f"FAIL: nothing was preloaded: {warm}")
+            return False
+        if warm.get("misses", 0) >= cold.get("misses", 0):
+            print(f"FAIL: warm misses {warm.get('misses')} not below "
+                  f"cold misses {cold.get('misses')}")
+            return False
+
+        print(f"Warm Up Test Passed! {extra_args} misses "
+              f"{cold['misses']:.0f} -> {warm['misses']:.0f}")
+        return True
+    finally:
+        cleanup()
+
+if __name__ == "__main__":
+    # mmap mode only warms the kernel page cache, so it is not covered here
+    for extra_args in ([], ["--io-uring"], ["--direct-io"]):
+        if not run_test(extra_args):
+            sys.exit(1)
+    sys.exit(0)